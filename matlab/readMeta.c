@@ -26,17 +26,19 @@ void  mexFunction( int nlhs,       mxArray *plhs[],
   int ncols, icol, nusecols, iusecol;
   int icolSpectrum, icolMimetype, mimetypeCode;
   char *mimetype;
-  int collist[METAIOMAXCOLS];
+  int *collist;
+  char *colused;
   int nrows, nread, irow;
 
   int allrows, bailed, allcols;
   double *rowlist;
   int nrowlist, irowlist;
+  const struct MetaioDirectory *dir;
 
   char colspec[1024];
 
-  int datasize[METAIOMAXCOLS], dataused[METAIOMAXCOLS];
-  void *dataptr[METAIOMAXCOLS], *newptr;
+  int *datasize, *dataused;
+  void **dataptr, *newptr;
   int size, length, i, j;
   char file[256], tablename[64], opts[64];
   int optadj, argadj;
@@ -47,8 +49,10 @@ void  mexFunction( int nlhs,       mxArray *plhs[],
   unsigned char *tempptr;
   unsigned char usave;
   float *fptr;
-  const char *colnames_p[METAIOMAXCOLS];
-  int coltype[METAIOMAXCOLS];
+  const char **colnames_p;
+  const char **selnames;
+  int nsel;
+  int *coltype;
 
   mxArray *fout, *carr;
   mxArray **mxap;
@@ -224,6 +228,13 @@ void  mexFunction( int nlhs,       mxArray *plhs[],
     return;
   }
 
+  /*-- With a row list, list the file's tables and rows so that the table
+    is opened and the rows are reached directly.  The listing is kept for
+    later calls on the same file; without it the rows are just skipped --*/
+  if ( allrows == 0 ) {
+    if ( MetaioReadDirectory( env, &dir ) != 0 ) { MetaioClearErrno( env ); }
+  }
+
   status = MetaioOpenTableOnly( env, tablename );
   if ( status != 0 ) {
     if ( strlen(tablename) ) {
@@ -247,8 +258,18 @@ void  mexFunction( int nlhs,       mxArray *plhs[],
   }
 
 
-  /*-- Clear data pointers for all columns --*/
+  /*-- Size the per-column lists to fit the table --*/
   ncols = env->ligo_lw.table.numcols;
+  collist = mxCalloc( ncols+1, sizeof(*collist) );
+  colused = mxCalloc( ncols+1, sizeof(*colused) );
+  datasize = mxCalloc( ncols+1, sizeof(*datasize) );
+  dataused = mxCalloc( ncols+1, sizeof(*dataused) );
+  dataptr = mxCalloc( ncols+1, sizeof(*dataptr) );
+  colnames_p = mxCalloc( ncols+1, sizeof(*colnames_p) );
+  selnames = mxCalloc( ncols+2, sizeof(*selnames) );
+  coltype = mxCalloc( ncols+1, sizeof(*coltype) );
+
+  /*-- Clear data pointers for all columns --*/
   for ( icol=0; icol<ncols; icol++ ) {
     dataptr[icol] = NULL;
   }
@@ -291,9 +312,11 @@ void  mexFunction( int nlhs,       mxArray *plhs[],
 	    mexPrintf( "Warning: column '%s' does not exist in table '%s'\n",
 		       vptr, env->ligo_lw.table );
 	  }
-	} else {
-	  /*-- Append this column index to the list --*/
+	} else if ( ! colused[icol] ) {
+	  /*-- Append this column index to the list, once, so the list
+	    never holds more than ncols entries --*/
 	  collist[nusecols] = icol;
+	  colused[icol] = 1;
 	  nusecols++;
 	}
       }
@@ -359,11 +382,39 @@ void  mexFunction( int nlhs,       mxArray *plhs[],
   }
 
 
+  /*-- Only parse the columns which are being read (plus the mimetype, which
+    is needed to interpret the spectrum).  The column list holds each column
+    once, so with the mimetype and the terminator there are at most ncols+2
+    names --*/
+  if ( allcols == 0 ) {
+    nsel = 0;
+    for ( iusecol=0; iusecol<nusecols; iusecol++ ) {
+      selnames[nsel] = MetaioColumnName( env, collist[iusecol] );
+      nsel++;
+    }
+    if ( icolMimetype >= 0 && ! colused[icolMimetype] ) {
+      selnames[nsel] = MetaioColumnName( env, icolMimetype );
+      nsel++;
+    }
+    selnames[nsel] = NULL;
+    MetaioSelectColumns( env, selnames );
+  }
+
+
   /*------ Loop over rows in the file ------*/
 
   nrows = 0;
   nread = 0;
-  while ( (status=MetaioGetRow(env)) == 1 ) {
+  while ( 1 ) {
+    /*-- Pass over the rows before the next listed row without parsing them --*/
+    if ( allrows == 0 && irowlist < nrowlist &&
+	 (int)rowlist[irowlist] > nrows + 1 ) {
+      status = MetaioSeekRow( env, (int)rowlist[irowlist] - 1 );
+      nrows = env->file->nrows;
+      if ( status != 0 ) { break; }
+    }
+
+    if ( (status=MetaioGetRow(env)) != 1 ) { break; }
     nrows++;
 
     /*-- Make sure we should process this row --*/
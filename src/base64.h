@@ -29,6 +29,14 @@
    integer >= n/k, i.e., the ceiling of n/k.  */
 # define BASE64_LENGTH(inlen) ((((inlen) + 2) / 3) * 4)
 
+/* The state of decoding a base64 string given in pieces */
+struct base64_decode_context
+{
+  unsigned int i;
+  char buf[4];
+  bool padded;
+};
+
 extern bool isbase64 (char ch);
 
 extern void base64_encode (const char *restrict in, size_t inlen,
@@ -39,6 +47,12 @@ extern size_t base64_encode_alloc (const char *in, size_t inlen, char **out);
 extern bool base64_decode (const char *restrict in, size_t inlen,
 			   char *restrict out, size_t *outlen);
 
+extern void base64_decode_ctx_init (struct base64_decode_context *ctx);
+
+extern bool base64_decode_ctx (struct base64_decode_context *ctx,
+			       const char *restrict in, size_t inlen,
+			       char *restrict out, size_t *outlen);
+
 extern bool base64_decode_alloc (const char *in, size_t inlen,
 				 char **out, size_t *outlen);
 
@@ -12,7 +12,7 @@ Uses the "Metaio" parsing code by Philip Charlton
 /*===========================================================================*/
 void PrintUsage( int flag )
 {
-  printf( "Usage: lwtcut <infile> [-t <table>] [<condition>] [-r <rowspec>] [-o <outfile>]\n" );
+  printf( "Usage: lwtcut <infile> [-t <table>] [<condition>] [-r <rowspec>] [-o <outfile>] [-g]\n" );
   if ( flag == 0 ) {
     printf( "Type 'lwtcut' without arguments for full usage information\n" );
     return;
@@ -44,7 +44,11 @@ void PrintUsage( int flag )
   printf( "<outfile> is the name of the file to generate.  A LIGO_LW document, containing\n" );
   printf( "    the table with only the rows satisfying the condition, is written to this\n" );
   printf( "    file.  If no output file is specified, then this utility simply counts the\n" );
-  printf( "    number of matching rows and prints it to standard output.\n" );
+  printf( "    number of matching rows and prints it to standard output.  If the name\n" );
+  printf( "    ends in '.gz', the file is written gzip-compressed.\n" );
+  printf( "-g writes <outfile> gzip-compressed whatever its name, and saves an index of\n" );
+  printf( "    it as <outfile>.gzidx, so that its rows can be reached without\n" );
+  printf( "    decompressing the whole file.\n" );
   printf( "Examples:\n" );
   printf( "  lwtcut myevents.xml 'snr > 8'\n" );
   printf( "  lwtcut myevents.xml 'ifo==L1' -o myL1events.xml\n" );
@@ -63,6 +67,7 @@ int main( int argc, char **argv )
   char *tablename=NULL;
   char *condition=NULL;
   char *outfile=NULL;
+  int gzindex=0;
   size_t vallen;
   int nvals;
   int valid, status, colindex;
@@ -281,6 +286,15 @@ int main( int argc, char **argv )
 
       break;
 
+    case 'g':   /*-- Compress the output file and index it --*/
+      if ( val != NULL ) {
+	printf( "Option -g does not take a value\n" );
+	PrintUsage(0); return 1;
+      }
+      gzindex = 1;
+      opt = '\0';
+      break;
+
     default:
       printf( "Invalid option -%c\n", opt );
       PrintUsage(0); return 1;
@@ -425,9 +439,21 @@ int main( int argc, char **argv )
     coltype = inEnv->ligo_lw.table.col[colindex].data_type;
   }
 
+  if ( ! outfile ) {
+    /*-- Only counting, so just parse the column in the condition (if any) --*/
+    const char *selnames[2] = { NULL, NULL };
+    if ( condition ) { selnames[0] = colname; }
+    MetaioSelectColumns( inEnv, selnames );
+  }
+
   if ( outfile ) {
     /*-- Open the output file --*/
-    status = MetaioCreate( outEnv, outfile );
+    if ( gzindex ) {
+      struct MetaioCompression options = { 0, 0, 1 };
+      status = MetaioCreateCompressed( outEnv, outfile, &options );
+    } else {
+      status = MetaioCreate( outEnv, outfile );
+    }
     if ( status != 0 ) {
       printf( "Error opening output file %s\n", outfile );
       MetaioAbort( inEnv );
@@ -451,7 +477,15 @@ int main( int argc, char **argv )
     irange = 0;
   }
 
-  while ( (status=MetaioGetRow(inEnv)) == 1 ) {
+  while ( 1 ) {
+    /*-- Pass over the rows before the next range without parsing them --*/
+    if ( active == 0 && target > irow + 1 ) {
+      status = MetaioSeekRow( inEnv, target - 1 );
+      irow = inEnv->file->nrows;
+      if ( status != 0 ) { break; }
+    }
+
+    if ( (status=MetaioGetRow(inEnv)) != 1 ) { break; }
     irow++;
 
     if ( irow == target ) {
@@ -6,6 +6,7 @@ Modified Sep 2001 by Peter Shawhan: Add "-x" option
 =============================================================================*/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "metaio.h"
 
@@ -49,11 +50,10 @@ int main( int argc, char **argv )
   int icol, jcol, irow, idiff;
   int tndiff, ndiff, firstdiff;
   int changed;
-  int tdifflist[METAIOMAXCOLS], difflist[METAIOMAXCOLS];
+  int *tdifflist, *difflist;
   int stat1, stat2, status;
-  char *icptr, *jcptr;
   int initval;
-  int imatch[METAIOMAXCOLS], jmatch[METAIOMAXCOLS];
+  int *imatch, *jmatch;
 
   struct MetaioParseEnvironment parseEnv1, parseEnv2;
   const MetaioParseEnv env1 = &parseEnv1;
@@ -199,6 +199,18 @@ int main( int argc, char **argv )
     return 2;
   }
 
+  /*-- Size the column lists to fit the tables --*/
+  tdifflist = calloc( env1->ligo_lw.table.numcols + 1, sizeof(int) );
+  difflist = calloc( env1->ligo_lw.table.numcols + 1, sizeof(int) );
+  imatch = calloc( env1->ligo_lw.table.numcols + 1, sizeof(int) );
+  jmatch = calloc( env2->ligo_lw.table.numcols + 1, sizeof(int) );
+  if ( !tdifflist || !difflist || !imatch || !jmatch ) {
+    printf( "Error: out of memory\n" );
+    MetaioAbort( env1 );
+    MetaioAbort( env2 );
+    return 2;
+  }
+
   /*-- Initialize "match" indexes for all columns in both tables --*/
   if ( colspeclen == -1 ) {
     initval = -1;   /* Means 'no match' */
@@ -216,14 +228,10 @@ int main( int argc, char **argv )
   if ( colspeclen == -1 ) {
     /*-- Compare all columns (except those specified with '-x') --*/
 
+    MetaioMatchColumns( env1, env2, imatch );
     for ( icol=0; icol < env1->ligo_lw.table.numcols; icol++ ) {
-      icptr = MetaioColumnName( env1, icol );
-      for ( jcol=0; jcol < env2->ligo_lw.table.numcols; jcol++ ) {
-	jcptr = MetaioColumnName( env2, jcol );
-	if ( strcasecmp(icptr,jcptr) == 0 ) {
-	  imatch[icol] = jcol;
-	  jmatch[jcol] = icol;
-	}
+      if ( imatch[icol] >= 0 ) {
+	jmatch[imatch[icol]] = icol;
       }
     }
 
@@ -450,5 +458,10 @@ int main( int argc, char **argv )
   MetaioClose(env1);
   MetaioClose(env2);
 
+  free( tdifflist );
+  free( difflist );
+  free( imatch );
+  free( jmatch );
+
   return retval;
 }
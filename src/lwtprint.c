@@ -62,8 +62,10 @@ int main( int argc, char **argv )
   char delim[16] = ",";    /*-- Delimiter string for output --*/
   char* char_u_format = "";
   int istart, iend, iovr1, iovr2;
-  int delta, irange;
+  int delta, irange = 0;
   int ncols=0, collist[256];
+  const char *selnames[257];
+  int nsel;
   int iarg, irow, i, j, icol, excol, active, target;
 
   struct MetaioParseEnvironment parseEnv;
@@ -475,6 +477,20 @@ int main( int argc, char **argv )
   }
 
 
+  /*-- Only parse the columns which will be printed --*/
+  if ( colspeclen != -1 || colexcllen > 0 ) {
+    nsel = 0;
+    for ( i=0; i < ncols; i++ ) {
+      if ( collist[i] != PSEUDOCOL_ROW ) {
+	selnames[nsel] = MetaioColumnName( env, collist[i] );
+	nsel++;
+      }
+    }
+    selnames[nsel] = NULL;
+    MetaioSelectColumns( env, selnames );
+  }
+
+
   /*-- Loop over rows in the file --*/
 
   irow = 0;
@@ -490,7 +506,15 @@ int main( int argc, char **argv )
     irange = 0;
   }
 
-  while ( (status=MetaioGetRow(env)) == 1 ) {
+  while ( 1 ) {
+    /*-- Pass over the rows before the next range without parsing them --*/
+    if ( active == 0 && target > irow + 1 ) {
+      status = MetaioSeekRow( env, target - 1 );
+      irow = env->file->nrows;
+      if ( status != 0 ) { break; }
+    }
+
+    if ( (status=MetaioGetRow(env)) != 1 ) { break; }
     irow++;
 
     if ( irow == target ) {
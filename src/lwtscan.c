@@ -14,10 +14,14 @@ Uses the "Metaio" parsing code by Philip Charlton
 /*===========================================================================*/
 void PrintUsage( void )
 {
-  printf( "Usage: lwtscan <file> [-t <table>]\n" );
+  printf( "Usage: lwtscan <file> [-t <table>] [-l] [-g]\n" );
   printf( "<table> lets you scan a particular table from a file"
 	  " containing multiple\ntables.  If omitted, the first table"
 	  " in the file is scanned.\n" );
+  printf( "-l lists all of the tables in the file.\n" );
+  printf( "-g saves an index of a gzip-compressed file as <file>.gzidx, so"
+	  " that its\ntables can be reached without decompressing the"
+	  " whole file.\n" );
   return;
 }
 
@@ -33,6 +37,11 @@ int main( int argc, char **argv )
   size_t vallen;
   int nvals;
   int nrows=0;
+  int listall=0;
+  int gzindex=0;
+  const struct MetaioDirectory *dir;
+  char *colname;
+  int itab;
 
   struct MetaioParseEnvironment parseEnv;
   const MetaioParseEnv env = &parseEnv;
@@ -87,6 +96,24 @@ int main( int argc, char **argv )
       if ( val != NULL ) { opt = '\0'; }
       break;
 
+    case 'l':   /*-- List all tables --*/
+      if ( val != NULL ) {
+	printf( "Option -l does not take a value\n" );
+	PrintUsage(); return 1;
+      }
+      listall = 1;
+      opt = '\0';
+      break;
+
+    case 'g':   /*-- Save a gzip index --*/
+      if ( val != NULL ) {
+	printf( "Option -g does not take a value\n" );
+	PrintUsage(); return 1;
+      }
+      gzindex = 1;
+      opt = '\0';
+      break;
+
     default:
       printf( "Invalid option -%c\n", opt );
       PrintUsage(); return 1;
@@ -101,6 +128,49 @@ int main( int argc, char **argv )
   }
 
 
+  /*-- Save the index of a compressed file --*/
+  if ( gzindex ) {
+    if ( MetaioOpenFile( env, file ) != 0 ||
+	 MetaioWriteGzipIndex( env, NULL ) != 0 ) {
+      printf( "Error indexing file %s\n", file );
+      printf( "%s\n", env->mierrmsg.data );
+      MetaioAbort( env );
+      return 2;
+    }
+    MetaioAbort( env );
+    if ( ! listall ) { return 0; }
+  }
+
+  /*-- List all tables, from the directory of the file --*/
+  if ( listall ) {
+    if ( MetaioOpenFile( env, file ) != 0 ||
+	 MetaioReadDirectory( env, &dir ) != 0 ) {
+      printf( "Error reading file %s\n", file );
+      printf( "%s\n", env->mierrmsg.data );
+      MetaioAbort( env );
+      return 2;
+    }
+
+    if ( dir->comment != 0 && strlen(dir->comment) > 0 ) {
+      printf( "Comment: %s\n", dir->comment );
+    }
+
+    for ( itab=0; itab < dir->ntables; itab++ ) {
+      printf( "Table %s\n", dir->table[itab].name );
+      for ( icol=0; icol < dir->table[itab].numcols; icol++ ) {
+	colname = strrchr( dir->table[itab].col[icol].name, ':' );
+	printf ( "  %-20s %s\n",
+		 colname == 0 ? dir->table[itab].col[icol].name : colname+1,
+		 MetaioTypeText( dir->table[itab].col[icol].data_type )
+		 );
+      }
+      printf( "%lld rows\n", dir->table[itab].nrows );
+    }
+
+    MetaioAbort( env );
+    return 0;
+  }
+
   /*-- Open the file --*/
   status = MetaioOpenTable( env, file, tablename );
   if ( status != 0 ) {
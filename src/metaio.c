@@ -42,11 +42,27 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _POSIX_MAPPED_FILES
+#include <sys/mman.h>
+#endif
+#ifdef _POSIX_THREADS
+#include <pthread.h>
+#ifdef __ATOMIC_SEQ_CST
+#define METAIO_READAHEAD 1
+#endif
+#endif
 
 #include "config.h"
 #include "metaio.h"
 #include "base64.h"
+#include "numeric.h"
+#include "scan.h"
 #include "ligo_lw_header.h"
 
 #ifdef  DEBUG
@@ -61,54 +77,7 @@
 #include <zlib.h>
 
 #define gzclose(fp) gzclose((gzFile)(fp))
-#define gzgetc(fp) gzgetc((gzFile)(fp))
-#define gzungetc(c,fp) gzungetc(c,(gzFile)(fp))
-
-/*
- * Warning: This is not a fully implemented scanf routine!
- * Warning: Only a single conversion to a numeric type is supported!
- */
-
-static int gzvscanf( gzFile file, const char *fmt, va_list ap )
-{
-    static const char terminators[] = {',', '\n', '\\', '\"', '\0'};
-    char buf[4096];
-    size_t i;
-    for ( i = 0; i < sizeof(buf); i++ ) {
-        int c = gzgetc( file );
-        if ( c == -1 )
-        {
-            /* error */
-#if 0
-            /* how to extract error message */
-            int errnum;
-            const char *msg = gzerror( file, &errnum );
-#endif
-            return EOF;	/* like C library's vscanf() */
-        }
-        if ( strchr( terminators, c ) )
-        {
-            /* end of field */
-            gzungetc( c, file );
-            buf[i] = '\0';
-            return vsscanf( buf, fmt, ap );
-        }
-        /* append and continue */
-        buf[i] = c;
-    }
-    /* buffer too small */
-    return EOF;
-}
-
-static int gzscanf( gzFile file, const char *fmt, ... )
-{
-    int c;
-    va_list ap;
-    va_start( ap, fmt );
-    c = gzvscanf( file, fmt, ap );
-    va_end( ap );
-    return c;
-}
+#define gzread(fp,buf,len) gzread((gzFile)(fp),buf,len)
 
 static int geterrno( gzFile file, const char **msg )
 {
@@ -159,9 +128,14 @@ static int geterrno( gzFile file, const char **msg )
 
 #define gzopen(path,mode) fopen(path,mode)
 #define gzclose(fp) fclose(fp)
-#define gzgetc(fp) fgetc(fp)
-#define gzungetc(c,fp) ungetc(c,fp)
-#define gzscanf fscanf
+
+static int gzread( FILE *file, void *buf, unsigned len )
+{
+    size_t n = fread(buf, 1, len, file);
+    if(n == 0 && ferror(file))
+        return -1;
+    return n;
+}
 
 static int geterrno( FILE *file, const char **msg )
 {
@@ -257,6 +231,156 @@ static const struct {
     {{"complex_16", NULL}}
 };
 
+/*
+ * The strings of the table header -- the names and comments of the
+ * LIGO_LW element and the table, the column names and the stream
+ * attributes, and the names of the file and the table sought -- are
+ * carved out of an arena owned by the parse environment.  They are laid
+ * out together in the order in which they are read, and are all freed at
+ * once when the environment is.  Each string is preceded by the size of
+ * its allocation, so that assign_cstr() can overwrite it in place with
+ * anything that fits.
+ *
+ * The arena's blocks come from the functions set with MetaioSetAllocator(),
+ * by default malloc() and free().  An arena remembers the functions it was
+ * created with, so changing them only affects arenas created later.
+ */
+
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_ALIGN sizeof(union { void *p; long long l; double d; })
+
+struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;            /* The number of bytes after the header */
+    size_t used;
+};
+
+struct Arena {
+    struct ArenaBlock *blocks;  /* The block being filled comes first */
+    MetaioAllocFunc alloc;
+    MetaioFreeFunc release;
+    void *data;
+};
+
+static void *default_alloc(size_t size, void *data)
+{
+    (void) data;
+    return malloc(size);
+}
+
+static void default_free(void *ptr, void *data)
+{
+    (void) data;
+    free(ptr);
+}
+
+static MetaioAllocFunc arena_alloc_func = default_alloc;
+static MetaioFreeFunc arena_free_func = default_free;
+static void *arena_func_data = 0;
+
+/* The space taken by x bytes rounded up to the alignment of the arena */
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+/*
+ * Allocate size bytes from the arena of env, creating the arena if need
+ * be.  Returns NULL if memory runs out.
+ */
+
+static
+void *arena_alloc(MetaioParseEnv const env, size_t size)
+{
+    struct Arena *arena = env->arena;
+    struct ArenaBlock *block;
+    const size_t need = ARENA_ROUND(sizeof(size_t)) + ARENA_ROUND(size);
+    char *p;
+
+    if(!arena)
+    {
+        arena = arena_alloc_func(sizeof(*arena), arena_func_data);
+        if(!arena)
+            return NULL;
+        arena->blocks = 0;
+        arena->alloc = arena_alloc_func;
+        arena->release = arena_free_func;
+        arena->data = arena_func_data;
+        env->arena = arena;
+    }
+
+    block = arena->blocks;
+    if(!block || block->size - block->used < need)
+    {
+        /* Each block is twice the size of the last, up to a limit */
+        size_t bsize = ARENA_BLOCK_SIZE;
+
+        if(block)
+            bsize = block->size < 8 * ARENA_BLOCK_SIZE ?
+                    2 * block->size : 16 * ARENA_BLOCK_SIZE;
+
+        if(bsize < need)
+            bsize = need;
+        block = arena->alloc(ARENA_ROUND(sizeof(*block)) + bsize, arena->data);
+        if(!block)
+            return NULL;
+        block->size = bsize;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    p = (char *) block + ARENA_ROUND(sizeof(*block)) + block->used;
+    block->used += need;
+    *(size_t *) p = need - ARENA_ROUND(sizeof(size_t));
+    return p + ARENA_ROUND(sizeof(size_t));
+}
+
+/*
+ * The number of bytes available at p, which came from arena_alloc()
+ */
+
+static
+size_t arena_capacity(const void * const p)
+{
+    return *(const size_t *) ((const char *) p - ARENA_ROUND(sizeof(size_t)));
+}
+
+/*
+ * Free the arena of env and everything in it
+ */
+
+static
+void release_arena(MetaioParseEnv const env)
+{
+    struct Arena * const arena = env->arena;
+    struct ArenaBlock *block, *next;
+
+    if(!arena)
+        return;
+    for(block = arena->blocks; block; block = next)
+    {
+        next = block->next;
+        arena->release(block, arena->data);
+    }
+    arena->release(arena, arena->data);
+    env->arena = 0;
+}
+
+void MetaioSetAllocator(MetaioAllocFunc alloc, MetaioFreeFunc release,
+                        void *data)
+{
+    if(alloc && release)
+    {
+        arena_alloc_func = alloc;
+        arena_free_func = release;
+        arena_func_data = data;
+    }
+    else
+    {
+        arena_alloc_func = default_alloc;
+        arena_free_func = default_free;
+        arena_func_data = 0;
+    }
+}
+
 /*
  * Resize a string
  */
@@ -317,17 +441,52 @@ int append_cstr(struct MetaioString * const str, const char* const s)
 }
 
 /*
- * Assign a null-terminated C-style string to a char*, assuming the
- * original char* was dynamically allocated. This is to try and avoid
- * memory leaks.
+ * Append n characters to the end of a MetaioString
+ */
+
+static
+int append_chars(struct MetaioString * const str, const char* const s, size_t n)
+{
+    size_t new_len = str->len + n;
+
+    if (new_len >= str->datasize)
+        if(string_resize(str, new_len) < 0)
+            return -1;
+
+    memcpy(&str->data[str->len], s, n);
+    str->len = new_len;
+    str->data[str->len] = '\0';
+    return 0;
+}
+
+/*
+ * Assign a null-terminated C-style string to a char* in the arena of env,
+ * reusing the memory it points to if the string fits there.  A NULL src
+ * makes *dest NULL.  Returns 0 on success, or -1 if memory runs out.
  */
 
 static
-char *assign_cstr(char **dest, const char * const src)
+int assign_cstr(MetaioParseEnv const env, char **dest, const char * const src)
 {
-    free(*dest);
-    *dest = strdup(src);
-    return *dest;
+    size_t len;
+
+    if (!src)
+    {
+        *dest = NULL;
+        return 0;
+    }
+
+    len = strlen(src);
+    if (!*dest || arena_capacity(*dest) <= len)
+    {
+        char * const copy = arena_alloc(env, len + 1);
+        if (!copy)
+            return -1;
+        *dest = copy;
+    }
+
+    memmove(*dest, src, len + 1);
+    return 0;
 }
 
 /*
@@ -423,7 +582,58 @@ void MetaioClearErrno(MetaioParseEnv const env)
 
 const char *MetaioGetErrorMessage(MetaioParseEnv const env)
 {
-    return env->mierrmsg.data;
+    return env->mierrmsg.len ? env->mierrmsg.data : NULL;
+}
+
+/*
+ * Try to map an uncompressed regular file into memory in its entirety, so
+ * that the tokenizer can work directly on the file's pages in the page
+ * cache rather than on copies read into the input buffer.  Compressed
+ * files, pipes, empty files and anything that cannot be mapped are left to
+ * be read with gzread() instead.
+ *
+ * Returns 0 if the file was mapped, non-zero otherwise.
+ */
+
+static
+int map_file(MetaioParseEnv const env, const char* const filename)
+{
+#ifdef _POSIX_MAPPED_FILES
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    unsigned char magic[2];
+    struct stat st;
+    void *map;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return 1;
+
+    /* Only regular files can be mapped, and gzip data must be inflated */
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+        (size_t) st.st_size != (unsigned long long) st.st_size ||
+        (pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b))
+    {
+        close(fd);
+        return 1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 1;
+#ifdef MADV_SEQUENTIAL
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+    in->data = in->next = map;
+    in->end = in->data + st.st_size;
+    in->datasize = st.st_size;
+    in->pos = st.st_size;
+    in->mapped = 1;
+    return 0;
+#else
+    return 1;
+#endif
 }
 
 /*
@@ -435,29 +645,28 @@ const char *MetaioGetErrorMessage(MetaioParseEnv const env)
  * parser could conceivably be used in threaded environments.
  */
 
+static int start_parse_env(MetaioParseEnv const env,
+                           const char* const filename, const char* mode);
+static void forget_plan(MetaioParseEnv const env);
+static int flush_output(FILE *fp, struct MetaioBuffer *out);
+
 static
 int init_parse_env(MetaioParseEnv const env, const char* const filename,
                    const char* mode )
 {
-    int i = 0;
-
     /* Error handling must be initialized first */
     MetaioClearErrno(env);
     env->mierrmsg.data = 0;
     env->mierrmsg.len = 0;
     env->mierrmsg.datasize = 0;
 
+    env->arena = 0;
+    env->plan = 0;
+
     env->file = &(env->fileRec);
-    env->file->name = strdup(filename);
-    env->file->fp = 0;
-    env->file->lineno = 1;
-    env->file->charno = 1;
-    env->file->nrows = 0;
-    env->file->mode = mode[0];
+    env->file->name = 0;
     env->file->tablename = NULL;
 
-    env->token = UNKNOWN;
-
     env->buffer.data = 0;
     env->buffer.len = 0;
     env->buffer.datasize = 0;
@@ -467,23 +676,65 @@ int init_parse_env(MetaioParseEnv const env, const char* const filename,
 
     env->ligo_lw.table.name = 0;
     env->ligo_lw.table.comment = 0;
-    env->ligo_lw.table.maxcols = METAIOMAXCOLS;
-    env->ligo_lw.table.numcols = 0;
-    
-    for (i = 0; i < METAIOMAXCOLS; ++i)
-    {
-        env->ligo_lw.table.col[i].name = 0;
-        env->ligo_lw.table.col[i].data_type = METAIO_TYPE_UNKNOWN;
-    }
+    env->ligo_lw.table.col = 0;
+    env->ligo_lw.table.elt = 0;
+    env->ligo_lw.table.maxcols = 0;
+    env->ligo_lw.table.colhash = 0;
 
     env->ligo_lw.table.stream.name = 0;
     env->ligo_lw.table.stream.type = 0;
+
+    return start_parse_env(env, filename, mode);
+}
+
+/*
+ * Set up the parse state for a new file in an environment initialized
+ * before, keeping the memory it holds, and open the file.
+ */
+
+static
+int start_parse_env(MetaioParseEnv const env, const char* const filename,
+                    const char* mode )
+{
+    assign_cstr(env, &env->file->name, filename);
+    env->file->fp = 0;
+    env->file->lineno = 1;
+    env->file->charno = 1;
+    env->file->nrows = 0;
+    env->file->mode = mode[0];
+    env->file->inbuf.data = 0;
+    env->file->inbuf.next = 0;
+    env->file->inbuf.end = 0;
+    env->file->inbuf.datasize = 0;
+    env->file->inbuf.mapped = 0;
+    env->file->inbuf.reader = 0;
+    env->file->inbuf.pos = 0;
+    env->file->inbuf.gzip = 0;
+    env->file->entry = 0;
+    env->file->outbuf.data = 0;
+    env->file->outbuf.next = 0;
+    env->file->outbuf.end = 0;
+    env->file->outbuf.datasize = 0;
+    env->file->outbuf.gzip = 0;
+    env->file->tables = 0;
+    env->file->table_open = 0;
+
+    env->token = UNKNOWN;
+
+    env->buffer.len = 0;
+
+    env->ligo_lw.table.numcols = 0;
+    env->ligo_lw.table.hashsize = 0;
     env->ligo_lw.table.stream.delimiter = '\0';
+    forget_plan(env);
 
     /*-- Now try to open the file --*/
     switch ( mode[0] )
     {
     case 'r':
+        /* Plain files are parsed straight out of a memory mapping */
+        if (!map_file(env, filename))
+            break;
         if (!(env->file->fp = gzopen(filename, "r")))
         {
             const char *msg;
@@ -509,30 +760,63 @@ int init_parse_env(MetaioParseEnv const env, const char* const filename,
     return 0;
 }
 
+#ifdef METAIO_READAHEAD
+struct ReadAhead;
+static void stop_reader(struct ReadAhead * const r);
+#endif
+#ifdef HAVE_LIBZ
+struct GzipCursor;
+static void close_cursor(struct GzipCursor * const c);
+struct GzipWriter;
+static int finish_writer(struct GzipWriter * const w,
+                         struct MetaioBuffer * const out);
+#endif
+
 /*
- * Destroy the parse environment. Should usually only be called when
- * parsing is completed.
- *
- * FIXME:  any memory that might have been allocated for an error message
- * in the mierrmsg element is leaked.  the memory needs to be left intact
- * so that errors that occur in this function can be reported by the
- * calling code.  the amount of leaked memory is typically a few hundred
- * bytes per parsing pass (i.e., per table), and so in a long-running
- * program that parses, say, 10 tables from each of 1000 files, several
- * megabytes will be lost.  valgrind will report this as memory lost via a
- * call to string_resize().
+ * Let go of the input buffer
  */
 
 static
-int destroy_parse_env(MetaioParseEnv const env)
+void release_input(MetaioParseEnv const env)
 {
-    int ret = 0;
+    struct MetaioBuffer * const in = &env->file->inbuf;
+
+#ifdef METAIO_READAHEAD
+    if (in->reader)
+    {
+        /* The buffer is one of the reader's blocks */
+        stop_reader(in->reader);
+        in->reader = 0;
+        in->data = 0;
+    }
+#endif
+#ifdef _POSIX_MAPPED_FILES
+    if (in->mapped)
+        munmap(in->data, in->datasize);
+    else
+#endif
+        free(in->data);
+    in->data = 0;
+    in->next = 0;
+    in->end = 0;
+    in->datasize = 0;
+    in->mapped = 0;
+}
+
+/*
+ * Free the memory held by the elements of the current row.  Slots beyond
+ * numcols are included when all is true.
+ */
+
+static
+void free_row(MetaioParseEnv const env, int all)
+{
+    const int n = all ? env->ligo_lw.table.maxcols : env->ligo_lw.table.numcols;
     int i = 0;
 
-    for (i = 0; i < env->ligo_lw.table.numcols; i++)
+    for (i = 0; i < n; i++)
     {
-        /* Delete the row data */
-        enum METAIO_Type type = env->ligo_lw.table.elt[i].col->data_type;
+        enum METAIO_Type type = env->ligo_lw.table.col[i].data_type;
 
         if(type == METAIO_TYPE_LSTRING || type == METAIO_TYPE_ILWD_CHAR || type == METAIO_TYPE_CHAR_S || type == METAIO_TYPE_CHAR_V)
         {
@@ -548,50 +832,79 @@ int destroy_parse_env(MetaioParseEnv const env)
             env->ligo_lw.table.elt[i].data.blob.len = 0;
             env->ligo_lw.table.elt[i].data.blob.datasize = 0;
         }
-        
-        env->ligo_lw.table.elt[i].col = 0;
-
-        /* Delete the column data */
-        free(env->ligo_lw.table.col[i].name);
-        env->ligo_lw.table.col[i].name = 0;
     }
+}
 
-    /* Delete the stream */
-    free(env->ligo_lw.table.stream.name);
-    env->ligo_lw.table.stream.name = 0;
-
-    free(env->ligo_lw.table.stream.type);
-    env->ligo_lw.table.stream.type = 0;
-
-    /* Delete the table */
-    free(env->ligo_lw.table.name);
-    env->ligo_lw.table.name = 0;
-
-    free(env->ligo_lw.table.comment);
-    env->ligo_lw.table.comment = 0;
-
-    /* Delete the ligo_lw */
-    free(env->ligo_lw.name);
-    env->ligo_lw.name = 0;
+/*
+ * Close the file and free the memory held by the parse environment.
+ * Should usually only be called when parsing is completed.  If keep is
+ * true, only the file is closed:  the memory is kept for the next file
+ * opened with MetaioReopen(), to be freed by a later call without keep.
+ *
+ * FIXME:  any memory that might have been allocated for an error message
+ * in the mierrmsg element is leaked.  the memory needs to be left intact
+ * so that errors that occur in this function can be reported by the
+ * calling code.  MetaioReopen() reuses it, so a program that reads many
+ * files through one environment that way loses it only once; otherwise
+ * the amount of leaked memory is typically a few hundred bytes per
+ * parsing pass (i.e., per table).  valgrind will report this as memory
+ * lost via a call to string_resize().
+ */
 
-    free(env->ligo_lw.comment);
-    env->ligo_lw.comment = 0;
+static
+int release_parse_env(MetaioParseEnv const env, int keep)
+{
+    int ret = 0;
 
-    /* Delete the buffer */
-    if (env->buffer.data != 0 && env->buffer.datasize != 0)
+    if (!keep)
     {
-        free(env->buffer.data);
-        env->buffer.data = 0;
-        env->buffer.len = 0;
-        env->buffer.datasize = 0;
-    }
+        /* Delete the row data, including any left in slots beyond numcols
+         * by an earlier, wider table */
+        free_row(env, 1);
 
-    /* Delete the file */
-    free(env->file->name);
-    env->file->name = 0;
+        /* Delete the column data */
+        free(env->ligo_lw.table.col);
+        free(env->ligo_lw.table.elt);
+        env->ligo_lw.table.col = 0;
+        env->ligo_lw.table.elt = 0;
+        env->ligo_lw.table.maxcols = 0;
+        env->ligo_lw.table.numcols = 0;
+
+        /* Delete the strings of the header, which are all in the arena */
+        release_arena(env);
+        env->ligo_lw.table.colhash = 0;
+        env->ligo_lw.table.hashsize = 0;
+        env->plan = 0;
+        env->ligo_lw.table.stream.name = 0;
+        env->ligo_lw.table.stream.type = 0;
+        env->ligo_lw.table.name = 0;
+        env->ligo_lw.table.comment = 0;
+        env->ligo_lw.name = 0;
+        env->ligo_lw.comment = 0;
+        env->file->name = 0;
+        env->file->tablename = 0;
+
+        /* Delete the buffer */
+        if (env->buffer.data != 0 && env->buffer.datasize != 0)
+        {
+            free(env->buffer.data);
+            env->buffer.data = 0;
+            env->buffer.len = 0;
+            env->buffer.datasize = 0;
+        }
+    }
+    else if (env->file->tablename)
+        /* The empty name matches any table */
+        env->file->tablename[0] = '\0';
 
-    free(env->file->tablename);
-    env->file->tablename = 0;
+    /* Delete the input buffer */
+    release_input(env);
+    env->file->inbuf.pos = 0;
+#ifdef HAVE_LIBZ
+    if (env->file->inbuf.gzip)
+        close_cursor(env->file->inbuf.gzip);
+#endif
+    env->file->inbuf.gzip = 0;
 
     if (env->file->fp != 0)
     {
@@ -605,7 +918,22 @@ int destroy_parse_env(MetaioParseEnv const env)
                 ret = 0;
         }
         else if ( env->file->mode == 'w' )
+        {
+            /* Write out the rows still in the buffer */
+            int flushed;
+
+#ifdef HAVE_LIBZ
+            if (env->file->outbuf.gzip)
+                flushed = finish_writer(env->file->outbuf.gzip, &env->file->outbuf);
+            else
+#endif
+                flushed = flush_output(env->file->fp, &env->file->outbuf);
+            env->file->outbuf.gzip = 0;
+
             ret = fclose(env->file->fp);
+            if (flushed < 0 && ret == 0)
+                ret = EOF;
+        }
         else
         {
             fprintf(stderr, "BUG at %s line %d\n", __FILE__, __LINE__);
@@ -615,6 +943,13 @@ int destroy_parse_env(MetaioParseEnv const env)
         env->file->fp = 0;
     }
 
+    /* Delete the output buffer */
+    free(env->file->outbuf.data);
+    env->file->outbuf.data = 0;
+    env->file->outbuf.next = 0;
+    env->file->outbuf.end = 0;
+    env->file->outbuf.datasize = 0;
+
     env->file->nrows = 0;
 
     /* previous parse errors take precedent */
@@ -636,1547 +971,5376 @@ int is_token_char(int c)
  * Return the single character corresponding to a character entity string.
  * Only the leading characters are compared, for example "&lt;blahblah"
  * will be found to match "&lt;".  The return value is the translated
- * character or 0 if the string is not recognized.
+ * character or 0 if the string is not recognized.  The letter after the
+ * '&' picks the one or two entities to compare against.
  */
 
 static
 int character_entity(const char* const s)
 {
-    static const struct entities {
-        const char *s;
-        int c;
-    } entities[] = {
-        {"&gt;", '>'},
-        {"&lt;", '<'},
-        {"&amp;", '&'},
-        {"&quot;", '\"'},
-        {"&apos;", '\''},
-        {"&nbsp;", ' '},
-        {NULL, 0}
-    };
-    const struct entities *entity;
-
-    for(entity = entities; entity->s; entity++)
-        if(!strncmp(entity->s, s, strlen(entity->s)))
-            return entity->c;
+    if(s[0] != '&')
+        return 0;
 
-    return 0;
+    switch(s[1])
+    {
+    case 'g':
+        return strncmp(s, "&gt;", 4) ? 0 : '>';
+    case 'l':
+        return strncmp(s, "&lt;", 4) ? 0 : '<';
+    case 'a':
+        if(!strncmp(s, "&amp;", 5))
+            return '&';
+        return strncmp(s, "&apos;", 6) ? 0 : '\'';
+    case 'q':
+        return strncmp(s, "&quot;", 6) ? 0 : '\"';
+    case 'n':
+        return strncmp(s, "&nbsp;", 6) ? 0 : ' ';
+    default:
+        return 0;
+    }
 }
 
+#ifdef HAVE_LIBZ
+
 /*
- * Get the next character from the stream. This function contains
- * a filter for fgetc to guarantee we always count lines correctly
+ * Random access into gzip files.  Deflate data can only be decoded from
+ * the start, but decoding can be resumed at the boundary of any block given
+ * the bit position there and the 32K of output before it, which is as far
+ * back as the following blocks can refer.  An index of such access points
+ * about every GZIP_SPAN characters of output is recorded while the
+ * directory of a compressed file is read, and can be saved beside the file
+ * to be used again.  Seeking to a position then means inflating from the
+ * last point before it, rather than from the start of the file.  The start
+ * of each member of a file made of several gzip members is also a point.
  */
 
-static
-int get_char(MetaioParseEnv env)
-{
-    int c = gzgetc(env->file->fp);
+#define GZIP_SPAN (4 * 1024 * 1024)
+#define GZIP_WINDOW 32768
+#define GZIP_CHUNK (64 * 1024)
+#define GZIP_INDEX_SUFFIX ".gzidx"
+#define GZIP_INDEX_MAGIC "metaio gzindex 2"
+
+struct GzipPoint {
+    long long out;          /* The position in the uncompressed data */
+    long long in;           /* The offset of the next whole byte in the file */
+    int bits;               /* Bits of the byte before that still to be
+                             * decoded, or -1 at the start of a member */
+    unsigned char *window;  /* The GZIP_WINDOW characters before out */
+};
 
-    if(c < 0)
-    {
-        const char *msg;
-        int errnum = geterrno(env->file->fp, &msg);
-        if(!msg && (errnum == EOF))
-            return EOF;
-        parse_error(env, -1, msg ? msg : "unknown failure");
-    }
+struct GzipIndex {
+    long long size;              /* The length of the compressed file */
+    unsigned char trailer[8];    /* and its last bytes, to recognize it by */
+    int npoints;
+    struct GzipPoint *point;
+};
 
-    if (c == '\n')
-    {
-        env->file->lineno++;
-        env->file->charno = 1;
-    }
-    else
-        env->file->charno++;
+struct GzipCursor {
+    int fd;
+    struct GzipIndex *index;
+    int record;             /* Add points to the index while reading */
+    int active;             /* strm has been initialized */
+    int raw;                /* strm is decoding deflate data, not gzip */
+    int eof;
+    z_stream strm;
+    long long inpos;        /* The offset in the file after input */
+    long long out;          /* The position in the uncompressed data */
+    long long last;         /* out at the last point recorded */
+    unsigned char input[GZIP_CHUNK];
+    unsigned char window[GZIP_WINDOW];  /* Recent output, circularly */
+    char errmsg[256];
+};
 
-    return c;
+static
+void free_gzip_index(struct GzipIndex * const index)
+{
+    int i;
+
+    if(!index)
+        return;
+    for(i = 0; i < index->npoints; i++)
+        free(index->point[i].window);
+    free(index->point);
+    free(index);
 }
 
 /*
- * Push a character back onto the stream. This function contains
- * a filter for ungetc to guarantee we always count lines correctly
+ * Find the length and last bytes of a compressed file.  Returns 0 if
+ * successful.
  */
 
 static
-int unget_char(MetaioParseEnv env, int c)
+int gzip_identity(int fd, struct GzipIndex * const index)
 {
-    if(c < 0)
-        /* get_char() returned error --> us too */
-	return c;
+    struct stat st;
 
-    env->file->charno--;
-    if (c == '\n')
-        env->file->lineno--;
+    if(fstat(fd, &st) < 0 || st.st_size < 8 ||
+       pread(fd, index->trailer, 8, st.st_size - 8) != 8)
+        return 1;
+    index->size = st.st_size;
+    return 0;
+}
 
-    return gzungetc(c, env->file->fp);
+static
+int cursor_error(struct GzipCursor * const c, const char * const msg)
+{
+    snprintf(c->errmsg, sizeof(c->errmsg), "%s", msg);
+    return -1;
 }
 
 /*
- * Return the next non-whitespace character.
+ * Read more of the file after the input that has not been used yet.
+ * Returns the number of bytes read, 0 at the end of the file, or -1 if
+ * there was an error.
  */
 
 static
-int skip_whitespace(MetaioParseEnv env)
+int more_input(struct GzipCursor * const c)
 {
-    int c;
+    z_stream * const strm = &c->strm;
+    ssize_t n;
+
+    memmove(c->input, strm->next_in, strm->avail_in);
+    strm->next_in = c->input;
+    n = read(c->fd, c->input + strm->avail_in, GZIP_CHUNK - strm->avail_in);
+    if(n < 0)
+        return cursor_error(c, strerror(errno));
+    strm->avail_in += n;
+    c->inpos += n;
+
+    return n;
+}
 
-    do
-        c = get_char(env);
-    while(isspace(c));
+/*
+ * Record an access point at the current position
+ */
 
-    return c;
+static
+int add_point(struct GzipCursor * const c, int bits)
+{
+    struct GzipIndex * const index = c->index;
+    const size_t i = c->out % GZIP_WINDOW;
+    struct GzipPoint *point;
+
+    /* Grow the array of points whenever its length reaches a power of two */
+    if(!(index->npoints & (index->npoints - 1)))
+    {
+        point = realloc(index->point, (index->npoints ? 2 * index->npoints : 1) * sizeof(*point));
+        if(!point)
+            return cursor_error(c, "cannot allocate memory for gzip index");
+        index->point = point;
+    }
+
+    point = &index->point[index->npoints];
+    point->out = c->out;
+    point->in = c->inpos - c->strm.avail_in;
+    point->bits = bits;
+    point->window = NULL;
+    if(bits >= 0)
+    {
+        if(!(point->window = malloc(GZIP_WINDOW)))
+            return cursor_error(c, "cannot allocate memory for gzip index");
+        memcpy(point->window, c->window + i, GZIP_WINDOW - i);
+        memcpy(point->window + GZIP_WINDOW - i, c->window, i);
+    }
+    index->npoints++;
+    c->last = c->out;
+
+    return 0;
 }
 
 /*
- * This function acts like fgets(), placing the next lstring from the file
- * into s.  Returns the number of characters written to the string.
+ * Keep the last GZIP_WINDOW characters of output for add_point()
  */
 
-static int fscanf_lstring(
-    MetaioParseEnv env,
-    struct MetaioString *s,
-    char terminator
-)
+static
+void keep_window(struct GzipCursor * const c, const unsigned char *p, size_t n)
 {
-    char escape_character = '\\';
-    /* NOTE:  terminator must be listed last because it can be 0 */
-    /* FIXME:  (9.x) remove delimiter, only listed for temporary backwards
-     * compatibility with pre-8.x documents */
-    char escapables[] = {escape_character, env->ligo_lw.table.stream.delimiter, terminator, '\0'};
-    size_t start_len = s->len;
-    int is_character_entity = 0;
-    int is_escaped = 0;
-    int start_of_character_entity = -1;
+    size_t i, k;
 
-    /* Make sure we start with at least a zero-length string */
-    string_resize(s, 1);
-    s->data[0] = '\0';
+    if(n > GZIP_WINDOW)
+    {
+        p += n - GZIP_WINDOW;
+        c->out += n - GZIP_WINDOW;
+        n = GZIP_WINDOW;
+    }
+    while(n > 0)
+    {
+        i = c->out % GZIP_WINDOW;
+        k = GZIP_WINDOW - i < n ? GZIP_WINDOW - i : n;
+        memcpy(c->window + i, p, k);
+        p += k;
+        c->out += k;
+        n -= k;
+    }
+}
 
-    /* Retrieve the string upto but not including an unescaped terminator */
-    do
+/*
+ * Open a gzip file for random access.  Returns the cursor, or NULL if the
+ * file cannot be opened or is not gzip-compressed.
+ */
+
+static
+struct GzipCursor *open_cursor(const char * const filename,
+                               struct GzipIndex * const index)
+{
+    struct GzipCursor *c;
+    unsigned char magic[2];
+    int fd;
+
+    if((fd = open(filename, O_RDONLY)) < 0)
+        return NULL;
+    if(pread(fd, magic, 2, 0) != 2 || magic[0] != 0x1f || magic[1] != 0x8b ||
+       !(c = calloc(1, sizeof(*c))))
     {
-        /* Get a character */
-        int c = get_char(env);
-        if(c < 0)
-            parse_error(env, -1, "failure reading lstring:  premature EOF");
+        close(fd);
+        return NULL;
+    }
+    c->fd = fd;
+    c->index = index;
 
-        /* Start of an XML tag --> end of string */
-        if(c == '<')
-        {
-            /* Unconsume the start-of-tag */
-            unget_char(env, c);
-            break;
-        }
+    return c;
+}
 
-        /* Are we starting a character entity? */
-        if((c == '&') && !is_character_entity)
-        {
-            is_character_entity = 1;
-            start_of_character_entity = s->len;
-        }
+static
+void close_cursor(struct GzipCursor * const c)
+{
+    if(c->active)
+        inflateEnd(&c->strm);
+    close(c->fd);
+    free(c);
+}
 
-        /* Have we just ended a character entity? */
-        if((c == ';') && is_character_entity)
+/*
+ * Start decoding at an access point, or at the start of the file if point
+ * is NULL.  Returns 0 if successful or -1 if there was an error.
+ */
+
+static
+int cursor_start(struct GzipCursor * const c, const struct GzipPoint * const point)
+{
+    z_stream * const strm = &c->strm;
+    long long in = point ? point->in : 0;
+
+    if(c->active)
+        inflateEnd(strm);
+    c->active = 0;
+    c->eof = 0;
+    c->raw = point && point->bits >= 0;
+    c->out = c->last = point ? point->out : 0;
+
+    memset(strm, 0, sizeof(*strm));
+    strm->next_in = c->input;
+    if(inflateInit2(strm, c->raw ? -15 : 15 + 16) != Z_OK)
+        return cursor_error(c, "cannot initialize zlib");
+    c->active = 1;
+
+    if(c->raw && point->bits > 0)
+        in--;
+    if(lseek(c->fd, in, SEEK_SET) < 0)
+        return cursor_error(c, strerror(errno));
+    c->inpos = in;
+
+    if(c->raw)
+    {
+        if(point->bits > 0)
         {
-            is_character_entity = 0;
-            append_char(s, c);
-            c = character_entity(&s->data[start_of_character_entity]);
-            if(!c)
-                /* Not recognized */
-                parse_error(env, -1, "unrecognized character entity \"%s\"", &s->data[start_of_character_entity]);
-            /* Recognized, unwind to start of character entity */
-            s->len = start_of_character_entity;
-            s->data[s->len] = '\0';
+            /* The point is part of the way through this byte */
+            if(more_input(c) <= 0)
+                return cursor_error(c, "unexpected end of file");
+            inflatePrime(strm, point->bits, strm->next_in[0] >> (8 - point->bits));
+            strm->next_in++;
+            strm->avail_in--;
         }
+        inflateSetDictionary(strm, point->window, GZIP_WINDOW);
+    }
+    else if(c->record)
+        return add_point(c, -1);
 
-        /* End of string? */
-        if((c == terminator) && !is_escaped)
+    return 0;
+}
+
+/*
+ * Inflate up to len characters into buf.  Returns the number of characters
+ * read, 0 at the end of the data, or -1 if there was an error.
+ */
+
+static
+int cursor_read(struct GzipCursor * const c, char * const buf, unsigned len)
+{
+    z_stream * const strm = &c->strm;
+    int ret, n;
+
+    strm->next_out = (unsigned char *) buf;
+    strm->avail_out = len;
+
+    while(strm->avail_out > 0 && !c->eof)
+    {
+        unsigned char * const out = strm->next_out;
+
+        if(strm->avail_in == 0 && (n = more_input(c)) <= 0)
+            return n < 0 ? -1 : cursor_error(c, "unexpected end of file");
+
+        /* Z_BLOCK stops at each block boundary, where a point may go */
+        ret = inflate(strm, c->record ? Z_BLOCK : Z_NO_FLUSH);
+        if(ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR)
+            return cursor_error(c, strm->msg ? strm->msg : "invalid compressed data");
+
+        if(!c->record)
+            c->out += strm->next_out - out;
+        else
         {
-            /* Unconsume the terminator */
-            unget_char(env, c);
-            break;
+            keep_window(c, out, strm->next_out - out);
+            if((strm->data_type & 128) && !(strm->data_type & 64) &&
+               c->out - c->last >= GZIP_SPAN && add_point(c, strm->data_type & 7) < 0)
+                return -1;
         }
 
-        /* Escaped? */
-        if(is_escaped && !is_character_entity)
+        if(ret == Z_STREAM_END)
         {
-            if(!strchr(escapables, c))
-		/* Escaped character is not in the list of characters that
-                 * can be escaped */
-                parse_error(env, -1, "unrecognized escape sequence \"%hhc%c\"", escape_character, c);
-            /* Strip preceding backslash */
-            s->len--;
-            s->data[s->len] = '\0';
-            /* Append character to string */
-            append_char(s, c);
+            /* Step over the trailer, which gzip decoding does itself */
+            for(n = c->raw ? 8 : 0; n > 0; n--)
+            {
+                if(strm->avail_in == 0 && more_input(c) <= 0)
+                    return cursor_error(c, "unexpected end of file");
+                strm->next_in++;
+                strm->avail_in--;
+            }
+
+            /* Another member may follow; anything else is ignored */
+            n = 0;
+            while(strm->avail_in < 2 && (n = more_input(c)) > 0)
+                ;
+            if(n < 0)
+                return -1;
+            if(strm->avail_in < 2 || strm->next_in[0] != 0x1f || strm->next_in[1] != 0x8b)
+                c->eof = 1;
+            else
+            {
+                inflateReset2(strm, 15 + 16);
+                c->raw = 0;
+                if(c->record && add_point(c, -1) < 0)
+                    return -1;
+            }
         }
-        else
-            /* Append character to string */
-            append_char(s, c);
+    }
 
-        /* Is the next character escaped? */
-        is_escaped = is_escaped ? is_character_entity : c == escape_character;
+    return len - strm->avail_out;
+}
+
+/*
+ * The last access point at or before position offset
+ */
+
+static
+const struct GzipPoint *find_point(const struct GzipIndex * const index,
+                                   long long offset)
+{
+    int lo = 0, hi = index->npoints;
+
+    while(hi - lo > 1)
+    {
+        const int mid = (lo + hi) / 2;
+
+        if(index->point[mid].out <= offset)
+            lo = mid;
+        else
+            hi = mid;
     }
-    while(1);
 
-    /* Done */
-    return s->len - start_len;
+    return index->npoints ? &index->point[lo] : NULL;
 }
 
 /*
- * This function acts like fread(), placing the next decoded blob from the
- * file into s.  Returns the number of octets in the decoded blob or
- * < 0 on error.  The input buffer is both overwritten.
+ * Resume decoding at position offset.  Returns 0 if successful or -1 if
+ * there was an error.
  */
 
-static int fscanf_blob(
-    MetaioParseEnv env,
-    struct MetaioStringU *s,
-    char terminator
-)
+static
+int cursor_seek(struct GzipCursor * const c, long long offset)
 {
-    struct MetaioString b64 = {
-        .data = calloc(1, sizeof(*b64.data)),
-        .len = 0,
-        .datasize = 1
-    };
-    int ok;
+    int n;
 
-    if(!b64.data)
-        /* Memory error */
+    if(cursor_start(c, find_point(c->index, offset)) < 0)
         return -1;
 
-    /* Retrieve the string upto but not including a terminator */
-    do
+    /* Inflate the rest of the way, using the window as scratch space */
+    while(c->out < offset)
     {
-        /* Get a character */
-        int c = get_char(env);
-        if(c < 0)
-            parse_error(env, -1, "failure reading blob:  premature EOF");
+        n = cursor_read(c, (char *) c->window,
+                        offset - c->out < GZIP_WINDOW ? offset - c->out : GZIP_WINDOW);
+        if(n < 0)
+            return -1;
+        if(n == 0)
+            return cursor_error(c, "cannot seek past the end of the file");
+    }
 
-        /* Start of an XML tag or terminator --> end of string */
-        if(c == '<' || c == terminator)
-        {
-            /* Unconsume the terminating character */
-            unget_char(env, c);
-            break;
-        }
+    return 0;
+}
 
-        /* Append character to string */
-        append_char(&b64, c);
-    }
-    while(1);
+static
+void put_int64(unsigned char * const p, long long v)
+{
+    int i;
 
-    /* Decode base64 data.  Formula for required length of decoded buffer
-     * copied from base64.c */
-    stringu_resize(s, 3 * (b64.len / 4) + 2);
-    ok = base64_decode(b64.data, b64.len, (char *) s->data, &s->datasize);
-    s->len = s->datasize;
-    free(b64.data);
-    if(!ok)
-        /* Decode error */
-        return -1;
+    for(i = 0; i < 8; i++)
+        p[i] = (unsigned long long) v >> (8 * i);
+}
 
-    /* Done */
-    return s->len;
+static
+long long get_int64(const unsigned char * const p)
+{
+    unsigned long long v = 0;
+    int i;
+
+    for(i = 8; i--; )
+        v = v << 8 | p[i];
+
+    return v;
 }
 
 /*
- * Scan the file for a ilwd:char_u string until the quote character is
- * reached.  The quote character us not consumed. An ilwd:char staring
- * consists of a combination of the following:
- *
- * - Unsigned bytes represented by 3 octal digits eg. \123
- *
- * - Non-space character eg. xyz
- *
- * - Backslash-escaped characters eg. backslash \\, space \ , comma \,
- *   and quotes \" or \'.
- *
- * The string may be any combination of the above. Spaces are treated as
- * separators between two bytes and are ignored, unless escaped using a
- * backslash. eg. '\057 a\ b  \"x' would (in ASCII) be translated to 'Wa b"x'.
- *
- * Like scanf(), this function returns the number of objects assigned,
- * which in this case means the number of Byte objects, *not* the number
- * of bytes - that value is contained in the 'len' field of the Byte object.
- *
- * If one or more valid bytes is read, 1 is returned.
- *
- * If no valid bytes are read, 0 is returned.
- * 
- * If EOF is reached before any valid bytes are read, EOF is returned.
- *
- * :NOTE: 
- * 
- * A slight flaw in this code is that it will accept octal
- * strings that are shorter than 3 characters eg. \10.
+ * Write or read part of an index file, adding it to the checksum
  */
 
 static
-int fscanf_ilwd_char_u(
-    MetaioParseEnv env,
-    struct MetaioStringU *b,
-    const char *terminators,
-    const char *specials
-)
+void write_block(FILE *fp, const void * const p, size_t n, uLong *crc)
 {
-    int val;
-    int count = 1;
-    int ret   = 0;
+    *crc = crc32(*crc, p, n);
+    fwrite(p, 1, n, fp);
+}
 
-    b->len = 0;
+static
+int read_block(FILE *fp, void * const p, size_t n, uLong *crc)
+{
+    if(fread(p, 1, n, fp) != n)
+        return 1;
+    *crc = crc32(*crc, p, n);
+    return 0;
+}
 
-    /*-- Get first character which is not a space --*/
-    val = skip_whitespace(env);
-    if(val < 0)
-        parse_error(env, -1, "failure reading ilwd_char_u:  premature EOF");
+/* The directory of the file can be saved in the index file too */
+static void save_directory(FILE *fp, const struct MetaioDirectory * const dir,
+                           uLong *crc);
+static int load_directory(FILE *fp, struct MetaioDirectory * const dir,
+                          long long ntables, long long limit, uLong *crc);
+static void free_directory(struct MetaioDirectory * const dir);
 
-    while ((count == 1) && (val <= 256) && ! strchr(terminators, val) && (val != EOF))
-    {
-        if (val == '&')
-        {
-            char tmp[8] = {val, 0, };
-            int i;
-            
-            for(i = 1; i < sizeof(tmp) - 1;)
-            {
-                int c = get_char(env);
-                if( c < 0 )
-                    parse_error(env, -1, "failure reading ilwd_char_u:  premature EOF");
-                tmp[i] = c;
-                if(tmp[i++] == ';')
-                {
-                    tmp[i] = 0;
-                    break;
-                }
-            }
+/*
+ * Save an index to a file:  a header with the identity of the compressed
+ * file and the number of points, then each point, all as 8-byte
+ * little-endian numbers, followed by its window if it has one, then the
+ * directory of the file if dir is not a null pointer (or -1 if it is), and
+ * lastly the CRC-32 of all that.  Returns 0 if successful, or else the
+ * error number.
+ */
 
-            /* Identify the character entity */
-            val = character_entity(tmp);
-        }
-        else if (val == '\\')
-        {
-            val = get_char(env);
-            if ( val < 0 )
-                parse_error(env, -1, "failure reading ilwd_char_u:  premature EOF");
-            if (isdigit(val))
-            {
-                /*
-                  We got something of the form \[digit][digit]...
-                  read it as an octal.
-                */
-                unget_char(env, (int) val);
-                count = gzscanf(env->file->fp, "%3o", &val);
-                if ( count < 0 )
-                    parse_error(env, -1, "failure parsing octal code");
-            }
-            else if ( strchr(specials, val) )
-                /* We got a properly-escaped character (such as space) */
-                count = 1;            
-            else
-                /*-- This character should not have been escaped --*/
-                parse_error(env, -1, "invalid escape sequence \"\\%c\"", val);
-        }
-        append_char_u(b, val);
+static
+int write_gzip_index(const struct GzipIndex * const index,
+                     const struct MetaioDirectory * const dir,
+                     const char * const filename)
+{
+    unsigned char buf[40];
+    uLong crc = crc32(0, NULL, 0);
+    FILE *fp;
+    int i, err;
 
-        /*-- Get next character, skipping any spaces. --*/
-        val = skip_whitespace(env);
-        if(val < 0)
-            parse_error(env, -1, "failure reading ilwd_char_u:  premature EOF");
-    }
-    
-    /* Unget the character that caused the loop to finish */
-    unget_char(env, (int) val);
+    if(!(fp = fopen(filename, "wb")))
+        return errno;
 
-    /*
-      A val of > 256 means that a valid octal string or character was read
-      but it was too large to fit in a byte. This invalidates the whole
-      string, so we abandon any data we got.
-    */
-    
-    if (val > 256)
+    memcpy(buf, GZIP_INDEX_MAGIC, 16);
+    put_int64(buf + 16, index->size);
+    memcpy(buf + 24, index->trailer, 8);
+    put_int64(buf + 32, index->npoints);
+    write_block(fp, buf, 40, &crc);
+
+    for(i = 0; i < index->npoints; i++)
     {
-        b->len = 0;
-        ret = 0;
+        const struct GzipPoint * const point = &index->point[i];
+
+        put_int64(buf, point->out);
+        put_int64(buf + 8, point->in);
+        put_int64(buf + 16, point->bits);
+        write_block(fp, buf, 24, &crc);
+        if(point->window)
+            write_block(fp, point->window, GZIP_WINDOW, &crc);
     }
-    else 
-    {   
-        if (b->len == 0)
-            ret = count == EOF ? EOF : 0;
-        else
-            ret = 1;
+    if(dir)
+        save_directory(fp, dir, &crc);
+    else
+    {
+        put_int64(buf, -1);
+        write_block(fp, buf, 8, &crc);
     }
+    put_int64(buf, crc);
+    fwrite(buf, 1, 8, fp);
 
-    return ret;
+    err = ferror(fp) ? errno : 0;
+    if(fclose(fp) != 0 && !err)
+        err = errno;
+    if(err)
+        remove(filename);
+
+    return err;
 }
 
 /*
- * See if the current table name (stored in env->ligo_lw.table.name) matches
- * the table which is being searched for (stored in env->file->tablename).
- *
- * The two are deemed to match if any of the following conditions are true:
- * 1) tablename is a null pointer
- * 2) tablename points to the null string
- * 3) tablename exactly matches the last characters of ligo_lw.table.name
- * 4) tablename exactly matches the last characters of ligo_lw.table.name
- *    before the terminating string ":table"
- *
- * Eg. if tablename = "foo" then it matches ligo_lw.table.name values such as
- *   - ligo_lw.table.name = "foo" or "foo:table"
- *   - ligo_lw.table.name = "bar:foo" or "bar:foo:table"
- * etc.
- *
- * Returns 0 if the table names match, non-zero otherwise
+ * Load the index saved beside a compressed file, if there is one and it
+ * belongs to the file as it is now.  If the directory of the file was
+ * saved with it, that is put in *dir and *listed is set, or else *listed
+ * is cleared; dir may be a null pointer if the directory is not wanted.
+ * Returns the index, or NULL.
  */
 
 static
-int match_tablename(MetaioParseEnv const env)
+struct GzipIndex *read_gzip_index(const char * const filename,
+                                  struct MetaioDirectory * const dir,
+                                  int * const listed)
 {
-    int match = 0;
-
-    if (env->file->tablename == 0)
-        match = 1;
-    else 
+    struct GzipIndex *index = NULL;
+    struct GzipIndex actual;
+    struct MetaioDirectory saved;
+    unsigned char buf[40];
+    uLong crc = crc32(0, NULL, 0);
+    char *indexname;
+    FILE *fp = NULL;
+    struct stat st;
+    long long npoints, ntables;
+    int fd, i;
+
+    memset(&saved, 0, sizeof(saved));
+    if(listed)
+        *listed = 0;
+
+    if((fd = open(filename, O_RDONLY)) < 0)
+        return NULL;
+    i = gzip_identity(fd, &actual);
+    close(fd);
+    if(i)
+        return NULL;
+
+    if(!(indexname = malloc(strlen(filename) + sizeof(GZIP_INDEX_SUFFIX))))
+        return NULL;
+    strcat(strcpy(indexname, filename), GZIP_INDEX_SUFFIX);
+    fp = fopen(indexname, "rb");
+    free(indexname);
+    if(!fp)
+        return NULL;
+
+    if(read_block(fp, buf, 40, &crc) || memcmp(buf, GZIP_INDEX_MAGIC, 16) ||
+       get_int64(buf + 16) != actual.size || memcmp(buf + 24, actual.trailer, 8))
+        goto fail;
+    npoints = get_int64(buf + 32);
+    if(npoints < 1 || npoints > actual.size ||
+       !(index = calloc(1, sizeof(*index))) ||
+       !(index->point = calloc(npoints, sizeof(*index->point))))
+        goto fail;
+    index->size = actual.size;
+    memcpy(index->trailer, actual.trailer, 8);
+
+    for(i = 0; i < npoints; i++)
     {
-        size_t len_tablename = strlen(env->file->tablename);
-        if (len_tablename == 0)
-            match = 1;
-        else
-        {
-            const char* const name = env->ligo_lw.table.name;
-            size_t len = strlen(name);
-            if (len >= 6 && !strcasecmp(name+len-6, ":table"))
-            {
-                if (len >= 6 + len_tablename && !strncasecmp(name+len-6-len_tablename, env->file->tablename, len_tablename))
-                    match = 1;
-            }
-            else
-            {
-                if (len >= len_tablename && !strncasecmp(name+len-len_tablename, env->file->tablename, len_tablename))
-                    match = 1;
-            }
-        }
+        struct GzipPoint * const point = &index->point[i];
+
+        if(read_block(fp, buf, 24, &crc))
+            goto fail;
+        point->out = get_int64(buf);
+        point->in = get_int64(buf + 8);
+        point->bits = get_int64(buf + 16);
+        index->npoints++;
+        if(point->out < (i ? point[-1].out : 0) || point->in < 0 ||
+           point->in > actual.size || point->bits < -1 || point->bits > 7)
+            goto fail;
+        if(point->bits >= 0 &&
+           (!(point->window = malloc(GZIP_WINDOW)) ||
+            read_block(fp, point->window, GZIP_WINDOW, &crc)))
+            goto fail;
+    }
+    if(index->point[0].out != 0 || index->point[0].bits != -1 ||
+       read_block(fp, buf, 8, &crc))
+        goto fail;
+
+    /* Strings and arrays in the directory cannot be longer than the file */
+    ntables = get_int64(buf);
+    if(ntables >= 0 &&
+       (fstat(fileno(fp), &st) < 0 ||
+        load_directory(fp, &saved, ntables, st.st_size, &crc)))
+        goto fail;
+    if(fread(buf, 1, 8, fp) != 8 || get_int64(buf) != (long long) crc)
+        goto fail;
+
+    fclose(fp);
+    if(ntables >= 0 && dir)
+    {
+        *dir = saved;
+        if(listed)
+            *listed = 1;
     }
+    else
+        free_directory(&saved);
+    return index;
 
-    return match;
+fail:
+    fclose(fp);
+    free_gzip_index(index);
+    free_directory(&saved);
+    return NULL;
 }
 
+#endif /* HAVE_LIBZ */
+
 /*
- * See if the string s matches any of the token strings (case-insensitive).
- * If it does, the function returns an integer correspondending to one of
- * the elements of the enumerated type Token (which includes zero), otherwise
- * it returns the integer corresponding to UNKNOWN.
+ * Input is read from the file in large blocks into env->file->inbuf, and
+ * the tokenizer then works through the block with a pointer.  When a block
+ * is exhausted the last few characters are kept at the front of the buffer
+ * so that unget_char() can always step back over them.
  */
 
-static
-enum Token match_token_string(const char* const s)
-{
-    enum Token i;
-    for(i = 0; i < UNKNOWN; i++)
-        if(!strcmp(TokenText[i], s))
-            break;
-    return i;
-}
+#define INPUT_BLOCK_SIZE (256 * 1024)
+#define INPUT_PUSHBACK 16
 
 /*
- * See if the string s matches any of the type strings (case-insensitive).
- * If it does, the function returns an integer correspondending to one of
- * the elements of the enumerated type METAIO_Type (which includes zero),
- * otherwise it returns the integer corresponding to METAIO_TYPE_UNKNOWN.
+ * Read up to len characters of input from fp, or from gzip once it has
+ * been positioned by a seek.  Returns the number of characters read, 0 at
+ * the end of the file, or -1 with *msg set to the reason for an error.
  */
 
 static
-enum METAIO_Type match_type_string(const char* const s)
+int read_input(void * const fp, void * const gzip, char * const buf,
+               unsigned len, const char **msg)
 {
-    enum METAIO_Type i;
+    int n;
 
-    for(i = 0; i < METAIO_TYPE_UNKNOWN; i++)
+#ifdef HAVE_LIBZ
+    struct GzipCursor * const c = gzip;
+
+    if(c && c->active)
     {
-        const char * const *name;
-        for(name = TypeText[i].name; *name; name++)
-            if(!strcasecmp(*name, s))
-                return i;
+        if((n = cursor_read(c, buf, len)) < 0)
+            *msg = c->errmsg;
+        return n;
     }
-    return METAIO_TYPE_UNKNOWN;
+#endif
+
+    if((n = gzread(fp, buf, len)) < 0)
+    {
+        geterrno(fp, msg);
+        if(!*msg)
+            *msg = "unknown failure";
+    }
+
+    return n;
 }
 
+#ifdef METAIO_READAHEAD
+
 /*
- * Returns a pointer to a string containing the name of the token
+ * Input that is not mapped, in particular compressed files, is read (and
+ * inflated) by a background thread into a ring of blocks, which the parser
+ * then takes in turn, so that decompression overlaps with parsing.  Each
+ * thread only advances its own counter of blocks filled or released, and
+ * the mutex is only used to sleep when the ring is full or empty.  The
+ * parser holds on to the block it is reading until it takes the next one.
  */
 
-static
-const char* token_text(enum Token token)
-{
-    if(token >= 0 && token < UNKNOWN)
-        return TokenText[token];
-    if(token == END_OF_FILE)
-        return "END_OF_FILE";
-    return "UNKNOWN";
-}
+#define READAHEAD_BLOCKS 4
+
+struct ReadAhead {
+    void *fp;
+    void *gzip;
+    char *block[READAHEAD_BLOCKS];
+    int len[READAHEAD_BLOCKS];  /* Characters read into each block, or -1 */
+    char errmsg[256];           /* The error if a read failed */
+    unsigned filled;            /* Blocks filled, updated by the reader */
+    unsigned released;          /* Blocks released, updated by the parser */
+    unsigned taken;             /* Blocks taken, used only by the parser */
+    int eof;                    /* Parser has reached the end of the file */
+    int stop;                   /* Reader should exit */
+    int reader_waiting;
+    int parser_waiting;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_SEQ_CST)
 
 /*
- * Returns a pointer to a string containing the name of the type, or NULL
- * if the type is not recognized.
+ * Wake the other thread if it is waiting
  */
 
-const char *MetaioTypeText(int type)
-{
-    if(type >= 0 && type < METAIO_TYPE_UNKNOWN)
-        return TypeText[type].name[0];
-    return NULL;
-}
-
 static
-int read_token_string(MetaioParseEnv const env, struct MetaioString * const s)
+void wake(struct ReadAhead * const r, int *waiting)
 {
-    size_t start_len = s->len;
-    int c = get_char(env);
-
-    while (is_token_char(c) && (c != EOF))
+    if(LOAD(*waiting))
     {
-        append_char(s, c);
-        c = get_char(env);
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
     }
-
-    /* Unconsume the character that caused us to halt */
-    unget_char(env, c);
-
-    return s->len - start_len;
 }
 
 static
-void read_attribute_value(MetaioParseEnv const env, struct MetaioString * const s)
+void *reader_thread(void *arg)
 {
-    int quote = skip_whitespace(env);
-    if(quote < 0)
-        parse_error(env, -1, "failure reading attribute value:  premature EOF");
+    struct ReadAhead * const r = arg;
+    unsigned filled = 0;
+    const char *msg;
+    int n;
 
-    if(quote == '\"' || quote == '\'')
+    do
     {
-        if ( fscanf_lstring(env, s, quote) < 0 )
-            parse_error(env, -1, "failure parsing attribute value");
+        const int i = filled % READAHEAD_BLOCKS;
 
-        /* Consume the terminating quote */
-        if(get_char(env) != quote)
-            parse_error(env, -1, "unmatched quote when reading attribute value");
-    }
-    else
-    {
-        /* Attributes *must* be quoted. May as well unget what we read. */
-        unget_char(env, quote);
-        parse_error(env, -1, "missing quote when reading attribute value");
+        /* Wait for the parser to release a block */
+        if(LOAD(r->released) + READAHEAD_BLOCKS == filled && !LOAD(r->stop))
+        {
+            pthread_mutex_lock(&r->lock);
+            STORE(r->reader_waiting, 1);
+            while(LOAD(r->released) + READAHEAD_BLOCKS == filled && !LOAD(r->stop))
+                pthread_cond_wait(&r->cond, &r->lock);
+            STORE(r->reader_waiting, 0);
+            pthread_mutex_unlock(&r->lock);
+        }
+        if(LOAD(r->stop))
+            break;
+
+        n = read_input(r->fp, r->gzip, r->block[i] + INPUT_PUSHBACK, INPUT_BLOCK_SIZE, &msg);
+        if(n < 0)
+            snprintf(r->errmsg, sizeof(r->errmsg), "%s", msg);
+        r->len[i] = n;
+
+        STORE(r->filled, ++filled);
+        wake(r, &r->parser_waiting);
     }
+    while(n > 0);
+
+    return NULL;
 }
 
+/*
+ * Start reading the file in the background.  Returns the reader, or NULL
+ * if it could not be started.
+ */
+
 static
-void get_next_token(MetaioParseEnv const env)
+struct ReadAhead *start_reader(void *fp, void *gzip)
 {
-    int c = skip_whitespace(env);
-
-    env->buffer.len = 0;
-    if(c >= 0)
-        append_char(&(env->buffer), c);
+    struct ReadAhead * const r = calloc(1, sizeof(*r));
+    int i;
+
+    if(!r)
+        return NULL;
+    r->fp = fp;
+    r->gzip = gzip;
+    for(i = 0; i < READAHEAD_BLOCKS; i++)
+        if(!(r->block[i] = malloc(INPUT_PUSHBACK + INPUT_BLOCK_SIZE)))
+            break;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
 
-    switch(c)
+    if(i < READAHEAD_BLOCKS ||
+       pthread_create(&r->thread, NULL, reader_thread, r) != 0)
     {
-    case '<':
-        c = skip_whitespace(env);
-        if(c < 0)
-            parse_error(env, -1, "failure reading tag:  premature EOF");
-        append_char(&(env->buffer), c);
-        read_token_string(env, &(env->buffer));
-        env->token = match_token_string(env->buffer.data);
-        break;
-    case '>':
-        env->token = GREATER_THAN;
-        break;
-    case '=':
-        env->token = EQUALS;
-        break;
-    case '/':
-        env->token = FORWARD_SLASH;
-        break;
-    case EOF:
-        env->token = END_OF_FILE;
-        break;
-    default:
-        read_token_string(env, &(env->buffer));
-        env->token = match_token_string(env->buffer.data);
-        break;
+        while(i--)
+            free(r->block[i]);
+        pthread_mutex_destroy(&r->lock);
+        pthread_cond_destroy(&r->cond);
+        free(r);
+        return NULL;
     }
-}
 
-static
-void unexpected_token(MetaioParseEnv const env, enum Token expected)
-{
-    parse_error(env, -1, "got %s when expecting %s", token_text(env->token), token_text(expected));
+    return r;
 }
 
 static
-void match(MetaioParseEnv const env, enum Token token)
+void stop_reader(struct ReadAhead * const r)
 {
-    if (env->token == token)
-        get_next_token(env);
-    else
-        unexpected_token(env, token);
+    int i;
+
+    STORE(r->stop, 1);
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+
+    for(i = 0; i < READAHEAD_BLOCKS; i++)
+        free(r->block[i]);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+    free(r);
 }
 
+/*
+ * Take the next block from the reader, in place of fill_input()
+ */
+
 static
-void name(MetaioParseEnv const env, char **s)
+size_t take_block(MetaioParseEnv env)
 {
-    switch(env->token)
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    struct ReadAhead * const r = in->reader;
+    const int i = r->taken % READAHEAD_BLOCKS;
+    size_t keep = 0;
+
+    if(r->eof)
+        return 0;
+
+    if(LOAD(r->filled) == r->taken)
     {
-    case NAME:
-        match(env, NAME);
-        env->buffer.len = 0;
-        read_attribute_value(env, &(env->buffer));
-        assign_cstr(s, env->buffer.data);
-        match(env, EQUALS);
-        break;
-    default:
-        assign_cstr(s, "");
-        break;
+        pthread_mutex_lock(&r->lock);
+        STORE(r->parser_waiting, 1);
+        while(LOAD(r->filled) == r->taken)
+            pthread_cond_wait(&r->cond, &r->lock);
+        STORE(r->parser_waiting, 0);
+        pthread_mutex_unlock(&r->lock);
     }
-}
 
-static
-void type(MetaioParseEnv const env, char **s)
-{
-    switch(env->token)
+    if(r->len[i] < 0)
+        parse_error(env, -1, "%s", r->errmsg);
+    if(r->len[i] == 0)
     {
-    case TYPE:
-        match(env, TYPE);
-        env->buffer.len = 0;
-        read_attribute_value(env, &(env->buffer));
-        assign_cstr(s, env->buffer.data);
-        match(env, EQUALS);
-        break;
-
-    default:
-        assign_cstr(s, "Local");
-        break;
+        /* Keep the last block so that unget_char() still works */
+        r->eof = 1;
+        return 0;
     }
 
-    return;
-}
-
-static
-void data_type(MetaioParseEnv const env, enum METAIO_Type * const type)
-{
-    match(env, TYPE);
-
-    env->buffer.len = 0;
-    read_attribute_value(env, &(env->buffer));
-
-    *type = match_type_string(env->buffer.data);
-    if (*type == METAIO_TYPE_UNKNOWN)
+    /* Carry the tail of the old block over for unget_char() */
+    if(in->data)
     {
-        /*-- Haven't yet set up pointers for this column, so ignore it --*/
-        env->ligo_lw.table.numcols--;
-        parse_error(env, -1, "unknown data type \"%s\"", env->buffer.data);
+        keep = in->end - in->data;
+        if(keep > INPUT_PUSHBACK)
+            keep = INPUT_PUSHBACK;
+        memcpy(r->block[i] + INPUT_PUSHBACK - keep, in->end - keep, keep);
+    }
+    in->data = r->block[i];
+    in->next = in->data + INPUT_PUSHBACK;
+    in->end = in->next + r->len[i];
+    in->datasize = INPUT_PUSHBACK + INPUT_BLOCK_SIZE;
+    in->pos += r->len[i];
+
+    /* The old block can be refilled now */
+    if(r->taken++)
+    {
+        STORE(r->released, r->taken - 1);
+        wake(r, &r->reader_waiting);
     }
 
-    match(env, EQUALS);
+    return r->len[i];
 }
 
-static
-void delimiter(MetaioParseEnv const env, char* const c)
-{
-    match(env, DELIMITER);
-
-    env->buffer.len = 0;
-    read_attribute_value(env, &(env->buffer));
-
-    if (env->buffer.len > 1)
-        parse_error(env, -1, "invalid delimiter \"%s\", must be a single character", env->buffer.data);
-
-    *c = env->buffer.data[0];
-
-    /*
-     * Some delimiter characters are banned, including most things that
-     * can appear in a row element.
-     */
-    if (*c == '\0' || strchr("<\"\'\\0123456789+-.Ee", *c))
-        parse_error(env, -1, "character '%hhc' is invalid as a delimiter", *c);
-
-    match(env, EQUALS);
-}
+#endif /* METAIO_READAHEAD */
 
-static
-void comment(MetaioParseEnv const env, char **s)
-{
-    if(env->token == COMMENT)
-    {
-        match(env, COMMENT);
-        env->buffer.len = 0;
-        if ( fscanf_lstring(env, &(env->buffer), 0) < 0 )
-            parse_error(env, -1, "failure parsing Comment text");
-        assign_cstr(s, env->buffer.data);
-        match(env, GREATER_THAN);
-        match(env, CLOSE_COMMENT);
-        match(env, GREATER_THAN);
-    }
-    else
-        assign_cstr(s, "");
-}
+/*
+ * Read the next block of input into the buffer.  Returns the number of new
+ * characters available, or 0 at the end of the file.
+ */
 
 static
-void column_attr(MetaioParseEnv const env)
+size_t fill_input(MetaioParseEnv env)
 {
-    int colnum = env->ligo_lw.table.numcols - 1;
-
-    switch(env->token)
-    {
-    case TYPE:
-      /*-- Type, then name --*/
-      data_type(env, &(env->ligo_lw.table.col[colnum].data_type));
-      DEBUGMSG2("DATA TYPE = \"%s\"\n", MetaioTypeText(env->ligo_lw.table.col[colnum].data_type));
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    const char *msg;
+    size_t keep;
+    int n;
 
-      name(env, &(env->ligo_lw.table.col[colnum].name));
-      DEBUGMSG2("NAME = \"%s\"\n", env->ligo_lw.table.col[colnum].name);
-      break;
+    /* A mapped file is all in the buffer from the start */
+    if(in->mapped)
+        return 0;
 
-    default:
-      /*-- Name, then type --*/
-      name(env, &(env->ligo_lw.table.col[colnum].name));
-      DEBUGMSG2("NAME = \"%s\"\n", env->ligo_lw.table.col[colnum].name);
+#ifdef METAIO_READAHEAD
+    if(!in->data && !in->reader)
+        in->reader = start_reader(env->file->fp, in->gzip);
+    if(in->reader)
+        return take_block(env);
+#endif
 
-      data_type(env, &(env->ligo_lw.table.col[colnum].data_type));
-      DEBUGMSG2("DATA TYPE = \"%s\"\n", MetaioTypeText(env->ligo_lw.table.col[colnum].data_type));
-      break;
+    if(!in->data)
+    {
+        in->data = malloc(INPUT_PUSHBACK + INPUT_BLOCK_SIZE);
+        if(!in->data)
+            parse_error(env, -1, "cannot allocate input buffer");
+        in->datasize = INPUT_PUSHBACK + INPUT_BLOCK_SIZE;
+        in->next = in->end = in->data;
     }
 
-    env->ligo_lw.table.elt[colnum].col = &(env->ligo_lw.table.col[colnum]);
-    env->ligo_lw.table.elt[colnum].data.int_4s = 0;
-    env->ligo_lw.table.elt[colnum].data.int_4u = 0;
-    env->ligo_lw.table.elt[colnum].data.int_2s = 0;
-    env->ligo_lw.table.elt[colnum].data.int_2u = 0;
-    env->ligo_lw.table.elt[colnum].data.int_8s = 0LL;
-    env->ligo_lw.table.elt[colnum].data.int_8u = 0LL;
-    env->ligo_lw.table.elt[colnum].data.real_4 = 0.0;
-    env->ligo_lw.table.elt[colnum].data.real_8 = 0.0;
-    env->ligo_lw.table.elt[colnum].data.lstring.data = 0;
-    env->ligo_lw.table.elt[colnum].data.lstring.len = 0;
-    env->ligo_lw.table.elt[colnum].data.lstring.datasize = 0;
-    env->ligo_lw.table.elt[colnum].data.blob.data = 0;
-    env->ligo_lw.table.elt[colnum].data.blob.len = 0;
-    env->ligo_lw.table.elt[colnum].data.blob.datasize = 0;
-    env->ligo_lw.table.elt[colnum].data.complex_8 = 0.0;
-    env->ligo_lw.table.elt[colnum].data.complex_16 = 0.0;
+    /* Preserve the tail of the old block for unget_char() */
+    keep = in->end - in->data;
+    if(keep > INPUT_PUSHBACK)
+        keep = INPUT_PUSHBACK;
+    memmove(in->data, in->end - keep, keep);
+    in->next = in->end = in->data + keep;
 
-    match(env, FORWARD_SLASH);
-    match(env, GREATER_THAN);
+    n = read_input(env->file->fp, in->gzip, in->end, in->datasize - keep, &msg);
+    if(n < 0)
+        parse_error(env, -1, "%s", msg);
+    in->end += n;
+    in->pos += n;
+
+    return n;
 }
 
+/*
+ * The position in the (uncompressed) file of the next character to be read
+ */
+
 static
-void column(MetaioParseEnv const env)
+long long input_position(MetaioParseEnv env)
 {
-    if (env->ligo_lw.table.numcols < env->ligo_lw.table.maxcols)
-        env->ligo_lw.table.numcols++;
-    else
-        parse_error(env, -1, "number of columns exceeds %d", env->ligo_lw.table.maxcols);
+    const struct MetaioBuffer * const in = &env->file->inbuf;
 
-    match(env, COLUMN);
-    column_attr(env);
+    return in->pos - (in->end - in->next);
 }
 
+/*
+ * Go on reading from position offset in the file.  This is always possible
+ * within the buffer, and so within a mapped file, but elsewhere in
+ * compressed input only with an index of access points.
+ */
+
 static
-void match_numeric(MetaioParseEnv const env,
-                   struct MetaioRowElement* const elt)
+void seek_input(MetaioParseEnv env, long long offset)
 {
-    int count;
-
-    /*
-      Need to skip whitespace with this function, since I don't
-      want to fscanf() to eat newlines without incrementing the
-      line number
-    */
-    int c = skip_whitespace(env);
-    if(c < 0)
-        parse_error(env, -1, "failure reading number:  premature EOF");
-    unget_char(env, c);
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    const long long start = in->pos - (in->end - in->data);
 
-    /* Zero or more whitespace between two delimiters maps to a null value */
-    if(c == env->ligo_lw.table.stream.delimiter)
+    if(in->data && offset >= start && offset <= in->pos)
     {
-        elt->valid = 0;
-        memset(&elt->data, 0, sizeof(elt->data));
+        in->next = in->data + (offset - start);
         return;
     }
-    elt->valid = 1;
 
-    switch(elt->col->data_type)
+#ifdef HAVE_LIBZ
+    if(in->gzip)
     {
-    case METAIO_TYPE_REAL_4:
-        elt->data.real_4 = 0.0;
-        count = gzscanf(env->file->fp, "%f", &(elt->data.real_4));
-        break;
-    case METAIO_TYPE_REAL_8:
-        elt->data.real_8 = 0.0;
-        count = gzscanf(env->file->fp, "%lf", &(elt->data.real_8));
-        break;
-    case METAIO_TYPE_INT_4S:
-        elt->data.int_4s = 0;
-        count = gzscanf(env->file->fp, "%d", &(elt->data.int_4s));
-        break;
-    case METAIO_TYPE_INT_4U:
-        elt->data.int_4u = 0;
-        count = gzscanf(env->file->fp, "%u", &(elt->data.int_4u));
-        break;
-    case METAIO_TYPE_INT_2S:
-        elt->data.int_2s = 0;
-        count = gzscanf(env->file->fp, "%hd", &(elt->data.int_2s));
-        break;
-    case METAIO_TYPE_INT_2U:
-        elt->data.int_2u = 0;
-        count = gzscanf(env->file->fp, "%hu", &(elt->data.int_2u));
-        break;
-    case METAIO_TYPE_INT_8S:
-        elt->data.int_8s = 0LL;
-        count = gzscanf(env->file->fp, "%lld", &(elt->data.int_8s));
-        break;
-    case METAIO_TYPE_INT_8U:
-        elt->data.int_8u = 0LL;
-        count = gzscanf(env->file->fp, "%llu", &(elt->data.int_8u));
-        break;
-    case METAIO_TYPE_COMPLEX_8: {
-        METAIO_REAL_4 re = 0.0, im = 0.0;
-        count = gzscanf(env->file->fp, "%f+i%f", &re, &im);
-        elt->data.complex_8 = re + I * im;
-	count = count < 0 ? count : count < 2 ? 0 : 1;
-        break;
-    }
-    case METAIO_TYPE_COMPLEX_16: {
-        METAIO_REAL_8 re = 0.0, im = 0.0;
-        count = gzscanf(env->file->fp, "%lf+i%lf", &re, &im);
-        elt->data.complex_16 = re + I * im;
-	count = count < 0 ? count : count < 2 ? 0 : 1;
-        break;
-    }
-    default:
-        /* cannot get here */
-        fprintf(stderr, "BUG at %s line %d\n", __FILE__, __LINE__);
-        fputs("impossible column type\n", stderr);
-        exit(1);
+        struct GzipCursor * const c = in->gzip;
+
+        /* Start again with an empty buffer, filled from the cursor */
+        release_input(env);
+        if(cursor_seek(c, offset) < 0)
+            parse_error(env, -1, "%s", c->errmsg);
+        in->pos = offset;
+        return;
     }
+#endif
 
-    if(count < 1)
-        parse_error(env, -1, "failure parsing numeric value");
+    parse_error(env, -1, "cannot seek in \"%s\"", env->file->name);
 }
 
+/*
+ * Whether seek_input() can get to position offset ahead more quickly than
+ * reading on to it:  in compressed input, if there is an access point
+ * between here and there
+ */
+
 static
-int match_lstring(MetaioParseEnv const env,
-                   struct MetaioRowElement* const elt)
+int seek_is_quicker(MetaioParseEnv env, long long offset)
 {
-    int c = skip_whitespace(env);
-    char terminators[] = {env->ligo_lw.table.stream.delimiter, '<', '\0'};
-    if(c < 0)
-        parse_error(env, -1, "failure reading lstring:  premature EOF");
+    const struct MetaioBuffer * const in = &env->file->inbuf;
 
-    if((c == '\"') || (c == '\''))
+    if(in->mapped)
+        return 1;
+#ifdef HAVE_LIBZ
+    if(in->gzip)
     {
-        /* Found quoted string, read everything up to the matching
-         * unescaped quote */
-        elt->data.lstring.len = 0;
-        if(fscanf_lstring(env, &(elt->data.lstring), c) < 0)
-            parse_error(env, -1, "error parsing string element");
-        elt->valid = 1;
-
-        /* Consume the terminating quote */
-        if(get_char(env) != c)
-            parse_error(env, -1, "unmatched quote when reading string");
+        const struct GzipPoint * const point =
+            find_point(((struct GzipCursor *) in->gzip)->index, offset);
 
-        /* Skip trailing white space */
-        c = skip_whitespace(env);
-        if(c < 0)
-            parse_error(env, -1, "failure reading lstring:  premature EOF");
-        else if(!strchr(terminators, c))
-            parse_error(env, -1, "text following quote when reading string");
-        else
-            /* Unconsume the terminator */
-            unget_char(env, c);
-    }
-    else if(strchr(terminators, c))
-    {
-        /* Whitespace between two delimiters --> null value */
-        unget_char(env, c);
-        elt->valid = 0;
-        /* Clear any old data */
-        if(!elt->data.lstring.datasize)
-            string_resize(&elt->data.lstring, 1);
-        elt->data.lstring.len = 0;
-        elt->data.lstring.data[0] = '\0';
-    }
-    else
-    {
-        /* A string must be quoted. May as well unget what we read. */
-        unget_char(env, c);
-        parse_error(env, -1, "missing quote when reading string");
+        return point && point->out > input_position(env);
     }
+#endif
 
     return 0;
 }
 
+/*
+ * Keep the line and character counts up to date for a run of n characters
+ * starting at s that has been consumed from the input buffer.
+ */
+
 static
-int match_ilwd_char_u(MetaioParseEnv const env,
-                       struct MetaioRowElement* const elt)
+void count_chars(MetaioParseEnv env, const char *s, size_t n)
 {
-    unsigned char *cptr;
-    int c = skip_whitespace(env);
-    char terminators[] = {env->ligo_lw.table.stream.delimiter, '<', '\0'};
-    char specials[] = {env->ligo_lw.table.stream.delimiter, '\\', ' ', '\0'};
-    if(c < 0)
-        parse_error(env, -1, "failure reading ilwd_char_u:  premature EOF");
+    const char *nl;
 
-    if (c == '\"')
+    /* s may be a null pointer when the buffer is empty */
+    if(n == 0)
+        return;
+    while((nl = memchr(s, '\n', n)))
     {
-        int quote = c;
+        env->file->lineno++;
+        env->file->charno = 1;
+        n -= nl + 1 - s;
+        s = nl + 1;
+    }
+    env->file->charno += n;
+}
 
-        if(fscanf_ilwd_char_u(env, &(elt->data.blob), terminators, specials) < 0)
-            parse_error(env, -1, "error parsing ilwd:char_u element");
-        elt->valid = 1;
+/*
+ * Get the next character from the stream. This function contains
+ * a filter to guarantee we always count lines correctly
+ */
 
-        /*-- Ignore everything from the terminating quote onward --*/
-        for(cptr = elt->data.blob.data + elt->data.blob.len - 1; cptr >= elt->data.blob.data; cptr--)
-            if(*cptr == quote)
-                break;
+static inline
+int get_char(MetaioParseEnv env)
+{
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    int c;
 
-        if(cptr < elt->data.blob.data)
-            parse_error(env, -1, "unmatched quote when reading ilwd:char_u");
-        else
-        {
-            *cptr = '\0';
-            elt->data.blob.len = cptr - elt->data.blob.data;
-        }
+    if(in->next == in->end && !fill_input(env))
+        return EOF;
 
-    }
-    else if ( strchr(terminators, c) )
+    c = (unsigned char) *in->next++;
+
+    if (c == '\n')
     {
-        /* Whitespace between two delimiters --> null value */
-        unget_char(env, c);
-        elt->valid = 0;
-        /* Clear any old data */
-        elt->data.blob.len = 0;
+        env->file->lineno++;
+        env->file->charno = 1;
     }
     else
-    {
-        /* An ilwd:char_u *must* be quoted. May as well unget what we read. */
-        unget_char(env, c);
-        parse_error(env, -1, "missing quote when reading ilwd:char_u");
-    }
+        env->file->charno++;
 
-    return 0;
+    return c;
 }
 
+/*
+ * Push a character back onto the stream. The character must be the last
+ * one returned by get_char(), so this only needs to step the buffer
+ * pointer back. This function contains a filter to guarantee we always
+ * count lines correctly
+ */
 
-static int match_blob(
-    MetaioParseEnv env,
-    struct MetaioRowElement *elt
-)
+static inline
+int unget_char(MetaioParseEnv env, int c)
 {
-    int c = skip_whitespace(env);
-    char terminators[] = {env->ligo_lw.table.stream.delimiter, '<', '\0'};
     if(c < 0)
-        parse_error(env, -1, "failure reading blob:  premature EOF");
+        /* get_char() returned error --> us too */
+	return c;
 
-    if((c == '\"') || (c == '\''))
+    env->file->charno--;
+    if (c == '\n')
+        env->file->lineno--;
+
+    env->file->inbuf.next--;
+
+    return c;
+}
+
+/*
+ * Return the next non-whitespace character.
+ */
+
+static
+int skip_whitespace(MetaioParseEnv env)
+{
+    struct MetaioBuffer * const in = &env->file->inbuf;
+
+    /* Most often there is no white space at all */
+    if(in->next < in->end && !isspace((unsigned char) *in->next))
+        return get_char(env);
+
+    do
+    {
+        const char *p = scan_skip_space(in->next, in->end);
+
+        count_chars(env, in->next, p - in->next);
+        in->next += p - in->next;
+        if(p < in->end)
+            return get_char(env);
+    }
+    while(fill_input(env));
+
+    return EOF;
+}
+
+/*
+ * Advance to the next '<' in the stream, or to the end of the file.  When
+ * skipping over an element only tokens that start with '<' can end it, so
+ * everything before the next one can be passed over without tokenizing it.
+ */
+
+static
+void skip_to_tag(MetaioParseEnv env)
+{
+    struct MetaioBuffer * const in = &env->file->inbuf;
+
+    do
+    {
+        const char *p = scan_find(in->next, in->end, "<", 1);
+
+        count_chars(env, in->next, p - in->next);
+        in->next += p - in->next;
+        if(p < in->end)
+            return;
+    }
+    while(fill_input(env));
+}
+
+/*
+ * This function acts like fgets(), placing the next lstring from the file
+ * into s.  Returns the number of characters written to the string.
+ */
+
+static int fscanf_lstring(
+    MetaioParseEnv env,
+    struct MetaioString *s,
+    char terminator
+)
+{
+    char escape_character = '\\';
+    /* NOTE:  terminator must be listed last because it can be 0 */
+    /* FIXME:  (9.x) remove delimiter, only listed for temporary backwards
+     * compatibility with pre-8.x documents */
+    char escapables[] = {escape_character, env->ligo_lw.table.stream.delimiter, terminator, '\0'};
+    const char specials[] = {'<', '&', escape_character, terminator};
+    size_t start_len = s->len;
+    int is_character_entity = 0;
+    int is_escaped = 0;
+    int start_of_character_entity = -1;
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    const char *p;
+
+    /* Most strings have no escapes or character entities, and lie whole
+     * in the input buffer:  if the first special character is the
+     * terminator, the string is everything before it, with nothing to
+     * unescape, and is copied at once */
+    p = scan_find(in->next, in->end, specials, sizeof(specials));
+    if(p < in->end && *p == terminator)
+    {
+        const size_t n = p - in->next;
+
+        if(s->len + n >= s->datasize && string_resize(s, s->len + n) < 0)
+            parse_error(env, -1, "cannot allocate memory for lstring");
+        memcpy(s->data + s->len, in->next, n);
+        s->len += n;
+        s->data[s->len] = '\0';
+        count_chars(env, in->next, n);
+        /* The terminator is left unconsumed */
+        in->next += n;
+        return n;
+    }
+
+    /* Make sure we start with at least a zero-length string */
+    string_resize(s, 1);
+    s->data[0] = '\0';
+
+    /* Retrieve the string upto but not including an unescaped terminator */
+    do
+    {
+        int c;
+
+        /* Outside of escapes and character entities, copy any run of
+         * ordinary characters straight from the input buffer */
+        if(!is_character_entity && !is_escaped)
+        {
+            const char *start = in->next;
+
+            p = scan_find(start, in->end, specials, sizeof(specials));
+
+            if(p != start)
+            {
+                append_chars(s, start, p - start);
+                count_chars(env, start, p - start);
+                in->next += p - start;
+            }
+        }
+
+        /* Get a character */
+        c = get_char(env);
+        if(c < 0)
+            parse_error(env, -1, "failure reading lstring:  premature EOF");
+
+        /* Start of an XML tag --> end of string */
+        if(c == '<')
+        {
+            /* Unconsume the start-of-tag */
+            unget_char(env, c);
+            break;
+        }
+
+        /* Are we starting a character entity? */
+        if((c == '&') && !is_character_entity)
+        {
+            is_character_entity = 1;
+            start_of_character_entity = s->len;
+        }
+
+        /* Have we just ended a character entity? */
+        if((c == ';') && is_character_entity)
+        {
+            is_character_entity = 0;
+            append_char(s, c);
+            c = character_entity(&s->data[start_of_character_entity]);
+            if(!c)
+                /* Not recognized */
+                parse_error(env, -1, "unrecognized character entity \"%s\"", &s->data[start_of_character_entity]);
+            /* Recognized, unwind to start of character entity */
+            s->len = start_of_character_entity;
+            s->data[s->len] = '\0';
+        }
+
+        /* End of string? */
+        if((c == terminator) && !is_escaped)
+        {
+            /* Unconsume the terminator */
+            unget_char(env, c);
+            break;
+        }
+
+        /* Escaped? */
+        if(is_escaped && !is_character_entity)
+        {
+            if(!strchr(escapables, c))
+		/* Escaped character is not in the list of characters that
+                 * can be escaped */
+                parse_error(env, -1, "unrecognized escape sequence \"%hhc%c\"", escape_character, c);
+            /* Strip preceding backslash */
+            s->len--;
+            s->data[s->len] = '\0';
+            /* Append character to string */
+            append_char(s, c);
+        }
+        else
+            /* Append character to string */
+            append_char(s, c);
+
+        /* Is the next character escaped? */
+        is_escaped = is_escaped ? is_character_entity : c == escape_character;
+    }
+    while(1);
+
+    /* Done */
+    return s->len - start_len;
+}
+
+/*
+ * This function acts like fread(), placing the next decoded blob from the
+ * file into s.  Returns the number of octets in the decoded blob or
+ * < 0 on error.  The base64 text is decoded as it is read, a block of the
+ * input buffer at a time, so it is never copied.
+ */
+
+static int fscanf_blob(
+    MetaioParseEnv env,
+    struct MetaioStringU *s,
+    char terminator
+)
+{
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    struct base64_decode_context ctx;
+    const char specials[] = {'<', terminator};
+    const char *p;
+    size_t n;
+
+    base64_decode_ctx_init(&ctx);
+    s->len = 0;
+
+    /* Decode the string upto but not including a terminator.  The whole
+     * blob is one block when it is already in the input buffer (which is
+     * always the case for a mapped file) */
+    do
+    {
+        const char *start = in->next;
+
+        if(start == in->end)
+        {
+            if(!fill_input(env))
+                parse_error(env, -1, "failure reading blob:  premature EOF");
+            continue;
+        }
+
+        /* Start of an XML tag or terminator --> end of string */
+        p = scan_find(start, in->end, specials, sizeof(specials));
+
+        if(p > start)
+        {
+            /* Make room for the octets of this block and of the characters
+             * left over from the last one.  Formula for the decoded length
+             * copied from base64.c */
+            const size_t need = s->len + 3 * ((ctx.i + (p - start)) / 4);
+
+            if(need >= s->datasize)
+                if(stringu_resize(s, need) < 0)
+                    /* Memory error */
+                    return -1;
+
+            n = s->datasize - s->len;
+            if(!base64_decode_ctx(&ctx, start, p - start,
+                                  (char *) s->data + s->len, &n))
+                /* Decode error */
+                return -1;
+            s->len += n;
+
+            count_chars(env, start, p - start);
+            in->next += p - start;
+        }
+
+        /* Leave the terminating character unconsumed */
+        if(p < in->end)
+            break;
+    }
+    while(1);
+
+    /* Check that no characters were left over */
+    if(!base64_decode_ctx(&ctx, NULL, 0, NULL, &n))
+        return -1;
+
+    /* Done */
+    return s->len;
+}
+
+/*
+ * Lookup tables for the ilwd:char_u codec, indexed by the (unsigned)
+ * character or byte.  TABLE256(F) expands to F(0), F(1), ... F(255).
+ */
+
+#define TABLE4(F, n) F(n), F((n) + 1), F((n) + 2), F((n) + 3)
+#define TABLE16(F, n) \
+    TABLE4(F, n), TABLE4(F, (n) + 4), TABLE4(F, (n) + 8), TABLE4(F, (n) + 12)
+#define TABLE64(F, n) \
+    TABLE16(F, n), TABLE16(F, (n) + 16), TABLE16(F, (n) + 32), \
+    TABLE16(F, (n) + 48)
+#define TABLE256(F) \
+    TABLE64(F, 0), TABLE64(F, 64), TABLE64(F, 128), TABLE64(F, 192)
+
+/* What to do with a character of an ilwd:char_u in the input */
+enum { ILWD_BYTE, ILWD_SPACE, ILWD_ESCAPE, ILWD_OTHER };
+
+#define ILWD_CLASS(c) \
+    ((c) == ' ' || ((c) >= '\t' && (c) <= '\r') ? ILWD_SPACE : \
+     (c) == '\\' ? ILWD_ESCAPE : \
+     (c) == '&' || (c) == '<' ? ILWD_OTHER : ILWD_BYTE)
+
+static const unsigned char ilwd_class[256] = { TABLE256(ILWD_CLASS) };
+
+/* The value of an octal digit, or 8 for any other character */
+#define OCTAL_DIGIT(c) ((c) >= '0' && (c) <= '7' ? (c) - '0' : 8)
+
+static const unsigned char octal_digit[256] = { TABLE256(OCTAL_DIGIT) };
+
+/* The escape sequence \ooo writing a byte in an ilwd:char_u */
+#define OCTAL_ESCAPE(b) \
+    { '\\', '0' + ((b) >> 6), '0' + (((b) >> 3) & 7), '0' + ((b) & 7) }
+
+static const char octal_escape[256][4] = { TABLE256(OCTAL_ESCAPE) };
+
+/*
+ * Read an octal number of up to 3 digits from the stream, like
+ * scanf("%3o").  Returns 1 if a number was read and 0 if the next
+ * character is not an octal digit, in which case nothing is consumed.
+ */
+
+static
+int read_octal(MetaioParseEnv env, int *val)
+{
+    int ndigits;
+
+    *val = 0;
+    for(ndigits = 0; ndigits < 3; ndigits++)
+    {
+        int c = get_char(env);
+        if(c < '0' || c > '7')
+        {
+            unget_char(env, c);
+            break;
+        }
+        *val = *val * 8 + (c - '0');
+    }
+
+    return ndigits ? 1 : 0;
+}
+
+/*
+ * Scan the file for a ilwd:char_u string until the quote character is
+ * reached.  The quote character us not consumed. An ilwd:char staring
+ * consists of a combination of the following:
+ *
+ * - Unsigned bytes represented by 3 octal digits eg. \123
+ *
+ * - Non-space character eg. xyz
+ *
+ * - Backslash-escaped characters eg. backslash \\, space \ , comma \,
+ *   and quotes \" or \'.
+ *
+ * The string may be any combination of the above. Spaces are treated as
+ * separators between two bytes and are ignored, unless escaped using a
+ * backslash. eg. '\057 a\ b  \"x' would (in ASCII) be translated to 'Wa b"x'.
+ *
+ * Like scanf(), this function returns the number of objects assigned,
+ * which in this case means the number of Byte objects, *not* the number
+ * of bytes - that value is contained in the 'len' field of the Byte object.
+ *
+ * If one or more valid bytes is read, 1 is returned.
+ *
+ * If no valid bytes are read, 0 is returned.
+ * 
+ * If EOF is reached before any valid bytes are read, EOF is returned.
+ *
+ * :NOTE: 
+ * 
+ * A slight flaw in this code is that it will accept octal
+ * strings that are shorter than 3 characters eg. \10.
+ */
+
+static
+int fscanf_ilwd_char_u(
+    MetaioParseEnv env,
+    struct MetaioStringU *b,
+    const char *terminators,
+    const char *specials
+)
+{
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    const char *p = in->next;
+    const char *end;
+    int val;
+    int count = 1;
+    int ret   = 0;
+
+    b->len = 0;
+
+    /* Decode bytes that are written plainly or as 3 octal digits straight
+     * from the input buffer, upto the terminator or the end of the buffer.
+     * The loop below carries on from there, and takes care of character
+     * entities, escaped specials, shorter or out of range octal numbers
+     * and errors */
+    end = scan_find(p, in->end, terminators, strlen(terminators));
+    if(p < end)
+    {
+        if((size_t) (end - p) >= b->datasize && stringu_resize(b, end - p) < 0)
+            parse_error(env, -1, "failure reading ilwd_char_u:  out of memory");
+
+        while(p < end)
+        {
+            const unsigned char c = *p;
+
+            if(ilwd_class[c] == ILWD_BYTE)
+            {
+                b->data[b->len++] = c;
+                p++;
+            }
+            else if(ilwd_class[c] == ILWD_SPACE)
+                p++;
+            else if(ilwd_class[c] == ILWD_ESCAPE && end - p >= 4)
+            {
+                const unsigned int hi = octal_digit[(unsigned char) p[1]];
+                const unsigned int mid = octal_digit[(unsigned char) p[2]];
+                const unsigned int lo = octal_digit[(unsigned char) p[3]];
+
+                /* A digit of 8 means one was not octal */
+                if((hi | mid | lo) > 7 || hi > 3)
+                    break;
+                b->data[b->len++] = hi << 6 | mid << 3 | lo;
+                p += 4;
+            }
+            else
+                break;
+        }
+        b->data[b->len] = '\0';
+
+        count_chars(env, in->next, p - in->next);
+        in->next += p - in->next;
+    }
+
+    /*-- Get first character which is not a space --*/
+    val = skip_whitespace(env);
+    if(val < 0)
+        parse_error(env, -1, "failure reading ilwd_char_u:  premature EOF");
+
+    while ((count == 1) && (val <= 256) && ! strchr(terminators, val) && (val != EOF))
+    {
+        if (val == '&')
+        {
+            char tmp[8] = {val, 0, };
+            int i;
+            
+            for(i = 1; i < sizeof(tmp) - 1;)
+            {
+                int c = get_char(env);
+                if( c < 0 )
+                    parse_error(env, -1, "failure reading ilwd_char_u:  premature EOF");
+                tmp[i] = c;
+                if(tmp[i++] == ';')
+                {
+                    tmp[i] = 0;
+                    break;
+                }
+            }
+
+            /* Identify the character entity */
+            val = character_entity(tmp);
+        }
+        else if (val == '\\')
+        {
+            val = get_char(env);
+            if ( val < 0 )
+                parse_error(env, -1, "failure reading ilwd_char_u:  premature EOF");
+            if (isdigit(val))
+            {
+                /*
+                  We got something of the form \[digit][digit]...
+                  read it as an octal.
+                */
+                unget_char(env, (int) val);
+                count = read_octal(env, &val);
+            }
+            else if ( strchr(specials, val) )
+                /* We got a properly-escaped character (such as space) */
+                count = 1;            
+            else
+                /*-- This character should not have been escaped --*/
+                parse_error(env, -1, "invalid escape sequence \"\\%c\"", val);
+        }
+        append_char_u(b, val);
+
+        /*-- Get next character, skipping any spaces. --*/
+        val = skip_whitespace(env);
+        if(val < 0)
+            parse_error(env, -1, "failure reading ilwd_char_u:  premature EOF");
+    }
+    
+    /* Unget the character that caused the loop to finish */
+    unget_char(env, (int) val);
+
+    /*
+      A val of > 256 means that a valid octal string or character was read
+      but it was too large to fit in a byte. This invalidates the whole
+      string, so we abandon any data we got.
+    */
+    
+    if (val > 256)
+    {
+        b->len = 0;
+        ret = 0;
+    }
+    else 
+    {   
+        if (b->len == 0)
+            ret = count == EOF ? EOF : 0;
+        else
+            ret = 1;
+    }
+
+    return ret;
+}
+
+/*
+ * See if the current table name (stored in env->ligo_lw.table.name) matches
+ * the table which is being searched for (stored in env->file->tablename).
+ *
+ * The two are deemed to match if any of the following conditions are true:
+ * 1) tablename is a null pointer
+ * 2) tablename points to the null string
+ * 3) tablename exactly matches the last characters of ligo_lw.table.name
+ * 4) tablename exactly matches the last characters of ligo_lw.table.name
+ *    before the terminating string ":table"
+ *
+ * Eg. if tablename = "foo" then it matches ligo_lw.table.name values such as
+ *   - ligo_lw.table.name = "foo" or "foo:table"
+ *   - ligo_lw.table.name = "bar:foo" or "bar:foo:table"
+ * etc.
+ *
+ * Returns 0 if the table names match, non-zero otherwise
+ */
+
+static
+int tablename_matches(const char* const name, const char* const tablename)
+{
+    int match = 0;
+
+    if (tablename == 0)
+        match = 1;
+    else 
+    {
+        size_t len_tablename = strlen(tablename);
+        if (len_tablename == 0)
+            match = 1;
+        else
+        {
+            size_t len = strlen(name);
+            if (len >= 6 && !strcasecmp(name+len-6, ":table"))
+            {
+                if (len >= 6 + len_tablename && !strncasecmp(name+len-6-len_tablename, tablename, len_tablename))
+                    match = 1;
+            }
+            else
+            {
+                if (len >= len_tablename && !strncasecmp(name+len-len_tablename, tablename, len_tablename))
+                    match = 1;
+            }
+        }
+    }
+
+    return match;
+}
+
+static
+int match_tablename(MetaioParseEnv const env)
+{
+    return tablename_matches(env->ligo_lw.table.name, env->file->tablename);
+}
+
+/*
+ * See if the string s matches any of the token strings (case-insensitive).
+ * If it does, the function returns an integer correspondending to one of
+ * the elements of the enumerated type Token (which includes zero), otherwise
+ * it returns the integer corresponding to UNKNOWN.
+ */
+
+static
+enum Token match_token_string(const char* const s)
+{
+    enum Token i;
+    for(i = 0; i < UNKNOWN; i++)
+        if(!strcmp(TokenText[i], s))
+            break;
+    return i;
+}
+
+/*
+ * See if the string s matches any of the type strings (case-insensitive).
+ * If it does, the function returns an integer correspondending to one of
+ * the elements of the enumerated type METAIO_Type (which includes zero),
+ * otherwise it returns the integer corresponding to METAIO_TYPE_UNKNOWN.
+ */
+
+static
+enum METAIO_Type match_type_string(const char* const s)
+{
+    enum METAIO_Type i;
+
+    for(i = 0; i < METAIO_TYPE_UNKNOWN; i++)
+    {
+        const char * const *name;
+        for(name = TypeText[i].name; *name; name++)
+            if(!strcasecmp(*name, s))
+                return i;
+    }
+    return METAIO_TYPE_UNKNOWN;
+}
+
+/*
+ * Returns a pointer to a string containing the name of the token
+ */
+
+static
+const char* token_text(enum Token token)
+{
+    if(token >= 0 && token < UNKNOWN)
+        return TokenText[token];
+    if(token == END_OF_FILE)
+        return "END_OF_FILE";
+    return "UNKNOWN";
+}
+
+/*
+ * Returns a pointer to a string containing the name of the type, or NULL
+ * if the type is not recognized.
+ */
+
+const char *MetaioTypeText(int type)
+{
+    if(type >= 0 && type < METAIO_TYPE_UNKNOWN)
+        return TypeText[type].name[0];
+    return NULL;
+}
+
+static
+int read_token_string(MetaioParseEnv const env, struct MetaioString * const s)
+{
+    size_t start_len = s->len;
+    int c = get_char(env);
+
+    while (is_token_char(c) && (c != EOF))
+    {
+        append_char(s, c);
+        c = get_char(env);
+    }
+
+    /* Unconsume the character that caused us to halt */
+    unget_char(env, c);
+
+    return s->len - start_len;
+}
+
+static
+void read_attribute_value(MetaioParseEnv const env, struct MetaioString * const s)
+{
+    int quote = skip_whitespace(env);
+    if(quote < 0)
+        parse_error(env, -1, "failure reading attribute value:  premature EOF");
+
+    if(quote == '\"' || quote == '\'')
+    {
+        if ( fscanf_lstring(env, s, quote) < 0 )
+            parse_error(env, -1, "failure parsing attribute value");
+
+        /* Consume the terminating quote */
+        if(get_char(env) != quote)
+            parse_error(env, -1, "unmatched quote when reading attribute value");
+    }
+    else
+    {
+        /* Attributes *must* be quoted. May as well unget what we read. */
+        unget_char(env, quote);
+        parse_error(env, -1, "missing quote when reading attribute value");
+    }
+}
+
+static
+void get_next_token(MetaioParseEnv const env)
+{
+    int c = skip_whitespace(env);
+
+    env->buffer.len = 0;
+    if(c >= 0)
+        append_char(&(env->buffer), c);
+
+    switch(c)
+    {
+    case '<':
+        c = skip_whitespace(env);
+        if(c < 0)
+            parse_error(env, -1, "failure reading tag:  premature EOF");
+        append_char(&(env->buffer), c);
+        read_token_string(env, &(env->buffer));
+        env->token = match_token_string(env->buffer.data);
+        break;
+    case '>':
+        env->token = GREATER_THAN;
+        break;
+    case '=':
+        env->token = EQUALS;
+        break;
+    case '/':
+        env->token = FORWARD_SLASH;
+        break;
+    case EOF:
+        env->token = END_OF_FILE;
+        break;
+    default:
+        read_token_string(env, &(env->buffer));
+        env->token = match_token_string(env->buffer.data);
+        break;
+    }
+}
+
+static
+void unexpected_token(MetaioParseEnv const env, enum Token expected)
+{
+    parse_error(env, -1, "got %s when expecting %s", token_text(env->token), token_text(expected));
+}
+
+static
+void match(MetaioParseEnv const env, enum Token token)
+{
+    if (env->token == token)
+        get_next_token(env);
+    else
+        unexpected_token(env, token);
+}
+
+static
+void name(MetaioParseEnv const env, char **s)
+{
+    switch(env->token)
+    {
+    case NAME:
+        match(env, NAME);
+        env->buffer.len = 0;
+        read_attribute_value(env, &(env->buffer));
+        assign_cstr(env, s, env->buffer.data);
+        match(env, EQUALS);
+        break;
+    default:
+        assign_cstr(env, s, "");
+        break;
+    }
+}
+
+static
+void type(MetaioParseEnv const env, char **s)
+{
+    switch(env->token)
+    {
+    case TYPE:
+        match(env, TYPE);
+        env->buffer.len = 0;
+        read_attribute_value(env, &(env->buffer));
+        assign_cstr(env, s, env->buffer.data);
+        match(env, EQUALS);
+        break;
+
+    default:
+        assign_cstr(env, s, "Local");
+        break;
+    }
+
+    return;
+}
+
+static
+void data_type(MetaioParseEnv const env, enum METAIO_Type * const type)
+{
+    match(env, TYPE);
+
+    env->buffer.len = 0;
+    read_attribute_value(env, &(env->buffer));
+
+    *type = match_type_string(env->buffer.data);
+    if (*type == METAIO_TYPE_UNKNOWN)
+    {
+        /*-- Haven't yet set up pointers for this column, so ignore it --*/
+        env->ligo_lw.table.numcols--;
+        parse_error(env, -1, "unknown data type \"%s\"", env->buffer.data);
+    }
+
+    match(env, EQUALS);
+}
+
+static
+void delimiter(MetaioParseEnv const env, char* const c)
+{
+    match(env, DELIMITER);
+
+    env->buffer.len = 0;
+    read_attribute_value(env, &(env->buffer));
+
+    if (env->buffer.len > 1)
+        parse_error(env, -1, "invalid delimiter \"%s\", must be a single character", env->buffer.data);
+
+    *c = env->buffer.data[0];
+
+    /*
+     * Some delimiter characters are banned, including most things that
+     * can appear in a row element.
+     */
+    if (*c == '\0' || strchr("<\"\'\\0123456789+-.Ee", *c))
+        parse_error(env, -1, "character '%hhc' is invalid as a delimiter", *c);
+
+    match(env, EQUALS);
+}
+
+static
+void comment(MetaioParseEnv const env, char **s)
+{
+    if(env->token == COMMENT)
+    {
+        match(env, COMMENT);
+        env->buffer.len = 0;
+        if ( fscanf_lstring(env, &(env->buffer), 0) < 0 )
+            parse_error(env, -1, "failure parsing Comment text");
+        assign_cstr(env, s, env->buffer.data);
+        match(env, GREATER_THAN);
+        match(env, CLOSE_COMMENT);
+        match(env, GREATER_THAN);
+    }
+    else
+        assign_cstr(env, s, "");
+}
+
+/*
+ * Give column i of the table a new type.  Its row element is cleared, but
+ * a string buffer the element holds is kept if the new type is also a
+ * string type, so that a table read again into the same environment
+ * reuses the memory of the last one.
+ */
+
+static
+void set_column_type(struct MetaioTable * const table, int i,
+                     enum METAIO_Type type)
+{
+    struct MetaioColumn * const col = &table->col[i];
+    struct MetaioRowElement * const elt = &table->elt[i];
+    void *data = 0;
+    size_t datasize = 0;
+
+    if(col->data_type == METAIO_TYPE_BLOB || col->data_type == METAIO_TYPE_ILWD_CHAR_U)
+    {
+        data = elt->data.blob.data;
+        datasize = elt->data.blob.datasize;
+    }
+    else if(col->data_type == METAIO_TYPE_LSTRING || col->data_type == METAIO_TYPE_ILWD_CHAR || col->data_type == METAIO_TYPE_CHAR_S || col->data_type == METAIO_TYPE_CHAR_V)
+    {
+        data = elt->data.lstring.data;
+        datasize = elt->data.lstring.datasize;
+    }
+
+    memset(elt, 0, sizeof(*elt));
+    elt->col = col;
+    col->data_type = type;
+    col->skip = 0;
+
+    if(type == METAIO_TYPE_BLOB || type == METAIO_TYPE_ILWD_CHAR_U)
+    {
+        elt->data.blob.data = data;
+        elt->data.blob.datasize = datasize;
+    }
+    else if(type == METAIO_TYPE_LSTRING || type == METAIO_TYPE_ILWD_CHAR || type == METAIO_TYPE_CHAR_S || type == METAIO_TYPE_CHAR_V)
+    {
+        elt->data.lstring.data = data;
+        elt->data.lstring.datasize = datasize;
+    }
+    else
+        free(data);
+}
+
+static
+void column_attr(MetaioParseEnv const env)
+{
+    int colnum = env->ligo_lw.table.numcols - 1;
+    enum METAIO_Type type;
+
+    switch(env->token)
+    {
+    case TYPE:
+      /*-- Type, then name --*/
+      data_type(env, &type);
+      DEBUGMSG2("DATA TYPE = \"%s\"\n", MetaioTypeText(type));
+
+      name(env, &(env->ligo_lw.table.col[colnum].name));
+      DEBUGMSG2("NAME = \"%s\"\n", env->ligo_lw.table.col[colnum].name);
+      break;
+
+    default:
+      /*-- Name, then type --*/
+      name(env, &(env->ligo_lw.table.col[colnum].name));
+      DEBUGMSG2("NAME = \"%s\"\n", env->ligo_lw.table.col[colnum].name);
+
+      data_type(env, &type);
+      DEBUGMSG2("DATA TYPE = \"%s\"\n", MetaioTypeText(type));
+      break;
+    }
+
+    set_column_type(&env->ligo_lw.table, colnum, type);
+
+    match(env, FORWARD_SLASH);
+    match(env, GREATER_THAN);
+}
+
+/*
+ * Make room for n columns in the table, keeping the ones it has.  The
+ * column and element arrays grow together to exactly n slots, and the
+ * elements are pointed back at their columns in case those moved.  The
+ * new slots are zeroed.  Returns 0, or -1 if memory runs out.
+ */
+
+static
+int grow_columns(struct MetaioTable * const table, int n)
+{
+    struct MetaioColumn *col;
+    struct MetaioRowElement *elt;
+    int i;
+
+    if(n <= table->maxcols)
+        return 0;
+
+    if(!(col = realloc(table->col, n * sizeof(*col))))
+        return -1;
+    table->col = col;
+    if(!(elt = realloc(table->elt, n * sizeof(*elt))))
+        return -1;
+    table->elt = elt;
+
+    memset(col + table->maxcols, 0, (n - table->maxcols) * sizeof(*col));
+    memset(elt + table->maxcols, 0, (n - table->maxcols) * sizeof(*elt));
+    for(i = 0; i < table->maxcols; i++)
+        if(elt[i].col)
+            elt[i].col = &col[i];
+    table->maxcols = n;
+
+    return 0;
+}
+
+static
+void column(MetaioParseEnv const env)
+{
+    if (grow_columns(&env->ligo_lw.table, env->ligo_lw.table.numcols + 1) < 0)
+        parse_error(env, -1, "out of memory for column %d", env->ligo_lw.table.numcols + 1);
+    env->ligo_lw.table.numcols++;
+
+    match(env, COLUMN);
+    column_attr(env);
+}
+
+/*
+ * Hash a column name as MetaioFindColumn() compares it, ignoring case
+ */
+
+static
+unsigned column_hash(const char *name)
+{
+    unsigned h = 2166136261u;
+
+    for(; *name; name++)
+        h = (h ^ (unsigned char) tolower((unsigned char) *name)) * 16777619u;
+    return h;
+}
+
+/*
+ * Build the hash of the column names of the current table used by
+ * MetaioFindColumn(), in the arena of env.  The hash is open-addressed
+ * with at least twice as many slots as there are columns, and holds the
+ * first of any columns with the same name.  Returns 0, or -1 if memory
+ * runs out.
+ */
+
+static
+int index_columns(MetaioParseEnv const env)
+{
+    struct MetaioTable * const table = &env->ligo_lw.table;
+    int size = 8;
+    int i;
+
+    while(size < 2 * table->numcols)
+        size *= 2;
+
+    table->hashsize = 0;
+    if(!table->colhash || arena_capacity(table->colhash) < size * sizeof(int))
+    {
+        int * const colhash = arena_alloc(env, size * sizeof(int));
+        if(!colhash)
+            return -1;
+        table->colhash = colhash;
+    }
+    memset(table->colhash, 0, size * sizeof(int));
+
+    for(i = 0; i < table->numcols; i++)
+    {
+        const char * const name = MetaioColumnName(env, i);
+        unsigned slot = column_hash(name) & (size - 1);
+
+        while(table->colhash[slot] &&
+              strcasecmp(name, MetaioColumnName(env, table->colhash[slot] - 1)))
+            slot = (slot + 1) & (size - 1);
+        if(!table->colhash[slot])
+            table->colhash[slot] = i + 1;
+    }
+
+    table->hashsize = size;
+    return 0;
+}
+
+/*
+ * The rows of a table are decoded by walking a plan compiled from its
+ * columns when the Stream header is read, rather than by looking at the
+ * type of every element of every row.  The plan has a step for each
+ * column, holding the decoder for its type, except that a run of
+ * columns passed over by MetaioSelectColumns() makes a single step.  The
+ * characters that end an element in the stream are worked out once, in
+ * the plan, instead of by each decoder on every call.
+ */
+
+struct DecodePlan;
+
+typedef void DecodeFunc(MetaioParseEnv, const struct DecodePlan *,
+                        struct MetaioRowElement *, int);
+
+struct DecodeStep {
+    DecodeFunc *decode;
+    int col;                /* The first column of the step */
+    int n;                  /* The number of columns it covers */
+};
+
+struct DecodePlan {
+    int nsteps;             /* -1 if the columns have changed since */
+    char terminators[3];    /* The characters that end a string element */
+    char specials[4];       /* and those scanned for in an ilwd:char_u */
+    char numeric[7];        /* and in a numeric element */
+    struct DecodeStep step[];
+};
+
+/*
+ * Consume the text of a numeric row element, up to but not including the
+ * first character that ends the element, and return the span [start,
+ * *end) holding it.  The span points straight into the input buffer when
+ * the element lies entirely within it, and into buf otherwise, or into
+ * env->buffer if the text does not fit into buf.
+ */
+
+static
+const char *read_numeric_text(MetaioParseEnv const env,
+                              const struct DecodePlan *plan, char *buf,
+                              size_t size, const char **end)
+{
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    struct MetaioString * const spill = &env->buffer;
+    const char * const specials = plan->numeric;
+    int spilled = 0;
+    size_t len = 0;
+
+    do
+    {
+        const char *start, *p;
+        size_t n;
+
+        if(in->next == in->end && !fill_input(env))
+            break;
+        start = in->next;
+        p = scan_find(start, in->end, specials, sizeof(plan->numeric));
+        n = p - start;
+        /* Newlines end the element, so there are none to count */
+        env->file->charno += n;
+        in->next += n;
+
+        /* The whole element is in the buffer:  no need to copy it */
+        if(!len && p < in->end)
+        {
+            *end = p;
+            return start;
+        }
+
+        /* Carry on in env->buffer if buf is too small */
+        if(!spilled && len + n > size)
+        {
+            spill->len = 0;
+            if(append_chars(spill, buf, len) < 0)
+                parse_error(env, -1, "cannot allocate memory for numeric value");
+            spilled = 1;
+        }
+        if(!spilled)
+            memcpy(buf + len, start, n);
+        else if(append_chars(spill, start, n) < 0)
+            parse_error(env, -1, "cannot allocate memory for numeric value");
+        len += n;
+
+        if(p < in->end)
+            break;
+    }
+    while(1);
+
+    if(spilled)
+    {
+        *end = spill->data + spill->len;
+        return spill->data;
+    }
+    *end = buf + len;
+    return buf;
+}
+
+/*
+ * Parse a complex number of the form "re+iim".  Returns -1 if either part
+ * fails to parse, otherwise 1 if either is out of range, as for the
+ * numeric_parse_*() functions.
+ */
+
+static
+int parse_complex(const char *s, const char *end, double *re, double *im,
+                  float *re_4, float *im_4)
+{
+    const char *p;
+    int status, status_im;
+
+    status = re ? numeric_parse_double(s, end, re, &p) : numeric_parse_float(s, end, re_4, &p);
+    if(status < 0)
+        return -1;
+    if(end - p < 2 || p[0] != '+' || p[1] != 'i')
+        return -1;
+    p += 2;
+    status_im = im ? numeric_parse_double(p, end, im, &p) : numeric_parse_float(p, end, im_4, &p);
+    return status_im ? status_im : status;
+}
+
+/*
+ * Start decoding a numeric row element.  Returns the span [text, *end)
+ * holding its text, or NULL if the element is null, in which case it has
+ * been marked so.
+ */
+
+static
+const char *numeric_text(MetaioParseEnv const env,
+                         const struct DecodePlan *plan,
+                         struct MetaioRowElement* const elt,
+                         char *buf, size_t size, const char **end)
+{
+    /*
+      Need to skip whitespace with this function, since
+      read_numeric_text() stops at newlines
+    */
+    int c = skip_whitespace(env);
+    if(c < 0)
+        parse_error(env, -1, "failure reading number:  premature EOF");
+    unget_char(env, c);
+
+    /* Zero or more whitespace between two delimiters maps to a null value */
+    if(c == plan->terminators[0])
+    {
+        elt->valid = 0;
+        memset(&elt->data, 0, sizeof(elt->data));
+        return NULL;
+    }
+    elt->valid = 1;
+
+    /* As with sscanf(), anything following the number is ignored */
+    return read_numeric_text(env, plan, buf, size, end);
+}
+
+/*
+ * Report the failure of a numeric parse, if it failed
+ */
+
+static
+void check_numeric(MetaioParseEnv const env, int status)
+{
+    if(status < 0)
+        parse_error(env, -1, "failure parsing numeric value");
+    else if(status > 0)
+        parse_error(env, -1, "numeric value out of range");
+}
+
+/*
+ * The decoders of the numeric types.  As with sscanf(), anything
+ * following the number is ignored.
+ */
+
+static
+void decode_real_4(MetaioParseEnv const env, const struct DecodePlan *plan,
+                   struct MetaioRowElement* const elt, int n)
+{
+    char buf[4096];
+    const char *text, *end, *stop;
+
+    (void) n;
+    if(!(text = numeric_text(env, plan, elt, buf, sizeof(buf), &end)))
+        return;
+    elt->data.real_4 = 0.0;
+    check_numeric(env, numeric_parse_float(text, end, &(elt->data.real_4), &stop));
+}
+
+static
+void decode_real_8(MetaioParseEnv const env, const struct DecodePlan *plan,
+                   struct MetaioRowElement* const elt, int n)
+{
+    char buf[4096];
+    const char *text, *end, *stop;
+
+    (void) n;
+    if(!(text = numeric_text(env, plan, elt, buf, sizeof(buf), &end)))
+        return;
+    elt->data.real_8 = 0.0;
+    check_numeric(env, numeric_parse_double(text, end, &(elt->data.real_8), &stop));
+}
+
+#define DECODE_INT(func, member, min, max)                                  \
+static                                                                      \
+void func(MetaioParseEnv const env, const struct DecodePlan *plan,          \
+          struct MetaioRowElement* const elt, int n)                        \
+{                                                                           \
+    char buf[4096];                                                         \
+    const char *text, *end, *stop;                                          \
+    long long ival;                                                         \
+    int status;                                                             \
+                                                                            \
+    (void) n;                                                               \
+    if(!(text = numeric_text(env, plan, elt, buf, sizeof(buf), &end)))     \
+        return;                                                             \
+    status = numeric_parse_int(text, end, min, max, &ival, &stop);          \
+    elt->data.member = status ? 0 : ival;                                   \
+    check_numeric(env, status);                                             \
+}
+
+#define DECODE_UINT(func, member, max)                                      \
+static                                                                      \
+void func(MetaioParseEnv const env, const struct DecodePlan *plan,          \
+          struct MetaioRowElement* const elt, int n)                        \
+{                                                                           \
+    char buf[4096];                                                         \
+    const char *text, *end, *stop;                                          \
+    unsigned long long uval;                                                \
+    int status;                                                             \
+                                                                            \
+    (void) n;                                                               \
+    if(!(text = numeric_text(env, plan, elt, buf, sizeof(buf), &end)))     \
+        return;                                                             \
+    status = numeric_parse_uint(text, end, max, &uval, &stop);              \
+    elt->data.member = status ? 0 : uval;                                   \
+    check_numeric(env, status);                                             \
+}
+
+DECODE_INT(decode_int_2s, int_2s, INT16_MIN, INT16_MAX)
+DECODE_INT(decode_int_4s, int_4s, INT32_MIN, INT32_MAX)
+DECODE_INT(decode_int_8s, int_8s, INT64_MIN, INT64_MAX)
+DECODE_UINT(decode_int_2u, int_2u, UINT16_MAX)
+DECODE_UINT(decode_int_4u, int_4u, UINT32_MAX)
+DECODE_UINT(decode_int_8u, int_8u, UINT64_MAX)
+
+static
+void decode_complex_8(MetaioParseEnv const env, const struct DecodePlan *plan,
+                      struct MetaioRowElement* const elt, int n)
+{
+    char buf[4096];
+    const char *text, *end;
+    METAIO_REAL_4 re = 0.0, im = 0.0;
+    int status;
+
+    (void) n;
+    if(!(text = numeric_text(env, plan, elt, buf, sizeof(buf), &end)))
+        return;
+    status = parse_complex(text, end, NULL, NULL, &re, &im);
+    elt->data.complex_8 = re + I * im;
+    check_numeric(env, status);
+}
+
+static
+void decode_complex_16(MetaioParseEnv const env, const struct DecodePlan *plan,
+                       struct MetaioRowElement* const elt, int n)
+{
+    char buf[4096];
+    const char *text, *end;
+    METAIO_REAL_8 re = 0.0, im = 0.0;
+    int status;
+
+    (void) n;
+    if(!(text = numeric_text(env, plan, elt, buf, sizeof(buf), &end)))
+        return;
+    status = parse_complex(text, end, &re, &im, NULL, NULL);
+    elt->data.complex_16 = re + I * im;
+    check_numeric(env, status);
+}
+
+static
+void decode_lstring(MetaioParseEnv const env, const struct DecodePlan *plan,
+                    struct MetaioRowElement* const elt, int n)
+{
+    const char * const terminators = plan->terminators;
+    int c;
+
+    (void) n;
+    /*-- Mark this item as invalid, until we successfully parse it --*/
+    elt->valid = 0;
+
+    c = skip_whitespace(env);
+    if(c < 0)
+        parse_error(env, -1, "failure reading lstring:  premature EOF");
+
+    if((c == '\"') || (c == '\''))
+    {
+        /* Found quoted string, read everything up to the matching
+         * unescaped quote */
+        elt->data.lstring.len = 0;
+        if(fscanf_lstring(env, &(elt->data.lstring), c) < 0)
+            parse_error(env, -1, "error parsing string element");
+        elt->valid = 1;
+
+        /* Consume the terminating quote */
+        if(get_char(env) != c)
+            parse_error(env, -1, "unmatched quote when reading string");
+
+        /* Skip trailing white space */
+        c = skip_whitespace(env);
+        if(c < 0)
+            parse_error(env, -1, "failure reading lstring:  premature EOF");
+        else if(!strchr(terminators, c))
+            parse_error(env, -1, "text following quote when reading string");
+        else
+            /* Unconsume the terminator */
+            unget_char(env, c);
+    }
+    else if(strchr(terminators, c))
+    {
+        /* Whitespace between two delimiters --> null value */
+        unget_char(env, c);
+        elt->valid = 0;
+        /* Clear any old data */
+        if(!elt->data.lstring.datasize)
+            string_resize(&elt->data.lstring, 1);
+        elt->data.lstring.len = 0;
+        elt->data.lstring.data[0] = '\0';
+    }
+    else
+    {
+        /* A string must be quoted. May as well unget what we read. */
+        unget_char(env, c);
+        parse_error(env, -1, "missing quote when reading string");
+    }
+}
+
+static
+void decode_ilwd_char_u(MetaioParseEnv const env,
+                        const struct DecodePlan *plan,
+                        struct MetaioRowElement* const elt, int n)
+{
+    const char * const terminators = plan->terminators;
+    unsigned char *cptr;
+    int c;
+
+    (void) n;
+    /*-- Mark this item as invalid, until we successfully parse it --*/
+    elt->valid = 0;
+
+    c = skip_whitespace(env);
+    if(c < 0)
+        parse_error(env, -1, "failure reading ilwd_char_u:  premature EOF");
+
+    if (c == '\"')
+    {
+        int quote = c;
+
+        if(fscanf_ilwd_char_u(env, &(elt->data.blob), terminators, plan->specials) < 0)
+            parse_error(env, -1, "error parsing ilwd:char_u element");
+        elt->valid = 1;
+
+        /*-- Ignore everything from the terminating quote onward --*/
+        for(cptr = elt->data.blob.data + elt->data.blob.len - 1; cptr >= elt->data.blob.data; cptr--)
+            if(*cptr == quote)
+                break;
+
+        if(cptr < elt->data.blob.data)
+            parse_error(env, -1, "unmatched quote when reading ilwd:char_u");
+        else
+        {
+            *cptr = '\0';
+            elt->data.blob.len = cptr - elt->data.blob.data;
+        }
+
+    }
+    else if ( strchr(terminators, c) )
+    {
+        /* Whitespace between two delimiters --> null value */
+        unget_char(env, c);
+        elt->valid = 0;
+        /* Clear any old data */
+        elt->data.blob.len = 0;
+    }
+    else
+    {
+        /* An ilwd:char_u *must* be quoted. May as well unget what we read. */
+        unget_char(env, c);
+        parse_error(env, -1, "missing quote when reading ilwd:char_u");
+    }
+}
+
+
+static
+void decode_blob(MetaioParseEnv const env, const struct DecodePlan *plan,
+                 struct MetaioRowElement* const elt, int n)
+{
+    const char * const terminators = plan->terminators;
+    int c;
+
+    (void) n;
+    /*-- Mark this item as invalid, until we successfully parse it --*/
+    elt->valid = 0;
+
+    c = skip_whitespace(env);
+    if(c < 0)
+        parse_error(env, -1, "failure reading blob:  premature EOF");
+
+    if((c == '\"') || (c == '\''))
+    {
+        /* Found quoted string, read everything up to the matching
+         * quote */
+        if(fscanf_blob(env, &(elt->data.blob), c) < 0)
+            parse_error(env, -1, "error parsing blob element");
+        elt->valid = 1;
+
+        /* Consume the terminating quote */
+        if(get_char(env) != c)
+            parse_error(env, -1, "unmatched quote when reading blob");
+
+        /* Skip trailing white space */
+        c = skip_whitespace(env);
+        if(c < 0)
+            parse_error(env, -1, "failure reading blob:  premature EOF");
+        else if(!strchr(terminators, c))
+            parse_error(env, -1, "text following quote when reading blob");
+        else
+            /* Unconsume the terminator */
+            unget_char(env, c);
+    }
+    else if(strchr(terminators, c))
+    {
+        /* Whitespace between two delimiters --> null value */
+        unget_char(env, c);
+        elt->valid = 0;
+        /* Clear any old data */
+        elt->data.blob.len = 0;
+    }
+    else
+    {
+        /* A blob must be quoted. May as well unget what we read. */
+        unget_char(env, c);
+        parse_error(env, -1, "missing quote when reading blob");
+    }
+}
+
+
+static
+void match_delimiter(MetaioParseEnv const env)
+{
+    int c = skip_whitespace(env);
+
+    if (c != env->ligo_lw.table.stream.delimiter)
+    {
+        unget_char(env, c);
+        parse_error(env, -1, (c < 0) ? "premature EOF, expected delimiter character '%c'" : "expected delimiter character '%c'", env->ligo_lw.table.stream.delimiter);
+    }
+}
+
+/*
+ * Pass over n consecutive row elements of columns that have not been
+ * selected, without decoding them.  Everything up to the n-th following
+ * delimiter (or the next tag) is skipped, except that a delimiter inside a
+ * quoted string does not count.  The final delimiter is left unconsumed.
+ */
+
+static
+void skip_elements(MetaioParseEnv const env, int n)
+{
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    const char delimiter = env->ligo_lw.table.stream.delimiter;
+    const char unquoted[] = {delimiter, '<', '\"', '\'', '\n'};
+    char quoted[] = {0, '<', '\n'};
+    size_t backslashes = 0;
+    int c;
+
+    do
+    {
+        const char *start = in->next;
+        const char *p;
+        size_t k = 0;
+
+        if(start == in->end && !fill_input(env))
+            parse_error(env, -1, "failure skipping row element:  premature EOF");
+        start = in->next;
+
+        if(quoted[0])
+        {
+            /* Rather than stopping at every escape, find the next quote
+             * and count the backslashes in front of it */
+            const char *q;
+
+            p = scan_find(start, in->end, quoted, sizeof(quoted));
+            for(q = p; q > start && q[-1] == '\\'; q--)
+                ;
+            k = p - q;
+            if(q == start)
+                /* The run may have started before the last refill */
+                k += backslashes;
+        }
+        else
+            p = scan_find(start, in->end, unquoted, sizeof(unquoted));
+        /* Newlines stop the scan, so there are none to count */
+        env->file->charno += p - start;
+        in->next += p - start;
+        backslashes = k;
+        if(p == in->end)
+            continue;
+        backslashes = 0;
+
+        c = get_char(env);
+        if(c == '\n')
+            continue;
+        else if(c == '<')
+        {
+            /* Unconsume the start of the tag */
+            unget_char(env, c);
+            return;
+        }
+        else if(quoted[0])
+        {
+            /* An odd number of backslashes escapes the quote */
+            if(!(k & 1))
+                quoted[0] = 0;
+        }
+        else if(c != delimiter)
+            /* Start of a quoted string */
+            quoted[0] = c;
+        else if(--n == 0)
+        {
+            /* Unconsume the terminator */
+            unget_char(env, c);
+            return;
+        }
+    }
+    while(1);
+}
+
+static
+void decode_skipped(MetaioParseEnv const env, const struct DecodePlan *plan,
+                    struct MetaioRowElement* const elt, int n)
+{
+    int i;
+
+    (void) plan;
+    for(i = 0; i < n; i++)
+        elt[i].valid = 0;
+    skip_elements(env, n);
+}
+
+static
+void decode_unknown(MetaioParseEnv const env, const struct DecodePlan *plan,
+                    struct MetaioRowElement* const elt, int n)
+{
+    (void) plan;
+    (void) n;
+    elt->valid = 0;
+    parse_error(env, -1, "row element has unknown type");
+}
+
+/*
+ * The decoder for a column of the given type
+ */
+
+static
+DecodeFunc *column_decoder(enum METAIO_Type type)
+{
+    switch (type)
+    {
+    case METAIO_TYPE_REAL_4:        return decode_real_4;
+    case METAIO_TYPE_REAL_8:        return decode_real_8;
+    case METAIO_TYPE_INT_4S:        return decode_int_4s;
+    case METAIO_TYPE_INT_4U:        return decode_int_4u;
+    case METAIO_TYPE_INT_2S:        return decode_int_2s;
+    case METAIO_TYPE_INT_2U:        return decode_int_2u;
+    case METAIO_TYPE_INT_8S:        return decode_int_8s;
+    case METAIO_TYPE_INT_8U:        return decode_int_8u;
+    case METAIO_TYPE_COMPLEX_8:     return decode_complex_8;
+    case METAIO_TYPE_COMPLEX_16:    return decode_complex_16;
+    case METAIO_TYPE_LSTRING:
+    case METAIO_TYPE_ILWD_CHAR:
+    case METAIO_TYPE_CHAR_S:
+    case METAIO_TYPE_CHAR_V:        return decode_lstring;
+    case METAIO_TYPE_BLOB:          return decode_blob;
+    case METAIO_TYPE_ILWD_CHAR_U:   return decode_ilwd_char_u;
+    default:                        return decode_unknown;
+    }
+}
+
+/*
+ * Compile the plan for decoding the rows of the current table, in the
+ * arena of env, from the types of its columns, which of them are
+ * selected, and the delimiter of its stream.
+ */
+
+static
+struct DecodePlan *compile_plan(MetaioParseEnv const env)
+{
+    const struct MetaioTable * const table = &env->ligo_lw.table;
+    const char delimiter = table->stream.delimiter;
+    struct DecodePlan *plan = env->plan;
+    const size_t size = sizeof(*plan) + table->numcols * sizeof(plan->step[0]);
+    int col;
+
+    if(!plan || arena_capacity(plan) < size)
+    {
+        if(!(plan = arena_alloc(env, size)))
+            parse_error(env, -1, "cannot allocate memory for decoding rows");
+        env->plan = plan;
+    }
+
+    plan->terminators[0] = delimiter;
+    plan->terminators[1] = '<';
+    plan->terminators[2] = '\0';
+    plan->specials[0] = delimiter;
+    plan->specials[1] = '\\';
+    plan->specials[2] = ' ';
+    plan->specials[3] = '\0';
+    plan->numeric[0] = delimiter;
+    plan->numeric[1] = ',';
+    plan->numeric[2] = '\n';
+    plan->numeric[3] = '\\';
+    plan->numeric[4] = '\"';
+    plan->numeric[5] = '<';
+    plan->numeric[6] = '\0';
+
+    plan->nsteps = 0;
+    for (col = 0; col < table->numcols; col++)
+    {
+        struct DecodeStep * const step = &plan->step[plan->nsteps++];
+
+        step->col = col;
+        step->n = 1;
+        if (table->col[col].skip)
+        {
+            /* Pass over all of the consecutive unselected columns at once */
+            step->decode = decode_skipped;
+            while (col + 1 < table->numcols && table->col[col + 1].skip)
+            {
+                step->n++;
+                col++;
+            }
+        }
+        else
+            step->decode = column_decoder(table->col[col].data_type);
+    }
+
+    return plan;
+}
+
+/*
+ * Mark the plan for decoding rows as out of date, after the columns of
+ * the table have changed.  The next row read compiles it again.
+ */
+
+static
+void forget_plan(MetaioParseEnv const env)
+{
+    struct DecodePlan * const plan = env->plan;
+
+    if(plan)
+        plan->nsteps = -1;
+}
+
+/*
+ * The following group of functions correspond to expanding the production
+ * rules of the parser.
+ */
+
+static
+int row(MetaioParseEnv const env)
+{
+    const struct DecodePlan *plan = env->plan;
+    struct MetaioRowElement * const elt = env->ligo_lw.table.elt;
+    int i;
+    /* Peek ahead to the next non-whitespace character */
+    int c = skip_whitespace(env);
+    if(c < 0)
+        parse_error(env, -1, "failure reading row:  premature EOF");
+
+    unget_char(env, c);
+
+    if (c == '<')
+        /* '<' --> start of new element = end of stream text */
+        return 0;
+
+    if (!plan || plan->nsteps < 0)
+        plan = compile_plan(env);
+
+    /* Process the whole row */
+    for (i = 0; i < plan->nsteps; i++)
+    {
+        const struct DecodeStep * const step = &plan->step[i];
+
+        if (i > 0)
+            match_delimiter(env);
+        step->decode(env, plan, &elt[step->col], step->n);
+    }
+
+    /* finished reading 1 row */
+    return 1;
+}
+
+static
+void stream_attr(MetaioParseEnv const env)
+{
+    int attr_mask = 0;
+
+    env->ligo_lw.table.stream.delimiter = ',';	/* default delimiter */
+
+    do {
+        switch(env->token)
+        {
+        case DELIMITER:
+            if(attr_mask & 1)
+                parse_error(env, -1, "duplicate Delimiter attribute for Stream");
+            delimiter(env, &(env->ligo_lw.table.stream.delimiter));
+            DEBUGMSG2("DELIMITER = \"%c\"\n", env->ligo_lw.table.stream.delimiter);
+            attr_mask |= 1;
+            continue;
+
+        case NAME:
+            if(attr_mask & 2)
+                parse_error(env, -1, "duplicate Name attribute for Stream");
+            name(env, &(env->ligo_lw.table.stream.name));
+            DEBUGMSG2("NAME = \"%s\"\n", env->ligo_lw.table.stream.name);
+            attr_mask |= 2;
+            continue;
+
+        case TYPE:
+            if(attr_mask & 4)
+                parse_error(env, -1, "duplicate Type attribute for Stream");
+            type(env, &(env->ligo_lw.table.stream.type));
+            DEBUGMSG2("TYPE = \"%s\"\n", env->ligo_lw.table.stream.type);
+            attr_mask |= 4;
+            continue;
+
+        default:
+            break;
+        }
+        break;
+    } while(1);
+
+    /*
+      This is a special case. We would normally do a match to
+      GREATER_THAN but that would also trigger an advance to the
+      next token. Since we expect to be reading data from the
+      stream object after this, the next data read shouldn't be tokenized.
+      Instead we match the GREATER_THAN after we return from reading
+      the stream
+
+      It is a little annoying that the stream_attr function needs to
+      be clairvoyant but in practise the initial parsing will only read
+      to here anyway. Reading the rows will be done on an individual basis
+      by the user.
+      
+      Ideally what we would do is unget all the text read by match(), but
+      unfortunately ungetting is only guaranteed for one character.
+    */
+
+    /*-- If the stream is empty, the end of the tag will be "/>" --*/
+    if (env->token == FORWARD_SLASH)
+        match(env, FORWARD_SLASH);
+
+    if (env->token != GREATER_THAN)
+        unexpected_token(env, env->token);
+
+    /*
+     * We are now at the end of the stream attributes for this table and
+     * are about to begin reading rows
+     */
+    env->file->nrows = 0;
+    compile_plan(env);
+}
+
+/*
+ * This function is used to when we encounter a table which is not the one
+ * specified in tablename. The function scans through the body of the
+ * table until it finds the end of the table's STREAM, then looks for the
+ * tokens to close the table. At the end we should be in the correct position
+ * in the file to look for the next table (and so on, until we get to the
+ * right table or run out of file). The body of the table is not parsed.
+ */
+
+static
+void table_consume(MetaioParseEnv const env)
+{
+#if 1	/* blast through with no validation (fast) */
+    while (env->token != CLOSE_STREAM)
+    {
+        skip_to_tag(env);
+        get_next_token(env);
+    }
+    get_next_token(env);
+    match(env, GREATER_THAN);
+  
+    /* Close the <TABLE> */
+    match(env, CLOSE_TABLE);
+    match(env, GREATER_THAN);
+#else	/* validate the table while consuming it (slow) */
+    /* consume remaining rows */
+    while (row(env) != 0)
+    {
+        int c = skip_whitespace(env);
+        if(c < 0)
+            parse_error(env, -1, "failure reading row:  premature EOF");
+        else if (c != env->ligo_lw.table.stream.delimiter)
+            unget_char(env, c);
+    }
+
+    /*-- Skip any tokens found until we get to the CLOSE_TABLE.  The
+      actual set of tokens encountered will vary depending on whether the
+      stream was empty (in which case there is no separate </STREAM> tag)
+      or non-empty. --*/
+    while ( env->token != CLOSE_TABLE || env->token == END_OF_FILE )
+        get_next_token(env);
+
+    /* Close the <TABLE> */
+    match(env, CLOSE_TABLE);
+    match(env, GREATER_THAN);
+#endif
+}
+
+static
+void stream(MetaioParseEnv const env)
+{
+    match(env, STREAM);
+    stream_attr(env);
+}
+
+static
+void table_attr(MetaioParseEnv const env)
+{
+    name(env, &(env->ligo_lw.table.name));
+    DEBUGMSG2("NAME = \"%s\"\n", env->ligo_lw.table.name); 
+
+    match(env, GREATER_THAN);
+}
+
+static
+void table_body(MetaioParseEnv const env)
+{
+    comment(env, &(env->ligo_lw.table.comment));
+    DEBUGMSG2("COMMENT = \"%s\"\n", env->ligo_lw.table.comment); 
+
+    env->ligo_lw.table.numcols = 0;
+    env->ligo_lw.table.hashsize = 0;
+    forget_plan(env);
+    while (env->token == COLUMN)
+        column(env);
+    if (index_columns(env) < 0)
+        parse_error(env, -1, "cannot allocate memory for column index");
+
+    stream(env);
+}
+
+static
+void table(MetaioParseEnv const env)
+{
+    match(env, TABLE);
+    table_attr(env);
+    table_body(env);
+    if (!match_tablename(env))
+        table_consume(env);
+}
+
+static
+void ligo_lw_attr(MetaioParseEnv const env)
+{
+    name(env, &(env->ligo_lw.name));
+    DEBUGMSG2("NAME = \"%s\"\n", env->ligo_lw.name); 
+
+    match(env, GREATER_THAN);
+}
+
+static
+void ligo_lw_body(MetaioParseEnv const env)
+{
+    comment(env, &(env->ligo_lw.comment));
+    DEBUGMSG2("COMMENT = \"%s\"\n", env->ligo_lw.comment); 
+
+    while (env->token == TABLE)
+        table(env);
+
+    if (env->token != GREATER_THAN)
+        parse_error(env, -1, "table not found: \"%s\"", env->file->tablename);
+}
+
+static
+void ligo_lw(MetaioParseEnv const env)
+{
+    match(env, LIGO_LW);
+    ligo_lw_attr(env);
+    ligo_lw_body(env);
+}
+
+/*
+ * This function consumes all of the uninteresting boilerplate at the
+ * beginning of a LIGO_LW XML file, up to the <LIGO_LW token.
+ */
+
+static
+void leading_junk(MetaioParseEnv const env)
+{
+    do
+        get_next_token(env);
+    while(env->token != LIGO_LW && env->token != END_OF_FILE);
+}
+
+/*
+ * Various useful functions
+ */
+
+/*
+ * Output.  The text written to a file is gathered in a buffer (outbuf of
+ * the file record) and passed to fwrite(), or to the compressor if gzip
+ * is set, when the buffer is full and when the file is closed, instead of
+ * making a stdio call for every field.  MetaioFprintElement() does the
+ * same with a smaller buffer of its own.  data holds the next - data
+ * characters still to be written, and end is the end of the memory.
+ */
+
+#define OUTPUT_BLOCK_SIZE (256 * 1024)
+
+/*
+ * Allocate the buffer of a file opened for writing.  Returns 0 on success
+ * or -1 if memory runs out.
+ */
+
+static
+int alloc_output(struct MetaioBuffer *out)
+{
+    if(!(out->data = malloc(OUTPUT_BLOCK_SIZE)))
+        return -1;
+    out->next = out->data;
+    out->end = out->data + OUTPUT_BLOCK_SIZE;
+    out->datasize = OUTPUT_BLOCK_SIZE;
+    return 0;
+}
+
+#ifdef HAVE_LIBZ
+
+/*
+ * Compressed output.  Each block of output is deflated on its own into a
+ * gzip member, and the file is those members one after another, which
+ * gunzip and zlib read as a single stream.  As no block refers to another,
+ * the blocks are compressed by a pool of threads while the rows of the
+ * next are formatted, and the start of each is a point from which the file
+ * can be decompressed; the index saved with the file lists them.  The
+ * blocks wait in a ring of jobs, GZIP_JOBS_PER_THREAD for each thread, and
+ * the writing thread writes them to the file in order when it needs a job
+ * again or the file is closed.
+ */
+
+#define GZIP_JOBS_PER_THREAD 2
+#define GZIP_MAX_THREADS 16
+
+struct GzipJob {
+    char *data;             /* The block of output */
+    size_t len;
+    unsigned char *zdata;   /* The gzip member made of it */
+    size_t zlen;
+    size_t zsize;           /* The length of the memory at zdata */
+    int done;               /* 1 when compressed, -1 if that failed */
+};
+
+struct GzipWriter {
+    FILE *fp;
+    int level;
+    int njobs;
+    struct GzipJob *job;
+    unsigned submitted;     /* Blocks handed over to be compressed */
+    unsigned taken;         /* Blocks taken by a thread */
+    unsigned written;       /* Blocks written to the file */
+    long long in;           /* The length of the file so far */
+    long long out;          /* and of the output in it */
+    struct GzipIndex *index;    /* The members so far, if an index is */
+    char *indexname;            /* to be saved under this name */
+    z_stream strm;          /* Used when there are no threads */
+    int active;             /* strm has been initialized */
+    int nthreads;
+#ifdef _POSIX_THREADS
+    int stop;               /* Threads should exit */
+    pthread_t *thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
+static
+int init_deflate(z_stream * const strm, int level)
+{
+    memset(strm, 0, sizeof(*strm));
+    return deflateInit2(strm, level, Z_DEFLATED, 15 + 16, 8,
+                        Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+/*
+ * Deflate the block of a job into a gzip member.  Returns 1 on success or
+ * -1 on error.
+ */
+
+static
+int compress_job(z_stream * const strm, struct GzipJob * const job)
+{
+    const size_t bound = deflateBound(strm, job->len);
+
+    if(job->zsize < bound)
+    {
+        unsigned char * const zdata = realloc(job->zdata, bound);
+
+        if(!zdata)
+            return -1;
+        job->zdata = zdata;
+        job->zsize = bound;
+    }
+
+    if(deflateReset(strm) != Z_OK)
+        return -1;
+    strm->next_in = (unsigned char *) job->data;
+    strm->avail_in = job->len;
+    strm->next_out = job->zdata;
+    strm->avail_out = job->zsize;
+    if(deflate(strm, Z_FINISH) != Z_STREAM_END)
+        return -1;
+    job->zlen = job->zsize - strm->avail_out;
+
+    return 1;
+}
+
+#ifdef _POSIX_THREADS
+
+static
+void *compress_thread(void *arg)
+{
+    struct GzipWriter * const w = arg;
+    z_stream strm;
+    const int ok = init_deflate(&strm, w->level);
+
+    pthread_mutex_lock(&w->lock);
+    for(;;)
+    {
+        struct GzipJob *job;
+        int done;
+
+        while(w->taken == w->submitted && !w->stop)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if(w->taken == w->submitted)
+            break;
+        job = &w->job[w->taken++ % w->njobs];
+
+        pthread_mutex_unlock(&w->lock);
+        done = ok ? compress_job(&strm, job) : -1;
+        pthread_mutex_lock(&w->lock);
+
+        job->done = done;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    if(ok)
+        deflateEnd(&strm);
+    return NULL;
+}
+
+#endif /* _POSIX_THREADS */
+
+static
+void free_writer(struct GzipWriter * const w)
+{
+    int i;
+
+#ifdef _POSIX_THREADS
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    for(i = 0; i < w->nthreads; i++)
+        pthread_join(w->thread[i], NULL);
+    free(w->thread);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+#endif
+
+    for(i = 0; w->job && i < w->njobs; i++)
+    {
+        free(w->job[i].data);
+        free(w->job[i].zdata);
+    }
+    free(w->job);
+    if(w->active)
+        deflateEnd(&w->strm);
+    free_gzip_index(w->index);
+    free(w->indexname);
+    free(w);
+}
+
+/*
+ * Start compressing the output to fp, saving an index as filename with
+ * GZIP_INDEX_SUFFIX appended if options->index is set.  Returns the
+ * writer, or NULL if it could not be started.
+ */
+
+static
+struct GzipWriter *start_writer(FILE *fp, const char * const filename,
+                                const struct MetaioCompression * const options)
+{
+    struct GzipWriter * const w = calloc(1, sizeof(*w));
+    int nthreads = options->nthreads;
+
+    if(!w)
+        return NULL;
+    w->fp = fp;
+    w->level = options->level >= 1 && options->level <= 9 ?
+        options->level : Z_DEFAULT_COMPRESSION;
+
+#ifdef _POSIX_THREADS
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+#ifdef _SC_NPROCESSORS_ONLN
+    if(nthreads <= 0 && (nthreads = sysconf(_SC_NPROCESSORS_ONLN)) > GZIP_MAX_THREADS)
+        nthreads = GZIP_MAX_THREADS;
+#endif
+    if(nthreads < 1)
+        nthreads = 1;
+    if(!(w->thread = calloc(nthreads, sizeof(*w->thread))))
+        goto fail;
+#else
+    nthreads = 1;
+#endif
+
+    w->njobs = GZIP_JOBS_PER_THREAD * nthreads;
+    if(!(w->job = calloc(w->njobs, sizeof(*w->job))))
+        goto fail;
+
+    if(options->index)
+    {
+        if(!(w->index = calloc(1, sizeof(*w->index))) ||
+           !(w->indexname = malloc(strlen(filename) + sizeof(GZIP_INDEX_SUFFIX))))
+            goto fail;
+        strcat(strcpy(w->indexname, filename), GZIP_INDEX_SUFFIX);
+    }
+
+#ifdef _POSIX_THREADS
+    while(w->nthreads < nthreads &&
+          pthread_create(&w->thread[w->nthreads], NULL, compress_thread, w) == 0)
+        w->nthreads++;
+#endif
+
+    /* Without threads, each block is compressed as it is handed over */
+    if(!w->nthreads)
+    {
+        if(!init_deflate(&w->strm, w->level))
+            goto fail;
+        w->active = 1;
+    }
+
+    return w;
+
+fail:
+    free_writer(w);
+    return NULL;
+}
+
+/*
+ * Wait for the oldest block not yet written to be compressed, and write
+ * it to the file.  Returns 0 on success or -1 on error.
+ */
+
+static
+int write_job(struct GzipWriter * const w)
+{
+    struct GzipJob * const job = &w->job[w->written % w->njobs];
+    struct GzipPoint *point;
+    int done;
+
+#ifdef _POSIX_THREADS
+    if(w->nthreads)
+    {
+        pthread_mutex_lock(&w->lock);
+        while(!(done = job->done))
+            pthread_cond_wait(&w->cond, &w->lock);
+        pthread_mutex_unlock(&w->lock);
+    }
+    else
+#endif
+        done = job->done;
+    w->written++;
+    if(done < 0)
+        return -1;
+
+    if(w->index)
+    {
+        struct GzipIndex * const index = w->index;
+
+        /* Grow the array of points whenever its length reaches a power of two */
+        if(!(index->npoints & (index->npoints - 1)))
+        {
+            point = realloc(index->point, (index->npoints ? 2 * index->npoints : 1) * sizeof(*point));
+            if(!point)
+                return -1;
+            index->point = point;
+        }
+
+        /* The member can be decompressed without anything before it */
+        point = &index->point[index->npoints++];
+        point->out = w->out;
+        point->in = w->in;
+        point->bits = -1;
+        point->window = NULL;
+    }
+
+    if(fwrite(job->zdata, 1, job->zlen, w->fp) != job->zlen)
+        return -1;
+    w->in += job->zlen;
+    w->out += job->len;
+
+    return 0;
+}
+
+/*
+ * Hand the block in the buffer over to be compressed, and give the buffer
+ * the memory of a block that has been written.  Returns 0 on success or
+ * -1 on error.
+ */
+
+static
+int compress_output(struct GzipWriter * const w, struct MetaioBuffer * const out)
+{
+    struct GzipJob * const job = &w->job[w->submitted % w->njobs];
+    char *data;
+
+    /* The job is free again once its last block has been written */
+    if(w->submitted - w->written == (unsigned) w->njobs && write_job(w) < 0)
+        return -1;
+    if(!(data = job->data) && !(data = malloc(OUTPUT_BLOCK_SIZE)))
+        return -1;
+
+    job->data = out->data;
+    job->len = out->next - out->data;
+    job->done = 0;
+    out->data = out->next = data;
+    out->end = data + OUTPUT_BLOCK_SIZE;
+
+#ifdef _POSIX_THREADS
+    if(w->nthreads)
+    {
+        pthread_mutex_lock(&w->lock);
+        w->submitted++;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        return 0;
+    }
+#endif
+    w->submitted++;
+    job->done = compress_job(&w->strm, job);
+
+    return 0;
+}
+
+/*
+ * Compress and write the rest of the output, save the index if there is to
+ * be one, and free the writer.  Returns 0 on success or -1 on error.
+ */
+
+static
+int finish_writer(struct GzipWriter * const w, struct MetaioBuffer * const out)
+{
+    int ret = 0;
+
+    if(out->next > out->data && compress_output(w, out) < 0)
+        ret = -1;
+    while(w->written != w->submitted)
+        if(write_job(w) < 0)
+            ret = -1;
+
+    if(!ret && w->index && w->written)
+    {
+        const struct GzipJob * const last = &w->job[(w->written - 1) % w->njobs];
+
+        /* The index is recognized by the length and the last bytes of the
+         * file, which are those of the last member */
+        w->index->size = w->in;
+        memcpy(w->index->trailer, last->zdata + last->zlen - 8, 8);
+        if(write_gzip_index(w->index, NULL, w->indexname))
+            ret = -1;
+    }
+    free_writer(w);
+
+    return ret;
+}
+
+#endif /* HAVE_LIBZ */
+
+/*
+ * Write out what is in the buffer.  Returns 0 on success or -1 on error,
+ * in which case the contents of the buffer are lost.
+ */
+
+static
+int flush_output(FILE *fp, struct MetaioBuffer *out)
+{
+    const size_t n = out->next - out->data;
+
+#ifdef HAVE_LIBZ
+    if(out->gzip)
+        return n ? compress_output(out->gzip, out) : 0;
+#endif
+    out->next = out->data;
+    if(n && fwrite(out->data, 1, n, fp) != n)
+        return -1;
+    return 0;
+}
+
+/*
+ * Make room for n characters in the buffer, which must be at least that
+ * large.  Returns where to put them, or NULL on error.
+ */
+
+static inline
+char *reserve_output(FILE *fp, struct MetaioBuffer *out, size_t n)
+{
+    if((size_t) (out->end - out->next) < n && flush_output(fp, out) < 0)
+        return NULL;
+    return out->next;
+}
+
+/*
+ * Append n characters to the buffer, writing it out as often as needed.
+ * Returns 0 on success or -1 on error.
+ */
+
+static
+int put_chars(FILE *fp, struct MetaioBuffer *out, const char *s, size_t n)
+{
+    while((size_t) (out->end - out->next) < n)
+    {
+        const size_t room = out->end - out->next;
+
+        memcpy(out->next, s, room);
+        out->next += room;
+        s += room;
+        n -= room;
+        if(flush_output(fp, out) < 0)
+            return -1;
+    }
+
+    memcpy(out->next, s, n);
+    out->next += n;
+    return 0;
+}
+
+/*
+ * Append each of a list of strings ended by a null pointer.  Returns 0 on
+ * success or -1 on error.
+ */
+
+static
+int put_strings(FILE *fp, struct MetaioBuffer *out, ...)
+{
+    const char *s;
+    va_list args;
+    int ret = 0;
+
+    va_start(args, out);
+    while(!ret && (s = va_arg(args, const char *)))
+        ret = put_chars(fp, out, s, strlen(s));
+    va_end(args);
+
+    return ret;
+}
+
+/*
+ * Append the decimal digits of an integer, preceded by a minus sign if
+ * negative is true, two digits at a time.  Returns 0 on success or -1 on
+ * error.
+ */
+
+static
+int put_decimal(FILE *fp, struct MetaioBuffer *out,
+                unsigned long long v, int negative)
+{
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324"
+        "25262728293031323334353637383940414243444546474849"
+        "50515253545556575859606162636465666768697071727374"
+        "75767778798081828384858687888990919293949596979899";
+    char digits[24];
+    char *p = digits + sizeof(digits);
+
+    while(v >= 100)
+    {
+        p -= 2;
+        memcpy(p, &pairs[2 * (v % 100)], 2);
+        v /= 100;
+    }
+    if(v >= 10)
+    {
+        p -= 2;
+        memcpy(p, &pairs[2 * v], 2);
+    }
+    else
+        *--p = '0' + v;
+    if(negative)
+        *--p = '-';
+
+    return put_chars(fp, out, p, digits + sizeof(digits) - p);
+}
+
+static
+int put_signed(FILE *fp, struct MetaioBuffer *out, long long v)
+{
+    /* Negate as unsigned, which is exact for the most negative value */
+    return v < 0 ? put_decimal(fp, out, 0ULL - (unsigned long long) v, 1)
+                 : put_decimal(fp, out, v, 0);
+}
+
+/*
+ * Append a real number with the fewest digits that read back to the same
+ * value, as a float if single is true (which is exact).  Returns 0 on
+ * success or -1 on error.
+ */
+
+static
+int put_real(FILE *fp, struct MetaioBuffer *out, double val, int single)
+{
+    char * const p = reserve_output(fp, out, NUMERIC_FORMAT_MAX);
+
+    if(!p)
+        return -1;
+
+    out->next += single ? numeric_format_float((float) val, p)
+                        : numeric_format_double(val, p);
+    return 0;
+}
+
+static
+int put_complex(FILE *fp, struct MetaioBuffer *out, double re, double im,
+                int single)
+{
+    if(put_real(fp, out, re, single) < 0 || put_chars(fp, out, "+i", 2) < 0)
+        return -1;
+    return put_real(fp, out, im, single);
+}
+
+static
+int putbinary(FILE *fp, struct MetaioBuffer *out,
+              const METAIO_CHAR_U *buf, size_t len)
+{
+    if(put_chars(fp, out, "\"", 1) < 0)
+        return -1;
+    while(len)
+    {
+        /* Escape as many bytes as fit in the buffer */
+        char * const p = reserve_output(fp, out, 4);
+        size_t n = (out->end - out->next) / 4;
+        size_t i;
+
+        if(!p)
+            return -1;
+        if(n > len)
+            n = len;
+        for(i = 0; i < n; i++)
+            memcpy(&p[4 * i], octal_escape[buf[i]], 4);
+        out->next += 4 * n;
+        buf += n;
+        len -= n;
+    }
+    return put_chars(fp, out, "\"", 1);
+}
+
+static
+int putblob(FILE *fp, struct MetaioBuffer *out,
+            const METAIO_CHAR_U *buf, size_t len)
+{
+    if(put_chars(fp, out, "\"", 1) < 0)
+        return -1;
+    while(len)
+    {
+        /* Encode as many whole groups of 3 octets as fit in the buffer */
+        char * const p = reserve_output(fp, out, 4);
+        size_t n = (out->end - out->next) / 4 * 3;
+
+        if(!p)
+            return -1;
+        if(n > len)
+            n = len;
+        base64_encode((const char *) buf, n, p, BASE64_LENGTH(n));
+        out->next += BASE64_LENGTH(n);
+        buf += n;
+        len -= n;
+    }
+    return put_chars(fp, out, "\"", 1);
+}
+
+/*
+ * Append a string, replacing the characters special to XML by character
+ * entities and preceding those in escaped by a backslash.  Runs of
+ * characters that need neither are copied in one go.  Returns 0 on
+ * success, or -1 on error or if the string holds a character that cannot
+ * be written.
+ */
+
+static
+int putstring(FILE *fp, struct MetaioBuffer *out, const char *string,
+              const char *escaped)
+{
+    char stops[8] = "<>&";
+
+    strncat(stops, escaped, sizeof(stops) - sizeof("<>&"));
+
+    while(*string)
+    {
+        /* Find the end of the run of printable ASCII characters */
+        const size_t n = strcspn(string, stops);
+        size_t i;
+
+        for(i = 0; i < n; i++)
+            if((unsigned char) (string[i] - ' ') > '~' - ' ')
+                break;
+        if(put_chars(fp, out, string, i) < 0)
+            return -1;
+        string += i;
+
+        switch(*string)
+        {
+        case '\0':
+            return 0;
+        case '>':
+            if(put_chars(fp, out, "&gt;", 4) < 0)
+                return -1;
+            break;
+        case '<':
+            if(put_chars(fp, out, "&lt;", 4) < 0)
+                return -1;
+            break;
+        case '&':
+            if(put_chars(fp, out, "&amp;", 5) < 0)
+                return -1;
+            break;
+        default:
+            if(!isprint(*string) || *string < 0)
+                /* Unprintable character or non-UTF-8-safe --> error */
+                return -1;
+            if(strchr(escaped, *string))
+                /* Character that must be escaped --> precede with '\\' */
+                if(put_chars(fp, out, "\\", 1) < 0)
+                    return -1;
+            /* Print character */
+            if(put_chars(fp, out, string, 1) < 0)
+                return -1;
+            break;
+        }
+        string++;
+    }
+
+    return 0;
+}
+
+/*
+ * Append the value of a row element to the buffer.  Returns 0 on success
+ * or -1 on error.
+ */
+
+static
+int put_element(FILE *fp, struct MetaioBuffer *out,
+                const struct MetaioRowElement *elt)
+{
+    /* null value --> print nothing */
+    if(!elt->valid)
+        return 0;
+
+    switch(elt->col->data_type)
+    {
+    case METAIO_TYPE_INT_4S:
+        return put_signed(fp, out, elt->data.int_4s);
+    case METAIO_TYPE_INT_4U:
+        return put_decimal(fp, out, elt->data.int_4u, 0);
+    case METAIO_TYPE_INT_2S:
+        return put_signed(fp, out, elt->data.int_2s);
+    case METAIO_TYPE_INT_2U:
+        return put_decimal(fp, out, elt->data.int_2u, 0);
+    case METAIO_TYPE_INT_8S:
+        return put_signed(fp, out, elt->data.int_8s);
+    case METAIO_TYPE_INT_8U:
+        return put_decimal(fp, out, elt->data.int_8u, 0);
+    case METAIO_TYPE_REAL_4:
+        return put_real(fp, out, elt->data.real_4, 1);
+    case METAIO_TYPE_REAL_8:
+        return put_real(fp, out, elt->data.real_8, 0);
+    case METAIO_TYPE_COMPLEX_8:
+        return put_complex(fp, out, crealf(elt->data.complex_8), cimagf(elt->data.complex_8), 1);
+    case METAIO_TYPE_COMPLEX_16:
+        return put_complex(fp, out, creal(elt->data.complex_16), cimag(elt->data.complex_16), 0);
+    case METAIO_TYPE_LSTRING:
+    case METAIO_TYPE_ILWD_CHAR:
+    case METAIO_TYPE_CHAR_S:
+    case METAIO_TYPE_CHAR_V:
+        if(put_chars(fp, out, "\"", 1) < 0)
+            return -1;
+        if(putstring(fp, out, elt->data.lstring.data, "\\\"") < 0)
+            return -1;
+        return put_chars(fp, out, "\"", 1);
+    case METAIO_TYPE_BLOB:
+        return putblob(fp, out, elt->data.blob.data, elt->data.blob.len);
+    case METAIO_TYPE_ILWD_CHAR_U:
+        return putbinary(fp, out, elt->data.blob.data, elt->data.blob.len);
+    default:
+        return -1;
+    }
+}
+
+int MetaioFprintElement(FILE *fp, const struct MetaioRowElement *elt)
+{
+    char block[4096];
+    struct MetaioBuffer out;
+    int ret;
+
+    out.data = out.next = block;
+    out.end = block + sizeof(block);
+    out.datasize = sizeof(block);
+    out.gzip = 0;
+
+    ret = put_element(fp, &out, elt);
+    if(flush_output(fp, &out) < 0)
+        return -1;
+
+    return ret;
+}
+
+/*
+ * Put the start of the table, up to the start tag of its stream, in the
+ * output buffer.  Returns 0 on success or -1 on error.
+ */
+
+static
+int putheader( const MetaioParseEnv env )
+{
+    FILE *fp = env->file->fp;
+    struct MetaioBuffer * const out = &env->file->outbuf;
+    struct MetaioTable *table = &(env->ligo_lw.table);
+    int icol;
+
+    env->file->table_open = 1;
+    env->file->nrows = 0;
+
+    if(put_strings(fp, out, "\n\t<Table Name=\"", table->name, "\">", NULL) < 0)
+        return -1;
+
+    /* Comment (if any) */
+    if(table->comment &&
+       (put_strings(fp, out, "\n\t\t<Comment>", NULL) < 0 ||
+        putstring(fp, out, table->comment, "\\") < 0 ||
+        put_strings(fp, out, "</Comment>", NULL) < 0))
+        return -1;
+
+    /* Column elements */
+    for(icol = 0; icol < table->numcols; icol++)
+        if(put_strings(fp, out, "\n\t\t<Column Name=\"", table->col[icol].name,
+                       "\" Type=\"", TypeText[table->col[icol].data_type].name[0],
+                       "\"/>", NULL) < 0)
+            return -1;
+
+    /* Stream element start tag */
+    return put_strings(fp, out, "\n\t\t<Stream Name=\"", table->name,
+                       "\" Type=\"Local\" Delimiter=\",\">", NULL);
+}
+
+/*
+ * Put the end of the table being written in the output buffer.  Returns 0
+ * on success or -1 on error.
+ */
+
+static
+int puttrailer( const MetaioParseEnv env )
+{
+    env->file->table_open = 0;
+    env->file->tables++;
+    env->file->nrows = 0;
+
+    return put_strings(env->file->fp, &env->file->outbuf,
+                       "\n\t\t</Stream>\n\t</Table>", NULL);
+}
+
+/*
+ * Table directories.
+ *
+ * MetaioReadDirectory() records where the rows of each table start.  The
+ * directories are kept in a list for the life of the program, identified
+ * by the device, inode, size and modification time of the file, so that
+ * any table of a file that has been listed can be opened without parsing
+ * the tables before it.  Entries are never removed, so a directory can be
+ * used without holding the lock once it has been found.
+ */
+
+/* The position of a row within a table, as left by end_row() */
+struct RowMark {
+    long long offset;
+    size_t lineno;
+    size_t charno;
+};
+
+/* A directory entry's rowindex:  the positions of every ROW_INDEX_INTERVAL'th row */
+#define ROW_INDEX_INTERVAL 1024
+
+struct RowIndex {
+    long long nmarks;
+    struct RowMark *mark;
+};
+
+struct DirectoryCache {
+    struct DirectoryCache *next;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    struct MetaioDirectory dir;
+    struct GzipIndex *gzindex;  /* Access points, if the file is compressed */
+};
+
+static struct DirectoryCache *directories = NULL;
+#ifdef _POSIX_THREADS
+static pthread_mutex_t directories_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static
+const struct DirectoryCache *find_directory(const struct stat * const st)
+{
+    const struct DirectoryCache *d;
+
+#ifdef _POSIX_THREADS
+    pthread_mutex_lock(&directories_lock);
+#endif
+    for(d = directories; d; d = d->next)
+        if(d->dev == st->st_dev && d->ino == st->st_ino &&
+           d->size == st->st_size && d->mtime == st->st_mtime)
+            break;
+#ifdef _POSIX_THREADS
+    pthread_mutex_unlock(&directories_lock);
+#endif
+
+    return d;
+}
+
+static
+void add_directory(struct DirectoryCache * const d)
+{
+#ifdef _POSIX_THREADS
+    pthread_mutex_lock(&directories_lock);
+#endif
+    d->next = directories;
+    directories = d;
+#ifdef _POSIX_THREADS
+    pthread_mutex_unlock(&directories_lock);
+#endif
+}
+
+#ifdef HAVE_LIBZ
+
+/*
+ * Load the directory of a compressed file that has not been listed from
+ * the index saved beside it, if it was saved there, and add it to the
+ * list.  Returns the directory, or NULL.
+ */
+
+static
+const struct DirectoryCache *load_directory_cache(const char * const filename,
+                                                  const struct stat * const st)
+{
+    struct DirectoryCache * const d = calloc(1, sizeof(*d));
+    int listed = 0;
+
+    if(!d)
+        return NULL;
+    if(!(d->gzindex = read_gzip_index(filename, &d->dir, &listed)) || !listed)
+    {
+        free_gzip_index(d->gzindex);
+        free(d);
+        return NULL;
+    }
+    d->dev = st->st_dev;
+    d->ino = st->st_ino;
+    d->size = st->st_size;
+    d->mtime = st->st_mtime;
+    add_directory(d);
+
+    return d;
+}
+
+#endif /* HAVE_LIBZ */
+
+/*
+ * Copy a string that may be a null pointer
+ */
+
+static
+char *dup_string(MetaioParseEnv const env, const char * const s)
+{
+    char *copy;
+
+    if(!s)
+        return NULL;
+    if(!(copy = strdup(s)))
+        parse_error(env, -1, "cannot allocate memory for table directory");
+    return copy;
+}
+
+/*
+ * If the file has been listed by MetaioReadDirectory(), or is compressed
+ * and its directory was saved with its index, and nothing has been read
+ * from it yet, go straight to the first row of the wanted table, as
+ * though the tables before it had been parsed.  Returns 1 if it did, or 0
+ * if the file must be parsed from the start as usual.
+ */
+
+static
+int seek_table(MetaioParseEnv const env)
+{
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    struct MetaioTable * const table = &env->ligo_lw.table;
+    const struct DirectoryCache *d;
+    const struct MetaioDirectory *dir;
+    const struct MetaioTableEntry *entry;
+    struct stat st;
+    int i;
+
+    if(stat(env->file->name, &st) < 0)
+        return 0;
+#ifdef HAVE_LIBZ
+    /* The directory saved with the index of a compressed file will do */
+    if(!(d = find_directory(&st)) && !in->mapped)
+        d = load_directory_cache(env->file->name, &st);
+#else
+    d = find_directory(&st);
+#endif
+    if(!d)
+        return 0;
+    dir = &d->dir;
+
+    /* Nothing may have been read yet, and compressed input needs an index */
+    if(in->mapped ? in->next != in->data || (size_t) st.st_size != in->datasize
+                  : in->data != 0 || !d->gzindex)
+        return 0;
+
+    /* The first matching table, as ligo_lw_body() would find */
+    for(i = 0; i < dir->ntables; i++)
+        if(tablename_matches(dir->table[i].name, env->file->tablename))
+            break;
+    if(i == dir->ntables)
+        return 0;
+    entry = &dir->table[i];
+
+#ifdef HAVE_LIBZ
+    if(!in->mapped && !in->gzip &&
+       !(in->gzip = open_cursor(env->file->name, d->gzindex)))
+        return 0;
+#endif
+
+    if(assign_cstr(env, &env->ligo_lw.name, dir->name) < 0 ||
+       assign_cstr(env, &env->ligo_lw.comment, dir->comment) < 0 ||
+       assign_cstr(env, &table->name, entry->name) < 0 ||
+       assign_cstr(env, &table->comment, entry->comment) < 0 ||
+       assign_cstr(env, &table->stream.name, entry->stream.name) < 0 ||
+       assign_cstr(env, &table->stream.type, entry->stream.type) < 0)
+        parse_error(env, -1, "cannot allocate memory for table header");
+
+    if(grow_columns(table, entry->numcols) < 0)
+        parse_error(env, -1, "out of memory for %d columns", entry->numcols);
+    for(i = 0; i < entry->numcols; i++)
     {
-        /* Found quoted string, read everything up to the matching
-         * quote */
-        if(fscanf_blob(env, &(elt->data.blob), c) < 0)
-            parse_error(env, -1, "error parsing blob element");
-        elt->valid = 1;
+        if(assign_cstr(env, &table->col[i].name, entry->col[i].name) < 0)
+            parse_error(env, -1, "cannot allocate memory for table header");
+        set_column_type(table, i, entry->col[i].data_type);
+    }
+    table->numcols = entry->numcols;
+    table->stream.delimiter = entry->stream.delimiter;
+    if(index_columns(env) < 0)
+        parse_error(env, -1, "cannot allocate memory for column index");
+
+    /* Carry on as at the end of stream_attr() */
+    compile_plan(env);
+    env->file->entry = entry;
+    seek_input(env, entry->offset);
+    env->file->lineno = entry->lineno;
+    env->file->charno = entry->charno;
+    env->file->nrows = 0;
+    env->token = GREATER_THAN;
+
+    return 1;
+}
+
+int MetaioOpenFile(MetaioParseEnv const env, const char* const filename)
+{
+    int result;
+
+    result = setjmp(env->jmp_env);
+    if(result)
+        /* We longjmp'ed to here --> parse error */
+        return result;
+    return init_parse_env(env, filename, "r");
+}
+
+int MetaioOpen(MetaioParseEnv const env, const char * const filename)
+{
+    /*
+     * This function is now replaced by MetaioOpenTable(), which
+     * is identical to MetaioOpen when the tablename is a null pointer
+     */
+    return MetaioOpenTable(env, filename, 0);
+}
+
+int MetaioReopen(MetaioParseEnv const env, const char * const filename)
+{
+    int result;
+
+    result = setjmp(env->jmp_env);
+    if(result)
+        /* We longjmp'ed to here --> parse error */
+        return result;
+
+    /* Abandon any file still open, keeping the memory */
+    if(env->file->fp || env->file->inbuf.mapped)
+        release_parse_env(env, 1);
+
+    /* Reuse the memory of the last error message */
+    MetaioClearErrno(env);
+    env->mierrmsg.len = 0;
+    if(env->mierrmsg.data)
+        env->mierrmsg.data[0] = '\0';
+
+    result = start_parse_env(env, filename, "r");
+    if(result)
+        return result;
+    if(!seek_table(env))
+    {
+        leading_junk(env);
+        ligo_lw(env);
+    }
+
+    return 0;
+}
+
+int MetaioOpenTableOnly(MetaioParseEnv const env, const char * const tablename)
+{
+    int result;
+
+    result = setjmp(env->jmp_env);
+    if(result)
+        /* We longjmp'ed to here --> parse error */
+        return result;
+
+    /* If file is not open, return an error */
+    if(env->fileRec.fp == 0 && !env->fileRec.inbuf.mapped)
+        return 1;
+    if(tablename)
+        assign_cstr(env, &env->file->tablename, tablename);
+    if(!seek_table(env))
+    {
+        leading_junk(env);
+        ligo_lw(env);
+    }
+
+    return 0;
+}
+
+int MetaioOpenTable(MetaioParseEnv const env, const char * const filename,
+                    const char * const tablename)
+{
+    int result;
+
+    result = setjmp(env->jmp_env);
+    if(result)
+        /* We longjmp'ed to here --> parse error */
+        return result;
+
+    result = init_parse_env(env, filename, "r");
+    if(result)
+        return result;
+    if(tablename)
+        assign_cstr(env, &env->file->tablename, tablename);
+    if(!seek_table(env))
+    {
+        leading_junk(env);
+        ligo_lw(env);
+    }
+
+    return 0;
+}
+
+int MetaioNextTable(MetaioParseEnv const env, const char * const tablename)
+{
+    int result;
+
+    result = setjmp(env->jmp_env);
+    if(result)
+        /* We longjmp'ed to here --> parse error */
+        return result;
+
+    /* If file is not open, return an error */
+    if(env->fileRec.fp == 0 && !env->fileRec.inbuf.mapped)
+        return -1;
+
+    /* Pass over the rest of the current table, if the last call found one */
+    if(env->token == GREATER_THAN)
+    {
+        free_row(env, 0);
+        while (env->token != CLOSE_TABLE && env->token != END_OF_FILE)
+        {
+            skip_to_tag(env);
+            get_next_token(env);
+        }
+        match(env, CLOSE_TABLE);
+        match(env, GREATER_THAN);
+    }
+
+    if(tablename)
+        assign_cstr(env, &env->file->tablename, tablename);
+    else if(env->file->tablename)
+        /* The empty name matches any table */
+        env->file->tablename[0] = '\0';
+    env->file->entry = 0;
+
+    /* Go on as in ligo_lw_body() */
+    while (env->token == TABLE)
+        table(env);
+
+    return env->token == GREATER_THAN ? 0 : 1;
+}
+
+/*
+ * Consume the delimiter (if any) following a row and count the row
+ */
+
+static
+void end_row(MetaioParseEnv const env)
+{
+    int c;
+
+    c = skip_whitespace(env);
+    if(c < 0)
+        parse_error(env, -1, "failure reading row:  premature EOF");
+    else if (c != env->ligo_lw.table.stream.delimiter)
+        unget_char(env, c);
+    /* Increment the count of the number of rows */
+    env->file->nrows++;
+}
+
+/*
+ * Parse the next row and the delimiter following it.  Returns 1 if a row
+ * was obtained or 0 at the end of the table.
+ */
+
+static
+int next_row(MetaioParseEnv const env)
+{
+    if(row(env) == 0)
+        /* end of table */
+	return 0;
+
+    end_row(env);
+
+    return 1;
+}
+
+/*
+ * Pass over the next row and the delimiter following it without decoding
+ * any of its elements.  Returns 1 if there was a row or 0 at the end of
+ * the table.
+ */
+
+static
+int skip_row(MetaioParseEnv const env)
+{
+    /* Peek ahead to the next non-whitespace character */
+    int c = skip_whitespace(env);
+    if(c < 0)
+        parse_error(env, -1, "failure reading row:  premature EOF");
+
+    unget_char(env, c);
+
+    if (c == '<')
+        /* '<' --> start of new element = end of stream text */
+        return 0;
+
+    if (env->ligo_lw.table.numcols > 0)
+        skip_elements(env, env->ligo_lw.table.numcols);
+    end_row(env);
+
+    return 1;
+}
+
+int MetaioGetRow(MetaioParseEnv const env)
+{
+    int result;
+
+    result = setjmp(env->jmp_env);
+    if(result)
+        /* We longjmp'ed to here --> parse error */
+        return result;
+
+    return next_row(env);
+}
+
+int MetaioSeekRow(MetaioParseEnv const env, int row)
+{
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    const struct MetaioTableEntry * const entry = env->file->entry;
+    int result;
+
+    result = setjmp(env->jmp_env);
+    if(result)
+        /* We longjmp'ed to here --> parse error */
+        return result;
+
+    if(row < 0)
+        parse_error(env, -1, "invalid row number %d", row);
+
+    /* Go to the last recorded row at or before the wanted one, unless the
+     * current position is nearer */
+    if(entry && entry->rowindex && (in->mapped || in->gzip))
+    {
+        const struct RowIndex * const index = entry->rowindex;
+        long long i = row / ROW_INDEX_INTERVAL;
+
+        if(i >= index->nmarks)
+            i = index->nmarks - 1;
+        if(row < env->file->nrows ||
+           (i * ROW_INDEX_INTERVAL > env->file->nrows &&
+            seek_is_quicker(env, index->mark[i].offset)))
+        {
+            seek_input(env, index->mark[i].offset);
+            env->file->lineno = index->mark[i].lineno;
+            env->file->charno = index->mark[i].charno;
+            env->file->nrows = i * ROW_INDEX_INTERVAL;
+        }
+    }
+
+    if(row < env->file->nrows)
+        parse_error(env, -1, "cannot seek back to row %d", row);
+
+    while(env->file->nrows < row)
+        if(!skip_row(env))
+            return 1;
+
+    return 0;
+}
+
+/*
+ * Size of one value of a numeric type, or 0 for string and blob types
+ */
+
+static
+size_t numeric_size(enum METAIO_Type type)
+{
+    switch(type)
+    {
+    case METAIO_TYPE_REAL_4:
+        return sizeof(METAIO_REAL_4);
+    case METAIO_TYPE_REAL_8:
+        return sizeof(METAIO_REAL_8);
+    case METAIO_TYPE_INT_4S:
+        return sizeof(METAIO_INT_4S);
+    case METAIO_TYPE_INT_4U:
+        return sizeof(METAIO_INT_4U);
+    case METAIO_TYPE_INT_2S:
+        return sizeof(METAIO_INT_2S);
+    case METAIO_TYPE_INT_2U:
+        return sizeof(METAIO_INT_2U);
+    case METAIO_TYPE_INT_8S:
+        return sizeof(METAIO_INT_8S);
+    case METAIO_TYPE_INT_8U:
+        return sizeof(METAIO_INT_8U);
+    case METAIO_TYPE_COMPLEX_8:
+        return sizeof(METAIO_COMPLEX_8);
+    case METAIO_TYPE_COMPLEX_16:
+        return sizeof(METAIO_COMPLEX_16);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Append the current row, in env->ligo_lw.table.elt[], to the batch
+ */
+
+static
+void store_row(MetaioParseEnv const env, struct MetaioRowBatch * const batch)
+{
+    const size_t i = batch->nrows;
+    int col;
+
+    for(col = 0; col < batch->numcols; col++)
+    {
+        const struct MetaioRowElement * const elt = &env->ligo_lw.table.elt[col];
+        struct MetaioColumnData * const cd = &batch->col[col];
+        const void *data;
+        size_t *offset;
+        size_t len;
+
+        if(elt->valid)
+            cd->valid[i / 8] |= 1 << (i % 8);
+        else
+            cd->valid[i / 8] &= ~(1 << (i % 8));
+
+        switch(cd->data_type)
+        {
+        case METAIO_TYPE_REAL_4:
+            ((METAIO_REAL_4 *) cd->values)[i] = elt->data.real_4;
+            continue;
+        case METAIO_TYPE_REAL_8:
+            ((METAIO_REAL_8 *) cd->values)[i] = elt->data.real_8;
+            continue;
+        case METAIO_TYPE_INT_4S:
+            ((METAIO_INT_4S *) cd->values)[i] = elt->data.int_4s;
+            continue;
+        case METAIO_TYPE_INT_4U:
+            ((METAIO_INT_4U *) cd->values)[i] = elt->data.int_4u;
+            continue;
+        case METAIO_TYPE_INT_2S:
+            ((METAIO_INT_2S *) cd->values)[i] = elt->data.int_2s;
+            continue;
+        case METAIO_TYPE_INT_2U:
+            ((METAIO_INT_2U *) cd->values)[i] = elt->data.int_2u;
+            continue;
+        case METAIO_TYPE_INT_8S:
+            ((METAIO_INT_8S *) cd->values)[i] = elt->data.int_8s;
+            continue;
+        case METAIO_TYPE_INT_8U:
+            ((METAIO_INT_8U *) cd->values)[i] = elt->data.int_8u;
+            continue;
+        case METAIO_TYPE_COMPLEX_8:
+            ((METAIO_COMPLEX_8 *) cd->values)[i] = elt->data.complex_8;
+            continue;
+        case METAIO_TYPE_COMPLEX_16:
+            ((METAIO_COMPLEX_16 *) cd->values)[i] = elt->data.complex_16;
+            continue;
+        case METAIO_TYPE_BLOB:
+        case METAIO_TYPE_ILWD_CHAR_U:
+            data = elt->data.blob.data;
+            len = elt->valid ? elt->data.blob.len : 0;
+            break;
+        default:
+            data = elt->data.lstring.data;
+            len = elt->valid ? elt->data.lstring.len : 0;
+            break;
+        }
+
+        /* String and blob contents go on the column's heap */
+        offset = cd->values;
+        if(offset[i] + len > cd->heapsize)
+        {
+            size_t size = cd->heapsize;
+            char *heap;
+
+            while(size < offset[i] + len)
+                size *= 2;
+            if(!(heap = realloc(cd->heap, size)))
+                parse_error(env, -1, "cannot allocate memory for row batch");
+            cd->heap = heap;
+            cd->heapsize = size;
+        }
+        if(len)
+            memcpy(cd->heap + offset[i], data, len);
+        offset[i + 1] = offset[i] + len;
+    }
+}
 
-        /* Consume the terminating quote */
-        if(get_char(env) != c)
-            parse_error(env, -1, "unmatched quote when reading blob");
+/*
+ * Add the table whose Stream start tag has just been parsed to the directory
+ */
 
-        /* Skip trailing white space */
-        c = skip_whitespace(env);
-        if(c < 0)
-            parse_error(env, -1, "failure reading blob:  premature EOF");
-        else if(!strchr(terminators, c))
-            parse_error(env, -1, "text following quote when reading blob");
-        else
-            /* Unconsume the terminator */
-            unget_char(env, c);
-    }
-    else if(strchr(terminators, c))
-    {
-        /* Whitespace between two delimiters --> null value */
-        unget_char(env, c);
-        elt->valid = 0;
-        /* Clear any old data */
-        elt->data.blob.len = 0;
-    }
-    else
+static
+struct MetaioTableEntry *add_entry(MetaioParseEnv const env,
+                                   struct MetaioDirectory * const dir)
+{
+    const struct MetaioTable * const table = &env->ligo_lw.table;
+    struct MetaioTableEntry *entry;
+    int i;
+
+    if(!(entry = realloc(dir->table, (dir->ntables + 1) * sizeof(*entry))))
+        parse_error(env, -1, "cannot allocate memory for table directory");
+    dir->table = entry;
+    entry = &dir->table[dir->ntables++];
+    memset(entry, 0, sizeof(*entry));
+
+    if(!(entry->col = calloc(table->numcols + 1, sizeof(*entry->col))))
+        parse_error(env, -1, "cannot allocate memory for table directory");
+    entry->numcols = table->numcols;
+    for(i = 0; i < table->numcols; i++)
     {
-        /* A blob must be quoted. May as well unget what we read. */
-        unget_char(env, c);
-        parse_error(env, -1, "missing quote when reading blob");
+        entry->col[i].name = dup_string(env, table->col[i].name);
+        entry->col[i].data_type = table->col[i].data_type;
     }
+    entry->name = dup_string(env, table->name);
+    entry->comment = dup_string(env, table->comment);
+    entry->stream.name = dup_string(env, table->stream.name);
+    entry->stream.type = dup_string(env, table->stream.type);
+    entry->stream.delimiter = table->stream.delimiter;
 
-    return 0;
-}
+    entry->offset = input_position(env);
+    entry->lineno = env->file->lineno;
+    entry->charno = env->file->charno;
 
+    return entry;
+}
 
 static
-void match_delimiter(MetaioParseEnv const env)
+void free_directory(struct MetaioDirectory * const dir)
 {
-    int c = skip_whitespace(env);
+    int i, j;
 
-    if (c != env->ligo_lw.table.stream.delimiter)
+    for(i = 0; i < dir->ntables; i++)
     {
-        unget_char(env, c);
-        parse_error(env, -1, (c < 0) ? "premature EOF, expected delimiter character '%c'" : "expected delimiter character '%c'", env->ligo_lw.table.stream.delimiter);
+        struct MetaioTableEntry * const entry = &dir->table[i];
+
+        for(j = 0; j < entry->numcols; j++)
+            free(entry->col[j].name);
+        free(entry->col);
+        free(entry->name);
+        free(entry->comment);
+        free(entry->stream.name);
+        free(entry->stream.type);
+        if(entry->rowindex)
+        {
+            free(((struct RowIndex *) entry->rowindex)->mark);
+            free(entry->rowindex);
+        }
     }
+    free(dir->table);
+    free(dir->name);
+    free(dir->comment);
 }
 
 /*
- * The following group of functions correspond to expanding the production
- * rules of the parser.
+ * Record the current position, at the start of a row, in the entry's index
  */
 
 static
-void row_element(MetaioParseEnv const env, struct MetaioRowElement* const elt)
+void add_row_mark(MetaioParseEnv const env, struct MetaioTableEntry * const entry)
 {
-    /*-- Mark this item as invalid, until we successfully parse it --*/
-    elt->valid = 0;
+    struct RowIndex *index = entry->rowindex;
+    struct RowMark *mark;
 
-    switch (elt->col->data_type)
+    if(!index)
     {
-    case METAIO_TYPE_REAL_4:
-    case METAIO_TYPE_REAL_8:
-    case METAIO_TYPE_INT_4S:
-    case METAIO_TYPE_INT_4U:
-    case METAIO_TYPE_INT_2S:
-    case METAIO_TYPE_INT_2U:
-    case METAIO_TYPE_INT_8S:
-    case METAIO_TYPE_INT_8U:
-    case METAIO_TYPE_COMPLEX_8:
-    case METAIO_TYPE_COMPLEX_16:
-        match_numeric(env, elt);
-        break;
-    case METAIO_TYPE_LSTRING:
-    case METAIO_TYPE_ILWD_CHAR:
-    case METAIO_TYPE_CHAR_S:
-    case METAIO_TYPE_CHAR_V:
-        match_lstring(env, elt);
-        break;
-    case METAIO_TYPE_BLOB:
-        match_blob(env, elt);
-        break;
-    case METAIO_TYPE_ILWD_CHAR_U:
-        match_ilwd_char_u(env, elt);
-        break;
-    default:
-        parse_error(env, -1, "row element has unknown type");
-        break;
+        if(!(index = calloc(1, sizeof(*index))))
+            parse_error(env, -1, "cannot allocate memory for table directory");
+        entry->rowindex = index;
+    }
+
+    /* Grow the array of marks whenever its length reaches a power of two */
+    if(!(index->nmarks & (index->nmarks - 1)))
+    {
+        mark = realloc(index->mark, (index->nmarks ? 2 * index->nmarks : 1) * sizeof(*mark));
+        if(!mark)
+            parse_error(env, -1, "cannot allocate memory for table directory");
+        index->mark = mark;
     }
+
+    mark = &index->mark[index->nmarks++];
+    mark->offset = input_position(env);
+    mark->lineno = env->file->lineno;
+    mark->charno = env->file->charno;
 }
 
+#ifdef HAVE_LIBZ
+
+/*
+ * A directory is saved in an index file as the number of tables, the name
+ * and comment of the document, then for each table its name, comment,
+ * stream name, type and delimiter, columns, position, number of rows and
+ * row marks.  Numbers are 8-byte little-endian, and each string is its
+ * length (or -1 for a null pointer) followed by its characters.
+ */
+
 static
-int row(MetaioParseEnv const env)
+void save_number(FILE *fp, long long v, uLong *crc)
 {
-    int numcols = env->ligo_lw.table.numcols;
-    int col;
-    /* Peek ahead to the next non-whitespace character */
-    int c = skip_whitespace(env);
-    if(c < 0)
-        parse_error(env, -1, "failure reading row:  premature EOF");
+    unsigned char buf[8];
 
-    unget_char(env, c);
+    put_int64(buf, v);
+    write_block(fp, buf, 8, crc);
+}
 
-    if (c == '<')
-        /* '<' --> start of new element = end of stream text */
-        return 0;
+static
+void save_string(FILE *fp, const char * const s, uLong *crc)
+{
+    const long long len = s ? (long long) strlen(s) : -1;
 
-    /* Process the whole row */
-    for (col = 0; col < numcols - 1; col++)
+    save_number(fp, len, crc);
+    if(len > 0)
+        write_block(fp, s, len, crc);
+}
+
+static
+void save_directory(FILE *fp, const struct MetaioDirectory * const dir,
+                    uLong *crc)
+{
+    int i, j;
+
+    save_number(fp, dir->ntables, crc);
+    save_string(fp, dir->name, crc);
+    save_string(fp, dir->comment, crc);
+
+    for(i = 0; i < dir->ntables; i++)
     {
-        row_element(env, &(env->ligo_lw.table.elt[col]));
-        match_delimiter(env);
+        const struct MetaioTableEntry * const entry = &dir->table[i];
+        const struct RowIndex * const index = entry->rowindex;
+        const long long nmarks = index ? index->nmarks : 0;
+        long long k;
+
+        save_string(fp, entry->name, crc);
+        save_string(fp, entry->comment, crc);
+        save_string(fp, entry->stream.name, crc);
+        save_string(fp, entry->stream.type, crc);
+        save_number(fp, (unsigned char) entry->stream.delimiter, crc);
+        save_number(fp, entry->numcols, crc);
+        for(j = 0; j < entry->numcols; j++)
+        {
+            save_string(fp, entry->col[j].name, crc);
+            save_number(fp, entry->col[j].data_type, crc);
+        }
+        save_number(fp, entry->offset, crc);
+        save_number(fp, entry->lineno, crc);
+        save_number(fp, entry->charno, crc);
+        save_number(fp, entry->nrows, crc);
+        save_number(fp, nmarks, crc);
+        for(k = 0; k < nmarks; k++)
+        {
+            save_number(fp, index->mark[k].offset, crc);
+            save_number(fp, index->mark[k].lineno, crc);
+            save_number(fp, index->mark[k].charno, crc);
+        }
     }
-    row_element(env, &(env->ligo_lw.table.elt[col]));
+}
 
-    /* finished reading 1 row */
-    return 1;
+/*
+ * Read a number, which must be from 0 to limit.  Returns 0 if successful.
+ */
+
+static
+int load_number(FILE *fp, long long *v, long long limit, uLong *crc)
+{
+    unsigned char buf[8];
+
+    if(read_block(fp, buf, 8, crc))
+        return 1;
+    *v = get_int64(buf);
+    return *v < 0 || *v > limit;
 }
 
 static
-void stream_attr(MetaioParseEnv const env)
+int load_string(FILE *fp, char **s, long long limit, uLong *crc)
 {
-    int attr_mask = 0;
+    unsigned char buf[8];
+    long long len;
 
-    env->ligo_lw.table.stream.delimiter = ',';	/* default delimiter */
+    if(read_block(fp, buf, 8, crc))
+        return 1;
+    len = get_int64(buf);
+    if(len < -1 || len > limit)
+        return 1;
+    if(len < 0)
+        return 0;
+    if(!(*s = malloc(len + 1)) || read_block(fp, *s, len, crc))
+        return 1;
+    (*s)[len] = '\0';
+    return 0;
+}
 
-    do {
-        switch(env->token)
-        {
-        case DELIMITER:
-            if(attr_mask & 1)
-                parse_error(env, -1, "duplicate Delimiter attribute for Stream");
-            delimiter(env, &(env->ligo_lw.table.stream.delimiter));
-            DEBUGMSG2("DELIMITER = \"%c\"\n", env->ligo_lw.table.stream.delimiter);
-            attr_mask |= 1;
-            continue;
+/*
+ * Load a directory of ntables tables saved by save_directory(), whose
+ * counts and lengths can be no more than limit.  Returns 0 if successful;
+ * otherwise what has been loaded is left in dir to be freed.
+ */
 
-        case NAME:
-            if(attr_mask & 2)
-                parse_error(env, -1, "duplicate Name attribute for Stream");
-            name(env, &(env->ligo_lw.table.stream.name));
-            DEBUGMSG2("NAME = \"%s\"\n", env->ligo_lw.table.stream.name);
-            attr_mask |= 2;
-            continue;
+static
+int load_directory(FILE *fp, struct MetaioDirectory * const dir,
+                   long long ntables, long long limit, uLong *crc)
+{
+    long long v, k;
+    int i, j;
 
-        case TYPE:
-            if(attr_mask & 4)
-                parse_error(env, -1, "duplicate Type attribute for Stream");
-            type(env, &(env->ligo_lw.table.stream.type));
-            DEBUGMSG2("TYPE = \"%s\"\n", env->ligo_lw.table.stream.type);
-            attr_mask |= 4;
-            continue;
+    if(ntables > limit || ntables > INT_MAX ||
+       !(dir->table = calloc(ntables + 1, sizeof(*dir->table))))
+        return 1;
+    dir->ntables = ntables;
+    if(load_string(fp, &dir->name, limit, crc) ||
+       load_string(fp, &dir->comment, limit, crc))
+        return 1;
 
-        default:
-            break;
+    for(i = 0; i < dir->ntables; i++)
+    {
+        struct MetaioTableEntry * const entry = &dir->table[i];
+        struct RowIndex *index;
+
+        if(load_string(fp, &entry->name, limit, crc) ||
+           load_string(fp, &entry->comment, limit, crc) ||
+           load_string(fp, &entry->stream.name, limit, crc) ||
+           load_string(fp, &entry->stream.type, limit, crc) ||
+           load_number(fp, &v, UCHAR_MAX, crc))
+            return 1;
+        entry->stream.delimiter = v;
+
+        if(load_number(fp, &v, limit < INT_MAX ? limit : INT_MAX, crc) ||
+           !(entry->col = calloc(v + 1, sizeof(*entry->col))))
+            return 1;
+        entry->numcols = v;
+        for(j = 0; j < entry->numcols; j++)
+        {
+            if(load_string(fp, &entry->col[j].name, limit, crc) ||
+               load_number(fp, &v, METAIO_TYPE_UNKNOWN, crc))
+                return 1;
+            entry->col[j].data_type = v;
         }
-        break;
-    } while(1);
 
-    /*
-      This is a special case. We would normally do a match to
-      GREATER_THAN but that would also trigger an advance to the
-      next token. Since we expect to be reading data from the
-      stream object after this, the next data read shouldn't be tokenized.
-      Instead we match the GREATER_THAN after we return from reading
-      the stream
+        if(load_number(fp, &entry->offset, LLONG_MAX, crc) ||
+           load_number(fp, &v, LLONG_MAX, crc))
+            return 1;
+        entry->lineno = v;
+        if(load_number(fp, &v, LLONG_MAX, crc))
+            return 1;
+        entry->charno = v;
+        if(load_number(fp, &entry->nrows, LLONG_MAX, crc) ||
+           load_number(fp, &v, limit, crc))
+            return 1;
 
-      It is a little annoying that the stream_attr function needs to
-      be clairvoyant but in practise the initial parsing will only read
-      to here anyway. Reading the rows will be done on an individual basis
-      by the user.
-      
-      Ideally what we would do is unget all the text read by match(), but
-      unfortunately ungetting is only guaranteed for one character.
-    */
+        if(v)
+        {
+            if(!(index = calloc(1, sizeof(*index))))
+                return 1;
+            entry->rowindex = index;
+            if(!(index->mark = calloc(v, sizeof(*index->mark))))
+                return 1;
+            index->nmarks = v;
+            for(k = 0; k < v; k++)
+            {
+                struct RowMark * const mark = &index->mark[k];
+                long long lineno, charno;
+
+                if(load_number(fp, &mark->offset, LLONG_MAX, crc) ||
+                   load_number(fp, &lineno, LLONG_MAX, crc) ||
+                   load_number(fp, &charno, LLONG_MAX, crc))
+                    return 1;
+                mark->lineno = lineno;
+                mark->charno = charno;
+            }
+        }
+    }
 
-    /*-- If the stream is empty, the end of the tag will be "/>" --*/
-    if (env->token == FORWARD_SLASH)
-        match(env, FORWARD_SLASH);
+    return 0;
+}
 
-    if (env->token != GREATER_THAN)
-        unexpected_token(env, env->token);
+#endif /* HAVE_LIBZ */
 
-    /*
-     * We are now at the end of the stream attributes for this table and
-     * are about to begin reading rows
-     */
-    env->file->nrows = 0;
+/*
+ * Parse a whole document, recording each table in the directory.  The rows
+ * are counted by passing over all of their elements, and the positions of
+ * some of them are recorded.
+ */
+
+static
+void read_directory(MetaioParseEnv const env, struct MetaioDirectory * const dir)
+{
+    leading_junk(env);
+    match(env, LIGO_LW);
+    ligo_lw_attr(env);
+    comment(env, &(env->ligo_lw.comment));
+    dir->name = dup_string(env, env->ligo_lw.name);
+    dir->comment = dup_string(env, env->ligo_lw.comment);
+
+    while (env->token == TABLE)
+    {
+        struct MetaioTableEntry *entry;
+
+        match(env, TABLE);
+        table_attr(env);
+        table_body(env);
+        entry = add_entry(env, dir);
+
+        do
+            if (env->file->nrows % ROW_INDEX_INTERVAL == 0)
+                add_row_mark(env, entry);
+        while (skip_row(env));
+        entry->nrows = env->file->nrows;
+
+        while (env->token != CLOSE_TABLE && env->token != END_OF_FILE)
+        {
+            skip_to_tag(env);
+            get_next_token(env);
+        }
+        match(env, CLOSE_TABLE);
+        match(env, GREATER_THAN);
+    }
 }
 
+#ifdef HAVE_LIBZ
+
 /*
- * This function is used to when we encounter a table which is not the one
- * specified in tablename. The function scans through the body of the
- * table until it finds the end of the table's STREAM, then looks for the
- * tokens to close the table. At the end we should be in the correct position
- * in the file to look for the next table (and so on, until we get to the
- * right table or run out of file). The body of the table is not parsed.
+ * Get the access points of a compressed file whose directory is being
+ * read, unless they were loaded from the index saved beside it, by
+ * recording them while the file is read through a cursor
  */
 
-static
-void table_consume(MetaioParseEnv const env)
-{
-#if 1	/* blast through with no validation (fast) */
-    while (env->token != CLOSE_STREAM)
-        get_next_token(env);
-    get_next_token(env);
-    match(env, GREATER_THAN);
-  
-    /* Close the <TABLE> */
-    match(env, CLOSE_TABLE);
-    match(env, GREATER_THAN);
-#else	/* validate the table while consuming it (slow) */
-    /* consume remaining rows */
-    while (row(env) != 0)
+static
+void index_gzip(MetaioParseEnv const scan, struct DirectoryCache * const d)
+{
+    struct GzipCursor *c;
+
+    if(d->gzindex)
+        return;
+    if(!(c = open_cursor(scan->file->name, NULL)))
+        /* Not gzip-compressed */
+        return;
+
+    /* The cursor is closed along with the scanning parser */
+    scan->file->inbuf.gzip = c;
+    if(!(d->gzindex = c->index = calloc(1, sizeof(*c->index))))
+        parse_error(scan, -1, "cannot allocate memory for gzip index");
+    if(gzip_identity(c->fd, c->index))
+        parse_error(scan, -1, "cannot read \"%s\": %s", scan->file->name, strerror(errno));
+    c->record = 1;
+    if(cursor_start(c, NULL) < 0)
+        parse_error(scan, -1, "%s", c->errmsg);
+}
+
+#endif /* HAVE_LIBZ */
+
+int MetaioReadDirectory(MetaioParseEnv const env,
+                        const struct MetaioDirectory **dir)
+{
+    struct MetaioParseEnvironment scanEnvironment;
+    MetaioParseEnv const scan = &scanEnvironment;
+    struct DirectoryCache *d;
+    struct stat st;
+    int result;
+#ifdef HAVE_LIBZ
+    int listed;
+#endif
+
+    result = setjmp(env->jmp_env);
+    if(result)
+        /* We longjmp'ed to here --> parse error */
+        return result;
+
+    if(stat(env->file->name, &st) < 0 || !S_ISREG(st.st_mode))
+        parse_error(env, -1, "cannot list the tables of \"%s\":  not a regular file", env->file->name);
+    if((d = (struct DirectoryCache *) find_directory(&st)))
+    {
+        *dir = &d->dir;
+        return 0;
+    }
+
+    if(!(d = calloc(1, sizeof(*d))))
+        parse_error(env, -1, "cannot allocate memory for table directory");
+    d->dev = st.st_dev;
+    d->ino = st.st_ino;
+    d->size = st.st_size;
+    d->mtime = st.st_mtime;
+
+#ifdef HAVE_LIBZ
+    /* The directory of a compressed file may have been saved with its
+     * index, which makes reading the file unnecessary */
+    d->gzindex = read_gzip_index(env->file->name, &d->dir, &listed);
+    if(!listed)
+#endif
+    {
+        /* Read the file with a parser of its own */
+        result = MetaioOpenFile(scan, env->file->name);
+        if(result == 0)
+        {
+            result = setjmp(scan->jmp_env);
+            if(result == 0)
+            {
+#ifdef HAVE_LIBZ
+                if(!scan->file->inbuf.mapped)
+                    index_gzip(scan, d);
+#endif
+                read_directory(scan, &d->dir);
+            }
+        }
+        if(result)
+        {
+            /* Pass the error on */
+            if(scan->mierrmsg.data)
+                append_cstr(&(env->mierrmsg), scan->mierrmsg.data);
+            env->mierrno = result;
+        }
+        MetaioAbort(scan);
+        free(scan->mierrmsg.data);
+    }
+
+    if(result)
     {
-        int c = skip_whitespace(env);
-        if(c < 0)
-            parse_error(env, -1, "failure reading row:  premature EOF");
-        else if (c != env->ligo_lw.table.stream.delimiter)
-            unget_char(env, c);
+        free_directory(&d->dir);
+#ifdef HAVE_LIBZ
+        free_gzip_index(d->gzindex);
+#endif
+        free(d);
+        return result;
     }
 
-    /*-- Skip any tokens found until we get to the CLOSE_TABLE.  The
-      actual set of tokens encountered will vary depending on whether the
-      stream was empty (in which case there is no separate </STREAM> tag)
-      or non-empty. --*/
-    while ( env->token != CLOSE_TABLE || env->token == END_OF_FILE )
-        get_next_token(env);
+    add_directory(d);
+    *dir = &d->dir;
 
-    /* Close the <TABLE> */
-    match(env, CLOSE_TABLE);
-    match(env, GREATER_THAN);
-#endif
+    return 0;
 }
 
-static
-void stream(MetaioParseEnv const env)
+int MetaioWriteGzipIndex(MetaioParseEnv const env, const char * const indexname)
 {
-    match(env, STREAM);
-    stream_attr(env);
-}
+    const struct MetaioDirectory *dir;
+    int result;
+#ifdef HAVE_LIBZ
+    const struct DirectoryCache *d;
+    struct stat st;
+    int err;
+#endif
 
-static
-void table_attr(MetaioParseEnv const env)
-{
-    name(env, &(env->ligo_lw.table.name));
-    DEBUGMSG2("NAME = \"%s\"\n", env->ligo_lw.table.name); 
+    /* The index is made along with the directory */
+    result = MetaioReadDirectory(env, &dir);
+    if(result)
+        return result;
 
-    match(env, GREATER_THAN);
-}
+    result = setjmp(env->jmp_env);
+    if(result)
+        /* We longjmp'ed to here --> parse error */
+        return result;
 
-static
-void table_body(MetaioParseEnv const env)
-{
-    comment(env, &(env->ligo_lw.table.comment));
-    DEBUGMSG2("COMMENT = \"%s\"\n", env->ligo_lw.table.comment); 
+#ifdef HAVE_LIBZ
+    if(stat(env->file->name, &st) == 0 && (d = find_directory(&st)) && d->gzindex)
+    {
+        /* Declared here, after setjmp(), so longjmp() cannot clobber it */
+        char *name = NULL;
 
-    env->ligo_lw.table.numcols = 0;
-    while (env->token == COLUMN)
-        column(env);
+        if(!indexname)
+        {
+            if(!(name = malloc(strlen(env->file->name) + sizeof(GZIP_INDEX_SUFFIX))))
+                parse_error(env, -1, "cannot allocate memory for gzip index");
+            strcat(strcpy(name, env->file->name), GZIP_INDEX_SUFFIX);
+        }
+        err = write_gzip_index(d->gzindex, &d->dir, indexname ? indexname : name);
+        free(name);
+        if(err)
+            parse_error(env, -1, "cannot write gzip index of \"%s\": %s", env->file->name, strerror(err));
+        return 0;
+    }
+#endif
 
-    stream(env);
+    parse_error(env, -1, "cannot index \"%s\":  not a gzip file", env->file->name);
+    return -1;
 }
 
-static
-void table(MetaioParseEnv const env)
+int MetaioInitRowBatch(const MetaioParseEnv env,
+                       struct MetaioRowBatch * const batch, size_t maxrows)
 {
-    match(env, TABLE);
-    table_attr(env);
-    table_body(env);
-    if (!match_tablename(env))
-        table_consume(env);
-}
+    int col;
 
-static
-void ligo_lw_attr(MetaioParseEnv const env)
-{
-    name(env, &(env->ligo_lw.name));
-    DEBUGMSG2("NAME = \"%s\"\n", env->ligo_lw.name); 
+    memset(batch, 0, sizeof(*batch));
+    if(maxrows < 1 || maxrows > INT_MAX)
+        return 1;
 
-    match(env, GREATER_THAN);
+    batch->col = calloc(env->ligo_lw.table.numcols, sizeof(*batch->col));
+    if(!batch->col && env->ligo_lw.table.numcols)
+        return 1;
+    batch->numcols = env->ligo_lw.table.numcols;
+    batch->maxrows = maxrows;
+
+    for(col = 0; col < batch->numcols; col++)
+    {
+        struct MetaioColumnData * const cd = &batch->col[col];
+        size_t size = numeric_size(env->ligo_lw.table.col[col].data_type);
+
+        cd->data_type = env->ligo_lw.table.col[col].data_type;
+        cd->values = size ? malloc(maxrows * size) : calloc(maxrows + 1, sizeof(size_t));
+        cd->valid = calloc((maxrows + 7) / 8, 1);
+        /* The heap is allocated even if every value turns out to be empty,
+         * so that callers can copy from it without a check */
+        if(!size)
+        {
+            cd->heapsize = 1024;
+            cd->heap = malloc(cd->heapsize);
+        }
+        if(!cd->values || !cd->valid || (!size && !cd->heap))
+        {
+            MetaioFreeRowBatch(batch);
+            return 1;
+        }
+    }
+
+    return 0;
 }
 
-static
-void ligo_lw_body(MetaioParseEnv const env)
+int MetaioGetRows(MetaioParseEnv const env, struct MetaioRowBatch * const batch)
 {
-    comment(env, &(env->ligo_lw.comment));
-    DEBUGMSG2("COMMENT = \"%s\"\n", env->ligo_lw.comment); 
+    int result;
 
-    while (env->token == TABLE)
-        table(env);
+    batch->nrows = 0;
 
-    if (env->token != GREATER_THAN)
-        parse_error(env, -1, "table not found: \"%s\"", env->file->tablename);
+    result = setjmp(env->jmp_env);
+    if(result)
+        /* We longjmp'ed to here --> parse error */
+        return result;
+
+    if(batch->numcols != env->ligo_lw.table.numcols)
+        parse_error(env, -1, "row batch has %d columns but the table has %d", batch->numcols, env->ligo_lw.table.numcols);
+
+    while(batch->nrows < batch->maxrows && next_row(env))
+    {
+        store_row(env, batch);
+        batch->nrows++;
+    }
+
+    return batch->nrows;
 }
 
-static
-void ligo_lw(MetaioParseEnv const env)
+void MetaioFreeRowBatch(struct MetaioRowBatch * const batch)
 {
-    match(env, LIGO_LW);
-    ligo_lw_attr(env);
-    ligo_lw_body(env);
+    int col;
+
+    for(col = 0; col < batch->numcols; col++)
+    {
+        free(batch->col[col].values);
+        free(batch->col[col].valid);
+        free(batch->col[col].heap);
+    }
+    free(batch->col);
+    memset(batch, 0, sizeof(*batch));
 }
 
 /*
- * This function consumes all of the uninteresting boilerplate at the
- * beginning of a LIGO_LW XML file, up to the <LIGO_LW token.
+ * Parallel parsing.
+ *
+ * The text of a stream runs up to the first '<' after the start of its
+ * rows, since '<' cannot appear unescaped in XML character data.  When the
+ * whole file is mapped that text is split into chunks starting after a
+ * newline, which are parsed concurrently by worker threads, each with a
+ * private parse environment sharing the table's columns.  A worker parses
+ * the rows that start before the next chunk's guessed start and records
+ * where the last of them ended.  The calling thread then takes the chunks
+ * in order:  if a chunk starts where the previous one ended its rows are
+ * passed on, otherwise (or if the worker hit an error) the chunk is parsed
+ * again from the right place in the caller's environment, so the rows and
+ * any error message are exactly those of a serial parse.
  */
 
+#define PARALLEL_MIN_CHUNK (16 * 1024)
+#define PARALLEL_MAX_CHUNK (4 * 1024 * 1024)
+
+struct ParallelChunk {
+    const char *start;          /* The guessed start of the first row */
+    const char *stop;           /* Rows starting here or later belong to the
+                                 * next chunk, or NULL for the last chunk */
+    const char *end;            /* Where parsing of the chunk stopped */
+    int at_end;                 /* Non-zero if the end of the table was reached */
+    int done;                   /* 1 once parsed, -1 if that failed */
+    struct MetaioRowBatch *batches;
+    int nbatches;
+};
+
+#ifdef _POSIX_THREADS
+struct ParallelWorker {
+    struct ParallelState *ps;
+    MetaioParseEnv env;         /* The worker's private environment */
+    pthread_t thread;
+};
+#endif
+
+struct ParallelState {
+    MetaioParseEnv env;         /* The caller's environment */
+    size_t maxrows;
+    MetaioRowBatchHandler handler;
+    void *data;
+    struct ParallelChunk serial;    /* Used when there are no workers */
+    struct ParallelChunk *current;  /* The chunk the caller is parsing */
+    struct ParallelChunk *chunks;
+    int nchunks;
+#ifdef _POSIX_THREADS
+    int next;                   /* The next chunk for a worker to take */
+    int limit;                  /* Workers wait before taking this chunk */
+    int cancel;
+    int nworkers;
+    struct ParallelWorker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
 static
-void leading_junk(MetaioParseEnv const env)
+void free_chunk(struct ParallelChunk * const chunk)
 {
-    do
-        get_next_token(env);
-    while(env->token != LIGO_LW && env->token != END_OF_FILE);
+    int i;
+
+    for(i = 0; i < chunk->nbatches; i++)
+        MetaioFreeRowBatch(&chunk->batches[i]);
+    free(chunk->batches);
+    chunk->batches = NULL;
+    chunk->nbatches = 0;
 }
 
 /*
- * Various useful functions
+ * Parse the rows of a chunk, starting at the current position in env.
+ * Without a handler the rows are kept in the chunk's batches; with one a
+ * single batch is reused and passed to the handler each time it fills up.
+ * Returns non-zero if the handler did.
  */
 
 static
-int putbinary(FILE *fp, const METAIO_CHAR_U *buf, size_t len)
+int parse_chunk(MetaioParseEnv const env, struct ParallelChunk * const chunk,
+                size_t maxrows, MetaioRowBatchHandler handler, void *data)
 {
-    if(fputc('\"', fp) == EOF)
-        return -1;
-    while(len--)
-        if(fprintf(fp, "\\%03hho", *(buf++)) < 0)
-            return -1;
-    if(fputc('\"', fp) == EOF)
-        return -1;
-    return 0;
-}
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    struct MetaioRowBatch *batch = NULL;
+    int result = 0;
 
-static
-int putblob(FILE *fp, const METAIO_CHAR_U *buf, size_t len)
-{
-    char *b64 = NULL;
-    size_t b64len;
+    for(;;)
+    {
+        /* Peek ahead to the start of the next row */
+        unget_char(env, skip_whitespace(env));
+        if(chunk->stop && in->next >= chunk->stop)
+            break;
 
-    b64len = base64_encode_alloc((char *) buf, len, &b64);
-    if(!b64)
-        return -1;
+        if(batch && batch->nrows == batch->maxrows && handler)
+        {
+            if((result = handler(batch, data)))
+                break;
+            batch->nrows = 0;
+        }
+        else if(!batch || batch->nrows == batch->maxrows)
+        {
+            batch = realloc(chunk->batches,
+                            (chunk->nbatches + 1) * sizeof(*batch));
+            if(!batch)
+                parse_error(env, -1, "cannot allocate memory for row batch");
+            chunk->batches = batch;
+            batch = &chunk->batches[chunk->nbatches];
+            if(MetaioInitRowBatch(env, batch, maxrows) != 0)
+                parse_error(env, -1, "cannot allocate memory for row batch");
+            chunk->nbatches++;
+        }
 
-    if(fprintf(fp, "\"%s\"", b64) < 0)
-    {
-        free(b64);
-        return -1;
+        if(!next_row(env))
+        {
+            chunk->at_end = 1;
+            break;
+        }
+        store_row(env, batch);
+        batch->nrows++;
     }
 
-    free(b64);
-    return 0;
+    chunk->end = in->next;
+    if(handler && batch && !result && batch->nrows)
+        result = handler(batch, data);
+    if(handler)
+        free_chunk(chunk);
+
+    return result;
 }
 
+#ifdef _POSIX_THREADS
+
+/*
+ * Make a private parse environment for a worker, reading the same mapping
+ * and table as env.  The column names are shared, not copied.
+ */
+
 static
-int putstring(FILE *fp, const char *string, const char *escaped)
+MetaioParseEnv new_worker_env(MetaioParseEnv const env)
 {
-    for(; *string; string++)
-        switch(*string)
-        {
-        case '>':
-            if(fputs("&gt;", fp) == EOF)
-                return -1;
-            break;
-        case '<':
-            if(fputs("&lt;", fp) == EOF)
-                return -1;
-            break;
-        case '&':
-            if(fputs("&amp;", fp) == EOF)
-                return -1;
-            break;
-        default:
-            if(!isprint(*string) || *string < 0)
-                /* Unprintable character or non-UTF-8-safe --> error */
-                return -1;
-            if(strchr(escaped, *string))
-                /* Character that must be escaped --> precede with '\\' */
-                if(fputc('\\', fp) == EOF)
-                    return -1;
-            /* Print character */
-            if(fputc(*string, fp) == EOF)
-                return -1;
-            break;
-        }
+    MetaioParseEnv const w = calloc(1, sizeof(*w));
+    int i;
+
+    if(!w)
+        return NULL;
+
+    w->file = &w->fileRec;
+    w->file->name = env->file->name;
+    w->file->mode = 'r';
+    w->file->inbuf = env->file->inbuf;
+    w->token = UNKNOWN;
+    if(grow_columns(&w->ligo_lw.table, env->ligo_lw.table.numcols) < 0)
+    {
+        free(w->ligo_lw.table.col);
+        free(w);
+        return NULL;
+    }
+    w->ligo_lw.table.numcols = env->ligo_lw.table.numcols;
+    w->ligo_lw.table.stream.delimiter = env->ligo_lw.table.stream.delimiter;
+    for(i = 0; i < env->ligo_lw.table.numcols; i++)
+    {
+        w->ligo_lw.table.col[i] = env->ligo_lw.table.col[i];
+        w->ligo_lw.table.elt[i].col = &w->ligo_lw.table.col[i];
+    }
 
-    return 0;
+    return w;
 }
 
-int MetaioFprintElement(FILE *fp, const struct MetaioRowElement *elt)
+static
+void free_worker_env(MetaioParseEnv const w)
 {
-    /* null value --> print nothing */
-    if(!elt->valid)
-        return 0;
+    int i;
 
-    switch(elt->col->data_type)
+    for(i = 0; i < w->ligo_lw.table.numcols; i++)
     {
-    case METAIO_TYPE_INT_4S:
-        if(fprintf(fp, "%d", elt->data.int_4s) < 0)
-            return -1;
-        break;
-    case METAIO_TYPE_INT_4U:
-        if(fprintf(fp, "%u", elt->data.int_4u) < 0)
-            return -1;
-        break;
-    case METAIO_TYPE_INT_2S:
-        if(fprintf(fp, "%hd", elt->data.int_2s) < 0)
-            return -1;
-        break;
-    case METAIO_TYPE_INT_2U:
-        if(fprintf(fp, "%hu", elt->data.int_2u) < 0)
-            return -1;
-        break;
-    case METAIO_TYPE_INT_8S:
-        if(fprintf(fp, "%lld", elt->data.int_8s) < 0)
-            return -1;
-        break;
-    case METAIO_TYPE_INT_8U:
-        if(fprintf(fp, "%llu", elt->data.int_8u) < 0)
-            return -1;
-        break;
-    case METAIO_TYPE_REAL_4:
-        if(fprintf(fp, "%.9g", elt->data.real_4) < 0)
-            return -1;
-        break;
-    case METAIO_TYPE_REAL_8:
-        if(fprintf(fp, "%.17g", elt->data.real_8) < 0)
-            return -1;
-        break;
-    case METAIO_TYPE_COMPLEX_8:
-        if(fprintf(fp, "%.9g+i%9g", crealf(elt->data.complex_8), cimagf(elt->data.complex_8)) < 0)
-            return -1;
-        break;
-    case METAIO_TYPE_COMPLEX_16:
-        if(fprintf(fp, "%.17g+i%17g", creal(elt->data.complex_16), cimag(elt->data.complex_16)) < 0)
-            return -1;
-        break;
-    case METAIO_TYPE_LSTRING:
-    case METAIO_TYPE_ILWD_CHAR:
-    case METAIO_TYPE_CHAR_S:
-    case METAIO_TYPE_CHAR_V:
-        if(fputc('\"', fp) == EOF)
-            return -1;
-        if(putstring(fp, elt->data.lstring.data, "\\\"") < 0)
-            return -1;
-        if(fputc('\"', fp) == EOF)
-            return -1;
-        break;
-    case METAIO_TYPE_BLOB:
-        if(putblob(fp, elt->data.blob.data, elt->data.blob.len) < 0)
-            return -1;
-        break;
-    case METAIO_TYPE_ILWD_CHAR_U:
-        if(putbinary(fp, elt->data.blob.data, elt->data.blob.len) < 0)
-            return -1;
-        break;
-    default:
+        enum METAIO_Type type = w->ligo_lw.table.col[i].data_type;
+
+        if(type == METAIO_TYPE_BLOB || type == METAIO_TYPE_ILWD_CHAR_U)
+            free(w->ligo_lw.table.elt[i].data.blob.data);
+        else if(!numeric_size(type))
+            free(w->ligo_lw.table.elt[i].data.lstring.data);
+    }
+    free(w->ligo_lw.table.col);
+    free(w->ligo_lw.table.elt);
+    release_arena(w);
+    free(w->buffer.data);
+    free(w->mierrmsg.data);
+    free(w);
+}
+
+/*
+ * Parse one chunk in a worker's environment.  Returns 1, or -1 after a
+ * parse error, which is left to be found again by the calling thread.
+ */
+
+static
+int parse_chunk_worker(MetaioParseEnv const w, struct ParallelChunk * const chunk,
+                       size_t maxrows)
+{
+    w->file->inbuf.next = (char *) chunk->start;
+    w->file->lineno = 1;
+    w->file->charno = 1;
+
+    if(setjmp(w->jmp_env))
+    {
+        free(w->mierrmsg.data);
+        w->mierrmsg.data = 0;
+        w->mierrmsg.len = 0;
+        w->mierrmsg.datasize = 0;
+        w->mierrno = 0;
+        free_chunk(chunk);
         return -1;
     }
 
-    return 0;
+    parse_chunk(w, chunk, maxrows, NULL, NULL);
+
+    return 1;
 }
 
 static
-void putheader( const MetaioParseEnv env )
+void *parallel_worker(void *arg)
 {
-    FILE *fp = env->file->fp;
-    struct MetaioTable *table = &(env->ligo_lw.table);
-    int icol;
-
-    fprintf(fp, "\n\t<Table Name=\"%s\">", table->name);
+    struct ParallelWorker * const worker = arg;
+    struct ParallelState * const ps = worker->ps;
 
-    /* Comment (if any) */
-    if(table->comment)
+    pthread_mutex_lock(&ps->lock);
+    for(;;)
     {
-        fputs("\n\t\t<Comment>", fp);
-        putstring(fp, table->comment, "\\");
-        fputs("</Comment>", fp);
+        struct ParallelChunk *chunk;
+        int done;
+
+        while(!ps->cancel && ps->next < ps->nchunks && ps->next >= ps->limit)
+            pthread_cond_wait(&ps->cond, &ps->lock);
+        if(ps->cancel || ps->next >= ps->nchunks)
+            break;
+        chunk = &ps->chunks[ps->next++];
+        pthread_mutex_unlock(&ps->lock);
+
+        done = parse_chunk_worker(worker->env, chunk, ps->maxrows);
+
+        pthread_mutex_lock(&ps->lock);
+        chunk->done = done;
+        pthread_cond_broadcast(&ps->cond);
     }
+    pthread_mutex_unlock(&ps->lock);
 
-    /* Column elements */
-    for(icol = 0; icol < table->numcols; icol++)
-        fprintf(fp, "\n\t\t<Column Name=\"%s\" Type=\"%s\"/>", table->col[icol].name, TypeText[table->col[icol].data_type].name[0]);
+    return NULL;
+}
 
-    /* Stream element start tag */
-    fprintf(fp, "\n\t\t<Stream Name=\"%s\" Type=\"Local\" Delimiter=\"%c\">", table->name, ',');
+/*
+ * Split the text from the current position up to its end into chunks.
+ * Returns the number of chunks.
+ */
 
-    return;
+static
+int split_chunks(struct ParallelState * const ps, int nthreads)
+{
+    const struct MetaioBuffer * const in = &ps->env->file->inbuf;
+    const char delimiter = ps->env->ligo_lw.table.stream.delimiter;
+    const char * const body = in->next;
+    const char *body_end = memchr(body, '<', in->end - body);
+    const char *b;
+    size_t size;
+    int n;
+
+    if(!body_end)
+        return 0;
+
+    size = (body_end - body) / ((size_t) nthreads * 8);
+    if(size < PARALLEL_MIN_CHUNK)
+        size = PARALLEL_MIN_CHUNK;
+    else if(size > PARALLEL_MAX_CHUNK)
+        size = PARALLEL_MAX_CHUNK;
+
+    if(!(ps->chunks = calloc((body_end - body) / size + 1, sizeof(*ps->chunks))))
+        return 0;
+    ps->chunks[0].start = body;
+
+    /* Guess that a row starts after each of the first newlines past the
+     * nominal chunk boundaries */
+    for(n = 1, b = body + size; b < body_end; b += size)
+    {
+        const char *s = memchr(b, '\n', body_end - b);
+
+        if(!s)
+            break;
+        s = scan_skip_space(s + 1, body_end);
+        if(s < body_end && *s == delimiter)
+            s = scan_skip_space(s + 1, body_end);
+        if(s >= body_end)
+            break;
+        ps->chunks[n - 1].stop = s;
+        ps->chunks[n++].start = s;
+        b = s;
+    }
+
+    return n;
 }
 
-int MetaioOpenFile(MetaioParseEnv const env, const char* const filename)
+static
+int start_workers(struct ParallelState * const ps, int nthreads)
 {
-    int result;
+    if(!(ps->workers = calloc(nthreads, sizeof(*ps->workers))))
+        return 0;
+    pthread_mutex_init(&ps->lock, NULL);
+    pthread_cond_init(&ps->cond, NULL);
 
-    result = setjmp(env->jmp_env);
-    if(result)
-        /* We longjmp'ed to here --> parse error */
-        return result;
-    return init_parse_env(env, filename, "r");
+    /* Let each worker get a few chunks ahead of the calling thread */
+    ps->limit = 4 * nthreads;
+
+    while(ps->nworkers < nthreads)
+    {
+        struct ParallelWorker * const worker = &ps->workers[ps->nworkers];
+
+        worker->ps = ps;
+        if(!(worker->env = new_worker_env(ps->env)))
+            break;
+        if(pthread_create(&worker->thread, NULL, parallel_worker, worker) != 0)
+        {
+            free_worker_env(worker->env);
+            break;
+        }
+        ps->nworkers++;
+    }
+
+    return ps->nworkers;
 }
 
-int MetaioOpen(MetaioParseEnv const env, const char * const filename)
+/*
+ * Take the chunks in order, parsing again those that went wrong.
+ */
+
+static
+int collect_chunks(struct ParallelState * const ps)
 {
-    /*
-     * This function is now replaced by MetaioOpenTable(), which
-     * is identical to MetaioOpen when the tablename is a null pointer
-     */
-    return MetaioOpenTable(env, filename, 0);
+    const MetaioParseEnv env = ps->env;
+    struct MetaioBuffer * const in = &env->file->inbuf;
+    const int window = ps->limit;
+    int result = 0;
+    int k;
+
+    for(k = 0; k < ps->nchunks && !result; k++)
+    {
+        struct ParallelChunk * const chunk = &ps->chunks[k];
+        int i;
+
+        pthread_mutex_lock(&ps->lock);
+        while(!chunk->done)
+            pthread_cond_wait(&ps->cond, &ps->lock);
+        pthread_mutex_unlock(&ps->lock);
+
+        if(chunk->done < 0 || chunk->start != in->next)
+        {
+            free_chunk(chunk);
+            ps->current = chunk;
+            result = parse_chunk(env, chunk, ps->maxrows, ps->handler, ps->data);
+            ps->current = NULL;
+        }
+        else
+        {
+            count_chars(env, in->next, chunk->end - in->next);
+            in->next = (char *) chunk->end;
+            for(i = 0; i < chunk->nbatches; i++)
+            {
+                env->file->nrows += chunk->batches[i].nrows;
+                if(!result)
+                    result = ps->handler(&chunk->batches[i], ps->data);
+            }
+            free_chunk(chunk);
+        }
+
+        if(chunk->at_end)
+            break;
+
+        pthread_mutex_lock(&ps->lock);
+        ps->limit = k + 1 + window;
+        pthread_cond_broadcast(&ps->cond);
+        pthread_mutex_unlock(&ps->lock);
+    }
+
+    return result;
 }
 
-int MetaioOpenTableOnly(MetaioParseEnv const env, const char * const tablename)
+#endif /* _POSIX_THREADS */
+
+static
+int get_rows_parallel(struct ParallelState * const ps, int nthreads)
 {
-    int result;
+    const MetaioParseEnv env = ps->env;
 
-    result = setjmp(env->jmp_env);
-    if(result)
-        /* We longjmp'ed to here --> parse error */
-        return result;
+#ifdef _POSIX_THREADS
+#ifdef _SC_NPROCESSORS_ONLN
+    if(nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
 
-    /* If file is not open, return an error */
-    if(env->fileRec.fp == 0)
-        return 1;
-    if(tablename)
-        assign_cstr(&env->file->tablename, tablename);
-    leading_junk(env);
-    ligo_lw(env);
+    if(env->file->inbuf.mapped && nthreads > 1)
+    {
+        /* Move to the start of the first row */
+        unget_char(env, skip_whitespace(env));
+        if((ps->nchunks = split_chunks(ps, nthreads)) > 1 &&
+           start_workers(ps, nthreads) > 0)
+            return collect_chunks(ps);
+    }
+#endif
 
-    return 0;
+    ps->current = &ps->serial;
+    return parse_chunk(env, &ps->serial, ps->maxrows, ps->handler, ps->data);
 }
 
-int MetaioOpenTable(MetaioParseEnv const env, const char * const filename,
-                    const char * const tablename)
+static
+void end_parallel(struct ParallelState * const ps)
 {
-    int result;
+    int i;
 
-    result = setjmp(env->jmp_env);
-    if(result)
-        /* We longjmp'ed to here --> parse error */
-        return result;
+#ifdef _POSIX_THREADS
+    if(ps->workers)
+    {
+        pthread_mutex_lock(&ps->lock);
+        ps->cancel = 1;
+        pthread_cond_broadcast(&ps->cond);
+        pthread_mutex_unlock(&ps->lock);
 
-    result = init_parse_env(env, filename, "r");
-    if(result)
-        return result;
-    if(tablename)
-        assign_cstr(&env->file->tablename, tablename);
-    leading_junk(env);
-    ligo_lw(env);
+        for(i = 0; i < ps->nworkers; i++)
+        {
+            pthread_join(ps->workers[i].thread, NULL);
+            free_worker_env(ps->workers[i].env);
+        }
+        pthread_mutex_destroy(&ps->lock);
+        pthread_cond_destroy(&ps->cond);
+    }
+    free(ps->workers);
+#endif
 
-    return 0;
+    for(i = 0; i < ps->nchunks; i++)
+        free_chunk(&ps->chunks[i]);
+    free(ps->chunks);
+    free_chunk(&ps->serial);
+    free(ps);
 }
 
-int MetaioGetRow(MetaioParseEnv const env)
+int MetaioGetRowsParallel(MetaioParseEnv const env, int nthreads,
+                          size_t maxrows, MetaioRowBatchHandler handler,
+                          void *data)
 {
+    struct ParallelState * const ps = calloc(1, sizeof(*ps));
     int result;
-    int c;
+
+    if(!ps)
+        return -1;
+    ps->env = env;
+    ps->maxrows = maxrows;
+    ps->handler = handler;
+    ps->data = data;
 
     result = setjmp(env->jmp_env);
     if(result)
-        /* We longjmp'ed to here --> parse error */
+    {
+        /* We longjmp'ed to here --> parse error.  Pass on the rows that
+         * were parsed before it. */
+        struct ParallelChunk * const chunk = ps->current;
+        int i;
+
+        for(i = 0; chunk && i < chunk->nbatches; i++)
+            if(chunk->batches[i].nrows)
+                handler(&chunk->batches[i], data);
+        end_parallel(ps);
         return result;
+    }
 
-    result = row(env);
-    if(result == 0)
-        /* end of table */
-	return 0;
+    if(maxrows < 1 || maxrows > INT_MAX)
+        parse_error(env, -1, "invalid row batch size %lu", (unsigned long) maxrows);
 
-    c = skip_whitespace(env);
-    if(c < 0)
-        parse_error(env, -1, "failure reading row:  premature EOF");
-    else if (c != env->ligo_lw.table.stream.delimiter)
-        unget_char(env, c);
-    /* Increment the count of the number of rows */
-    env->file->nrows++;
+    result = get_rows_parallel(ps, nthreads);
+    end_parallel(ps);
 
-    /* Success */
-    return 1;
+    return result;
 }
 
-int MetaioClose(MetaioParseEnv const env)
+/*
+ * Finish the file opened in env and close it, freeing the memory held by
+ * env unless keep is true
+ */
+
+static
+int close_parse_env(MetaioParseEnv const env, int keep)
 {
     int result;
 
-    /* file has already been closed, or the open failed --> no-op */
-    if ( !env->file->fp )
-        return 0;
-
     /* Reset the position to which errors jump */
     result = setjmp(env->jmp_env);
     if(result)
         /* We longjmp'ed to here --> parse error */
-        return destroy_parse_env(env);
+        return release_parse_env(env, keep);
 
     /* Try to parse the rest of the file (input files only). */
     if ( env->file->mode == 'r' )
@@ -2186,7 +6350,10 @@ int MetaioClose(MetaioParseEnv const env)
 	 * loop like is done in table() */
         /* Find the end of the LIGO_LW element */
         while ( env->token != CLOSE_LIGO_LW || env->token == END_OF_FILE )
+        {
+            skip_to_tag(env);
             get_next_token(env);
+        }
 
         /* Close the <LIGO_LW> */
         match(env, CLOSE_LIGO_LW);
@@ -2196,24 +6363,49 @@ int MetaioClose(MetaioParseEnv const env)
     /*-- Handle output file --*/
     else if ( env->file->mode == 'w' )
     {
-        /*-- If header was never written out, write it out now --*/
-        if ( env->file->nrows == 0 )
+        /*-- If no table was ever written out, write out an empty one now --*/
+        if ( !env->file->table_open && env->file->tables == 0 )
             putheader( env );
 
-        /*-- Write out the file trailer stuff before closing --*/
-        fputs( "\n\t\t</Stream>\n\t</Table>\n</LIGO_LW>", env->file->fp );
+        /*-- Add the file trailer stuff, written out along with the rows
+         * still in the buffer when the file is closed --*/
+        if ( env->file->table_open )
+            puttrailer( env );
+        put_strings( env->file->fp, &env->file->outbuf, "\n</LIGO_LW>", NULL );
     }
     else
     {
         /* !?  unknown file mode */
     }
 
-    return destroy_parse_env(env);
+    return release_parse_env(env, keep);
+}
+
+int MetaioClose(MetaioParseEnv const env)
+{
+    /* file has already been closed, or the open failed --> no-op, apart
+     * from freeing any memory kept by MetaioReset() */
+    if ( !env->file->fp && !env->file->inbuf.mapped )
+    {
+        release_parse_env(env, 0);
+        return 0;
+    }
+
+    return close_parse_env(env, 0);
+}
+
+int MetaioReset(MetaioParseEnv const env)
+{
+    /* file has already been closed, or the open failed --> no-op */
+    if ( !env->file->fp && !env->file->inbuf.mapped )
+        return 0;
+
+    return close_parse_env(env, 1);
 }
 
 int MetaioAbort(MetaioParseEnv const env)
 {
-    return destroy_parse_env(env);
+    return release_parse_env(env, 0);
 }
 
 char *MetaioColumnName( const MetaioParseEnv env, int icol )
@@ -2237,6 +6429,30 @@ char *MetaioColumnName( const MetaioParseEnv env, int icol )
 }
 
 
+int MetaioSelectColumns(MetaioParseEnv const env, const char * const names[])
+{
+    int result;
+    int col;
+
+    result = setjmp(env->jmp_env);
+    if(result)
+        /* We longjmp'ed to here --> parse error */
+        return result;
+
+    /* Check all of the names before changing anything */
+    for(col = 0; names && names[col]; col++)
+        if(MetaioFindColumn(env, names[col]) < 0)
+            parse_error(env, -1, "no column named \"%s\"", names[col]);
+
+    for(col = 0; col < env->ligo_lw.table.numcols; col++)
+        env->ligo_lw.table.col[col].skip = names != NULL;
+    for(col = 0; names && names[col]; col++)
+        env->ligo_lw.table.col[MetaioFindColumn(env, names[col])].skip = 0;
+    compile_plan(env);
+
+    return 0;
+}
+
 int MetaioFindColumn( const MetaioParseEnv env, const char *name )
 /*--
   Written 31 Jan 2001 by Peter Shawhan.
@@ -2245,9 +6461,24 @@ int MetaioFindColumn( const MetaioParseEnv env, const char *name )
   "prefix" strings, delimited by colons, in the column name in the file.
 --*/
 {
+    const struct MetaioTable * const table = &env->ligo_lw.table;
     int icol;
     char *cptr;
 
+    /*-- Look the name up in the hash built with the column headers --*/
+    if ( table->hashsize > 0 )
+    {
+        unsigned slot = column_hash( name ) & (table->hashsize - 1);
+
+        while ( (icol = table->colhash[slot]) != 0 )
+        {
+            if ( strcasecmp( name, MetaioColumnName( env, icol - 1 ) ) == 0 )
+                return icol - 1;
+            slot = (slot + 1) & (table->hashsize - 1);
+        }
+        return -1;
+    }
+
     for ( icol = 0; icol < env->ligo_lw.table.numcols; icol++ )
     {
         cptr = MetaioColumnName( env, icol );
@@ -2262,6 +6493,23 @@ int MetaioFindColumn( const MetaioParseEnv env, const char *name )
 }
 
 
+int MetaioMatchColumns( const MetaioParseEnv env, const MetaioParseEnv other,
+                        int match[] )
+{
+    int icol;
+    int nmatch = 0;
+
+    for ( icol = 0; icol < env->ligo_lw.table.numcols; icol++ )
+    {
+        match[icol] = MetaioFindColumn( other, MetaioColumnName( env, icol ) );
+        if ( match[icol] >= 0 )
+            nmatch++;
+    }
+
+    return nmatch;
+}
+
+
 int MetaioCompareElements( struct MetaioRowElement *elt1,
                            struct MetaioRowElement *elt2 )
 /*--
@@ -2473,26 +6721,82 @@ int MetaioCompareElements( struct MetaioRowElement *elt1,
 }
 
 
-int MetaioCreate( const MetaioParseEnv env, const char* const filename )
-/*--
-  Written 15 Jul 2002 by Peter Shawhan.
-  Opens a file for writing, and writes the LIGO_LW header.
-  Returns 0 if successful, nonzero if there was an error creating the file.
---*/
+/*
+ * Open a file for writing, compressed if options is not a null pointer,
+ * and put the LIGO_LW header in the output buffer.
+ */
+
+static
+int create_file( const MetaioParseEnv env, const char* const filename,
+                 const struct MetaioCompression* const options )
 {
+    struct MetaioBuffer *out;
     int status;
 
     status = init_parse_env( env, filename, "w" );
     if ( status )
         return status;
 
+    out = &env->file->outbuf;
+    if ( alloc_output( out ) < 0 )
+    {
+        release_parse_env( env, 0 );
+        return 1;
+    }
+
+#ifdef HAVE_LIBZ
+    if ( options && !(out->gzip = start_writer( env->file->fp, filename, options )) )
+    {
+        release_parse_env( env, 0 );
+        return 1;
+    }
+#else
+    (void) options;
+#endif
+
     /*-- Write out the LIGO_LW header --*/
-    fputs( MetaIO_Header, env->file->fp);
+    put_chars( env->file->fp, out, MetaIO_Header, strlen( MetaIO_Header ) );
 
     return 0;
 }
 
 
+int MetaioCreate( const MetaioParseEnv env, const char* const filename )
+/*--
+  Written 15 Jul 2002 by Peter Shawhan.
+  Opens a file for writing, and writes the LIGO_LW header.
+  Returns 0 if successful, nonzero if there was an error creating the file.
+--*/
+{
+#ifdef HAVE_LIBZ
+    const struct MetaioCompression defaults = { 0, 0, 0 };
+    const size_t len = strlen( filename );
+
+    /*-- Compress files named like compressed files --*/
+    if ( len > 3 && !strcmp( filename + len - 3, ".gz" ) )
+        return create_file( env, filename, &defaults );
+#endif
+
+    return create_file( env, filename, NULL );
+}
+
+
+int MetaioCreateCompressed( const MetaioParseEnv env, const char* const filename,
+                            const struct MetaioCompression* const options )
+{
+#ifdef HAVE_LIBZ
+    const struct MetaioCompression defaults = { 0, 0, 0 };
+
+    return create_file( env, filename, options ? options : &defaults );
+#else
+    (void) env;
+    (void) filename;
+    (void) options;
+    return 1;
+#endif
+}
+
+
 int MetaioCopyEnv( const MetaioParseEnv dest, const MetaioParseEnv source )
 /*--
   Copies column definitions, etc., from one metaio environment to another.
@@ -2501,42 +6805,25 @@ int MetaioCopyEnv( const MetaioParseEnv dest, const MetaioParseEnv source )
 --*/
 {
     int icol;
-    struct MetaioRowElement* elt;
 
-    dest->ligo_lw.table.name = strdup(source->ligo_lw.table.name);
-    dest->ligo_lw.table.comment = strdup(source->ligo_lw.table.comment);
+    if ( grow_columns(&dest->ligo_lw.table, source->ligo_lw.table.numcols) < 0 )
+        return -1;
+
+    assign_cstr(dest, &(dest->ligo_lw.table.name), source->ligo_lw.table.name);
+    assign_cstr(dest, &(dest->ligo_lw.table.comment), source->ligo_lw.table.comment);
     dest->ligo_lw.table.numcols = source->ligo_lw.table.numcols;
 
     for ( icol = 0; icol < dest->ligo_lw.table.numcols; icol++ )
     {
-        dest->ligo_lw.table.col[icol].name =
-            strdup(source->ligo_lw.table.col[icol].name );
-
-        dest->ligo_lw.table.col[icol].data_type = 
-            source->ligo_lw.table.col[icol].data_type;
-
-        elt = &(dest->ligo_lw.table.elt[icol]);
-
-        elt->col = &(dest->ligo_lw.table.col[icol]);
-        elt->data.int_4s = 0;
-        elt->data.int_4u = 0;
-        elt->data.int_2s = 0;
-        elt->data.int_2u = 0;
-        elt->data.int_8s = 0LL;
-        elt->data.int_8u = 0LL;
-        elt->data.real_4 = 0.0;
-        elt->data.real_8 = 0.0;
-        elt->data.complex_8 = 0.0;
-        elt->data.complex_16 = 0.0;
-        elt->data.lstring.data = 0;
-        elt->data.lstring.len = 0;
-        elt->data.lstring.datasize = 0;
-        elt->data.blob.data = 0;
-        elt->data.blob.len = 0;
-        elt->data.blob.datasize = 0;
+        assign_cstr( dest, &(dest->ligo_lw.table.col[icol].name),
+                     source->ligo_lw.table.col[icol].name );
+
+        set_column_type( &(dest->ligo_lw.table), icol,
+                         source->ligo_lw.table.col[icol].data_type );
     }
+    forget_plan( dest );
 
-    return 0;
+    return index_columns( dest );
 }
 
 
@@ -2611,6 +6898,7 @@ int MetaioPutRow( const MetaioParseEnv env )
 --*/
 {
     FILE *fp = env->file->fp;
+    struct MetaioBuffer * const out = &env->file->outbuf;
     const struct MetaioTable *table = &env->ligo_lw.table;
     int icol;
 
@@ -2621,18 +6909,22 @@ int MetaioPutRow( const MetaioParseEnv env )
     if(env->file->mode != 'w')
         return 1;
 
-    /* If we have not yet written out any rows write the table header
-     * otherwise write a delimiter */
-    if(env->file->nrows == 0)
-        putheader(env);
-    else
-        fputs(",", fp);
+    /* If no table is being written write the table header, otherwise
+     * write a delimiter after the last row, if any */
+    if(!env->file->table_open)
+    {
+        if(putheader(env) < 0)
+            return 1;
+    }
+    else if(env->file->nrows && put_chars(fp, out, ",", 1) < 0)
+        return 1;
 
     /* Write out the data for this row */
     for(icol = 0; icol < table->numcols; icol++)
     {
-        fputs(icol ? "," : "\n\t\t\t", fp);
-        MetaioFprintElement(fp, &table->elt[icol]);
+        if(put_chars(fp, out, icol ? "," : "\n\t\t\t", icol ? 1 : 4) < 0)
+            return 1;
+        put_element(fp, out, &table->elt[icol]);
     }
 
     /*-- Increment the count of the number of rows written out --*/
@@ -2640,3 +6932,25 @@ int MetaioPutRow( const MetaioParseEnv env )
 
     return 0;
 }
+
+
+int MetaioBeginTable( const MetaioParseEnv env )
+{
+    if ( !env->file->fp || env->file->mode != 'w' )
+        return 1;
+
+    /*-- End the table before, if any --*/
+    if ( env->file->table_open && puttrailer( env ) < 0 )
+        return 1;
+
+    return putheader( env ) < 0;
+}
+
+
+int MetaioEndTable( const MetaioParseEnv env )
+{
+    if ( !env->file->fp || env->file->mode != 'w' )
+        return 1;
+
+    return env->file->table_open && puttrailer( env ) < 0;
+}
@@ -14,7 +14,10 @@
  *   the parsing environment
  *   2) Use MetaioOpenTableOnly() to seek to a specific table (or use a null
  *   table name to seek to the first table in the file)
- *   3) Use MetaioGetRow() to read individual rows from the table
+ *   3) Use MetaioGetRow() to read individual rows from the table, or
+ *   MetaioInitRowBatch() and MetaioGetRows() to read them in batches stored
+ *   column by column, or MetaioGetRowsParallel() to parse the rest of a
+ *   large table with several threads
  *   4) Use MetaioClose() to parse to the end of the file and clean up, or
  *   MetaioAbort() to clean up immediately without parsing to the end of the
  *   file eg.
@@ -73,8 +76,17 @@
  *   file.
  */
 
+#ifdef __cplusplus
+#include <complex>
+#else
 #include <complex.h>
+#endif
 #include <setjmp.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef int METAIO_INT_4S;
 typedef unsigned int METAIO_INT_4U;
@@ -86,8 +98,14 @@ typedef float METAIO_REAL_4;
 typedef double METAIO_REAL_8;
 typedef char  METAIO_CHAR;
 typedef unsigned char METAIO_CHAR_U;
+#ifdef __cplusplus
+/* Laid out the same as the C99 complex types */
+typedef std::complex<float> METAIO_COMPLEX_8;
+typedef std::complex<double> METAIO_COMPLEX_16;
+#else
 typedef float complex METAIO_COMPLEX_8;
 typedef double complex METAIO_COMPLEX_16;
+#endif
 
 /*-- This must be kept consistent with "const TypeText" in metaio.c !! --*/
 enum METAIO_Type {
@@ -127,6 +145,7 @@ struct MetaioStringU {
 struct MetaioColumn {
     char* name;
     enum METAIO_Type data_type;
+    int skip;               /* Non-zero if excluded by MetaioSelectColumns() */
 };
 
 struct MetaioStream {
@@ -154,15 +173,26 @@ struct MetaioRowElement {
     } data;
 };
 
+/*
+ * Tables may have any number of columns:  the column and element arrays
+ * are allocated as the columns are read.  METAIOMAXCOLS no longer limits
+ * anything and is kept only so that older code which sizes its own arrays
+ * with it still compiles; such code should size them from numcols
+ * instead.  METAIO_DYNAMIC_COLUMNS tells code that must build against
+ * both kinds of library which one it has.
+ */
 #define METAIOMAXCOLS 100
+#define METAIO_DYNAMIC_COLUMNS 1
 
 struct MetaioTable {
     char*                   name;
     char*                   comment;
-    struct MetaioColumn     col[METAIOMAXCOLS];
-    struct MetaioRowElement elt[METAIOMAXCOLS];
+    struct MetaioColumn*    col;
+    struct MetaioRowElement* elt;
     int                     numcols;
-    int                     maxcols;
+    int                     maxcols;    /* The number of slots in col and elt */
+    int*                    colhash;    /* Column numbers + 1 hashed by name */
+    int                     hashsize;   /* The slots in colhash, 0 if unbuilt */
     struct MetaioStream     stream;
 };
 
@@ -172,6 +202,19 @@ struct MetaioLigo_lw {
     struct MetaioTable table;
 };
 
+/* A block of input text owned by the parser */
+struct MetaioBuffer {
+    char*  data;            /* The memory holding the block */
+    char*  next;            /* The next character to be consumed */
+    char*  end;             /* One past the last valid character */
+    size_t datasize;        /* The length of the memory pointed to by data */
+    int    mapped;          /* Non-zero if data is a mapping of the file */
+    void*  reader;          /* The background reader filling data, if any */
+    long long pos;          /* The position of end in the (uncompressed) file */
+    void*  gzip;            /* Random access into compressed input, or the
+                             * compressor of output, if any */
+};
+
 struct MetaioFileRecord {
     char*  name;
     void*  fp;
@@ -180,6 +223,15 @@ struct MetaioFileRecord {
     int nrows;
     char mode;
     char* tablename;
+    struct MetaioBuffer inbuf;
+    const struct MetaioTableEntry* entry; /* The directory entry of the
+                                           * current table, if it was
+                                           * opened from one */
+    struct MetaioBuffer outbuf; /* The output not yet written to the file,
+                                 * if writing */
+    int tables;                 /* The tables ended so far, if writing */
+    int table_open;             /* Non-zero if the start of a table has been
+                                 * written and the table not yet ended */
 };
 
 typedef struct MetaioFileRecord* MetaioFile;
@@ -193,10 +245,65 @@ struct MetaioParseEnvironment {
     struct MetaioString     mierrmsg;  /* Parsing error messages put here */
     jmp_buf                 jmp_env;
     struct MetaioLigo_lw    ligo_lw;
+    void*                   arena;     /* Memory holding the strings of
+                                        * the table header */
+    void*                   plan;      /* How to decode the rows of the
+                                        * current table */
 };
 
 typedef struct MetaioParseEnvironment* MetaioParseEnv;
 
+/* A table listed by MetaioReadDirectory() */
+struct MetaioTableEntry {
+    char*                name;
+    char*                comment;
+    int                  numcols;
+    struct MetaioColumn* col;       /* The names and types of the columns */
+    struct MetaioStream  stream;
+    long long            offset;    /* The position of the first row in the
+                                     * (uncompressed) file */
+    size_t               lineno;    /* The line and character number there */
+    size_t               charno;
+    long long            nrows;
+    void*                rowindex;  /* Positions of rows for MetaioSeekRow() */
+};
+
+/* The tables of a file, as found by MetaioReadDirectory() */
+struct MetaioDirectory {
+    char*                    name;      /* The LIGO_LW element's Name */
+    char*                    comment;   /* and Comment */
+    int                      ntables;
+    struct MetaioTableEntry* table;
+};
+
+/* The values of one column in a batch of rows read by MetaioGetRows() */
+struct MetaioColumnData {
+    enum METAIO_Type data_type;
+    void*          values;   /* Numeric columns:  an array of values of the
+                              * column's type, e.g. METAIO_REAL_8.
+                              * String and blob columns:  an array of
+                              * size_t offsets into heap, value i being
+                              * the bytes from heap + offsets[i] up to
+                              * heap + offsets[i + 1] (not null terminated) */
+    unsigned char* valid;    /* A bitmap, bit i % 8 of valid[i / 8] is set
+                              * if the value in row i is not null */
+    char*          heap;     /* The contents of string and blob values,
+                              * never a null pointer for such a column */
+    size_t         heapsize; /* The length of the memory pointed to by heap */
+};
+
+/* A batch of rows stored column by column */
+struct MetaioRowBatch {
+    int                      numcols; /* The number of columns */
+    size_t                   maxrows; /* The capacity of the batch in rows */
+    size_t                   nrows;   /* The number of rows in the batch */
+    struct MetaioColumnData* col;     /* The columns, in table order */
+};
+
+/* Non-zero if the value in row i of a batch column is not null */
+#define METAIO_BATCH_VALID(coldata, i) \
+    (((coldata)->valid[(i) / 8] >> ((i) % 8)) & 1)
+
 /*
  * Returns the name of the data type as a string.
  * Usually only useful for debugging.
@@ -209,6 +316,10 @@ const char* MetaioTypeText(int data_type);
  * MetaioOpenTable() which will then fill the env with information about
  * the appropriate table
  *
+ * Uncompressed regular files are memory-mapped and parsed directly from
+ * the mapping; gzip-compressed files, pipes and other streams are read
+ * through zlib.  A mapped file must not be truncated while it is open.
+ *
  * Returns 0 if successful, non-zero otherwise.
  *
  * In case of an error, an error message is returned in env->mierrmsg.
@@ -303,6 +414,72 @@ int MetaioOpenTable(MetaioParseEnv const env, const char* const filename,
 extern
 int MetaioOpenTableOnly(MetaioParseEnv const env, const char* const tablename);
 
+/*
+ * Go on from the current table to the next one in the file whose name
+ * matches tablename (as for MetaioOpenTableOnly()), or to the very next
+ * table if tablename is a null pointer.  Any rows of the current table that
+ * have not been read are passed over.  All of the tables in a document can
+ * thus be read in a single pass, instead of opening the file again for
+ * each of them.
+ *
+ * Returns 0 if a table was found, 1 if there are no more matching tables
+ * (MetaioClose() should then be called), or a negative number if an error
+ * was encountered.
+ *
+ * In case of an error, an error message is returned in env->mierrmsg.
+ * The line number in and character positions in the XML file where the
+ * error occurred is returned in env->file->lineno and env->file->charno.
+ */
+extern
+int MetaioNextTable(MetaioParseEnv const env, const char* const tablename);
+
+/*
+ * List the tables in the file opened by 'env', with their columns and the
+ * number of rows in each.  The file is read again from the start with a
+ * separate parser (the rows are counted, not decoded), so the position of
+ * 'env' is not affected; it must be a regular file, possibly compressed.
+ *
+ * The directory is kept for the rest of the life of the program and *dir
+ * is set to point to it.  Afterwards, opening any table of the same file
+ * with MetaioOpenTableOnly() or MetaioOpenTable() goes straight to its
+ * first row instead of parsing the tables before it.
+ *
+ * For a gzip-compressed file, an index of points from which decompression
+ * can be resumed, every few megabytes, is kept with the directory.  It is
+ * read from the file's name with ".gzidx" appended if that was saved by
+ * MetaioWriteGzipIndex() or MetaioCreateCompressed() for the same file,
+ * and is otherwise made while the file is read.  An index saved by
+ * MetaioWriteGzipIndex() holds the directory as well, which is then
+ * loaded instead of reading the file, and is also used by
+ * MetaioOpenTableOnly() and MetaioOpenTable() in a program that has not
+ * called this.  Without a saved directory, listing takes a pass over the
+ * whole file.
+ *
+ * Returns 0 if successful, non-zero otherwise.
+ *
+ * In case of an error, an error message is returned in env->mierrmsg.
+ */
+extern
+int MetaioReadDirectory(MetaioParseEnv const env,
+                        const struct MetaioDirectory **dir);
+
+/*
+ * Save the index of the gzip-compressed file opened by 'env', which lets
+ * its tables and rows be reached without decompressing everything before
+ * them, to the file 'indexname', along with its directory.  If indexname
+ * is a null pointer, the index is saved as the file's name with ".gzidx"
+ * appended, where MetaioReadDirectory() will look for it.  The index is
+ * made by calling MetaioReadDirectory() if that has not been done
+ * already.
+ *
+ * Returns 0 if successful, non-zero otherwise.
+ *
+ * In case of an error, an error message is returned in env->mierrmsg.
+ */
+extern
+int MetaioWriteGzipIndex(MetaioParseEnv const env,
+                         const char* const indexname);
+
 /*
  * Parse the next row in the input file and insert it into 'env',
  * overwriting the current row. Row element i can be accessed
@@ -318,6 +495,105 @@ int MetaioOpenTableOnly(MetaioParseEnv const env, const char* const tablename);
 extern
 int MetaioGetRow(MetaioParseEnv const env);
 
+/*
+ * Move to row 'row' of the current table (counting from 0), so that it is
+ * the next row returned by MetaioGetRow().  The rows in between are passed
+ * over without decoding their elements.
+ *
+ * If the table was opened from a directory made by MetaioReadDirectory(),
+ * the directory records the position of every 1024th row and the seek
+ * starts from the nearest of them, which also allows seeking backwards.
+ * For a compressed file, decompression restarts from the last point of its
+ * index before that row.  Otherwise only rows after the current position
+ * can be reached.
+ *
+ * Returns 0 if successful, 1 if the table has fewer rows (in which case
+ * it is left at its end), or a negative number if an error was
+ * encountered.  In any case env->file->nrows is the number of rows before
+ * the new position.
+ *
+ * In case of an error, an error message is returned in env->mierrmsg.
+ * The line number in and character positions in the XML file where the
+ * error occurred is returned in env->file->lineno and env->file->charno.
+ */
+extern
+int MetaioSeekRow(MetaioParseEnv const env, int row);
+
+/*
+ * Allocate a batch that can hold up to maxrows rows of the current table,
+ * for use with MetaioGetRows().  It must be called after the table has been
+ * opened, and the batch must be released with MetaioFreeRowBatch().
+ *
+ * Returns 0 if successful, non-zero otherwise.
+ */
+extern
+int MetaioInitRowBatch(const MetaioParseEnv env,
+                       struct MetaioRowBatch * const batch, size_t maxrows);
+
+/*
+ * Parse up to batch->maxrows rows from the input file into 'batch',
+ * overwriting its previous contents.  This is equivalent to calling
+ * MetaioGetRow() repeatedly and copying each element, but the values of
+ * each column end up in a contiguous array of the column's type.  The
+ * last row read is also left in env->ligo_lw.table.elt[] as usual.
+ * It can be mixed with calls to MetaioGetRow().
+ *
+ * Returns the number of rows obtained (0 at the end of the table), or a
+ * negative number if an error was encountered.  After an error,
+ * batch->nrows holds the number of complete rows parsed before it.
+ *
+ * In case of an error, an error message is returned in env->mierrmsg.
+ * The line number in and character positions in the XML file where the
+ * error occurred is returned in env->file->lineno and env->file->charno.
+ */
+extern
+int MetaioGetRows(MetaioParseEnv const env, struct MetaioRowBatch * const batch);
+
+/*
+ * Free the memory owned by a batch.
+ */
+extern
+void MetaioFreeRowBatch(struct MetaioRowBatch * const batch);
+
+/*
+ * A function that receives the batches produced by MetaioGetRowsParallel().
+ * The batch is only valid for the duration of the call.  Returning non-zero
+ * stops the parse.
+ */
+typedef int (*MetaioRowBatchHandler)(const struct MetaioRowBatch *batch,
+                                     void *data);
+
+/*
+ * Parse the rest of the current table using up to nthreads threads (or one
+ * per processor if nthreads is 0), passing the rows to handler in batches
+ * of at most maxrows rows.  The batches are passed in the order in which
+ * the rows appear in the file, from the calling thread, so the handler
+ * does not need to be thread-safe.
+ *
+ * The table body is split into chunks at line boundaries which are parsed
+ * concurrently, each by a private copy of the parser.  A chunk whose guessed
+ * starting point turns out not to be the start of a row, e.g. because a
+ * string element spans lines, is parsed again by the calling thread.  Input
+ * that is not memory-mapped (compressed files and pipes) is parsed by the
+ * calling thread alone.
+ *
+ * Unlike MetaioGetRows(), env->ligo_lw.table.elt[] is not updated.  When
+ * this returns 0 the table has been read to its end, and MetaioClose() can
+ * be called as usual.
+ *
+ * Returns 0 if successful, the handler's return value if it stopped the
+ * parse, or a negative number if an error was encountered.  The rows before
+ * an error are all passed to handler.
+ *
+ * In case of an error, an error message is returned in env->mierrmsg.
+ * The line number in and character positions in the XML file where the
+ * error occurred is returned in env->file->lineno and env->file->charno.
+ */
+extern
+int MetaioGetRowsParallel(MetaioParseEnv const env, int nthreads,
+                          size_t maxrows, MetaioRowBatchHandler handler,
+                          void *data);
+
 /*
  * Finish off parsing the file (looking for closing tags and so on), close
  * the file and free resources owned by 'env'. After calling this, accessing
@@ -332,6 +608,39 @@ int MetaioGetRow(MetaioParseEnv const env);
 extern
 int MetaioClose(MetaioParseEnv const env);
 
+/*
+ * Like MetaioClose(), but keep the memory that 'env' has grown -- the
+ * names and types of the columns, the string buffers of the row, the
+ * token buffer and the error message -- for reading another file with
+ * MetaioReopen().  A program that reads many files one after another
+ * through the same 'env' then allocates almost nothing after the first.
+ * MetaioClose() or MetaioAbort() frees the memory at the end.
+ *
+ * Returns 0 if successful, or a negative number if an error was encountered.
+ *
+ * In case of an error, an error message is returned in env->mierrmsg.
+ */
+extern
+int MetaioReset(MetaioParseEnv const env);
+
+/*
+ * Open filename and parse it up to the first row of its first table, like
+ * MetaioOpen(), reusing the memory kept in 'env' by MetaioReset().  'env'
+ * must have been opened before with one of the other open functions;
+ * MetaioClose() and MetaioAbort() leave it fit for this too.  A file still
+ * open in 'env' is abandoned first, as by MetaioAbort() but keeping the
+ * memory.  MetaioNextTable() can be used afterwards to move on to other
+ * tables.
+ *
+ * Returns 0 if successful, non-zero otherwise.
+ *
+ * In case of an error, an error message is returned in env->mierrmsg.
+ * The line number in and character positions in the XML file where the
+ * error occurred is returned in env->file->lineno and env->file->charno.
+ */
+extern
+int MetaioReopen(MetaioParseEnv const env, const char* const filename);
+
 /*
  * Immediately close the file, without trying to parse the rest of it,
  * and free resources owned by 'env'. After calling this, accessing
@@ -360,6 +669,28 @@ void MetaioClearErrno(MetaioParseEnv const env);
 extern
 const char *MetaioGetErrorMessage(MetaioParseEnv const env);
 
+/*
+ * Functions that supply and release memory, for MetaioSetAllocator().
+ * data is the pointer given to MetaioSetAllocator().
+ */
+typedef void* (*MetaioAllocFunc)(size_t size, void* data);
+typedef void  (*MetaioFreeFunc)(void* ptr, void* data);
+
+/*
+ * Set the functions from which each parse environment obtains the arena
+ * holding the strings of the table header (the names, comments and stream
+ * attributes, which are laid out together in it and freed all at once by
+ * MetaioClose()).  alloc must return memory aligned for any type, or NULL
+ * on failure.  Null functions restore malloc() and free().  An
+ * environment keeps the functions it started with until it is closed, so
+ * this should be called before any file is opened, and not while other
+ * threads are opening files.  The row elements' string buffers, which grow
+ * with realloc(), still come from malloc().
+ */
+extern
+void MetaioSetAllocator(MetaioAllocFunc alloc, MetaioFreeFunc release,
+                        void* data);
+
 /*
  * Look up a the name of the column with the given index, ignoring any "prefix"
  * string(s) delimited by colons.  For instance, if the file contains a column
@@ -375,12 +706,44 @@ char *MetaioColumnName(const MetaioParseEnv env, int icol);
  * Find a column by name.  The name comparison is case-insensitive and ignores
  * any "prefix" strings, delimited by colons, in the column name in the file.
  *
+ * The names are looked up in a hash built when the table header is read,
+ * so the lookup takes the same time however wide the table is.
+ *
  * Returns the index of the column with the specified name, or -1 if no such
  * column is found.
  */
 extern
 int MetaioFindColumn(const MetaioParseEnv env, const char *name);
 
+/*
+ * Match the columns of the current table of env to those of other by name,
+ * as by MetaioFindColumn().  For each column icol of env, match[icol] is
+ * set to the index of the column of other with the same name, or -1 if
+ * there is none.  match must have room for env->ligo_lw.table.numcols
+ * entries.
+ *
+ * Returns the number of columns matched.
+ */
+extern
+int MetaioMatchColumns(const MetaioParseEnv env, const MetaioParseEnv other,
+                       int match[]);
+
+/*
+ * Restrict parsing to the named columns of the current table.  names is an
+ * array of column names terminated by a null pointer, matched as by
+ * MetaioFindColumn(); a null names pointer selects all columns again.  It
+ * is called after MetaioOpenTableOnly() and affects the rows read after it.
+ *
+ * The elements of the other columns are passed over without being decoded
+ * and are marked as null (their valid flag is 0).
+ *
+ * Returns 0 if successful, non-zero if a column does not exist, in which
+ * case the selection is not changed and an error message is returned in
+ * env->mierrmsg.
+ */
+extern
+int MetaioSelectColumns(MetaioParseEnv const env, const char * const names[]);
+
 /*
  * Compares element values in a way which depends on the particular data type.
  *
@@ -394,7 +757,8 @@ int MetaioCompareElements(struct MetaioRowElement *elt1,
 
 /*
  * Print the value of a row element to the given file (which may be a standard
- * stream such as stdout, stderr) as a string.
+ * stream such as stdout, stderr) as a string.  Real and complex numbers are
+ * printed with the fewest digits that read back to the same value.
  * 
  * Returns the number of characters printed.
  */
@@ -402,12 +766,44 @@ extern
 int MetaioFprintElement(FILE *f, const struct MetaioRowElement *elt);
 
 /*
- * Opens a file for writing, and writes the LIGO_LW header.
+ * Opens a file for writing, and writes the LIGO_LW header.  If filename
+ * ends in ".gz" and the library was built with zlib, the file is written
+ * gzip-compressed as by MetaioCreateCompressed() with the default options.
  * Returns 0 if successful, nonzero if there was an error creating the file.
  */
 extern
 int MetaioCreate(const MetaioParseEnv env, const char* const filename);
 
+/*
+ * How MetaioCreateCompressed() compresses a file.  A structure filled with
+ * zeros gives the defaults.
+ */
+struct MetaioCompression {
+    int level;      /* The zlib compression level, from 1 (fastest) to 9
+                     * (smallest), or 0 for zlib's default */
+    int nthreads;   /* The number of threads compressing the output, or 0
+                     * for one per processor, up to 16 */
+    int index;      /* Non-zero to save an index of the blocks beside
+                     * the file */
+};
+
+/*
+ * Opens a file for writing gzip-compressed, whatever its name, and writes
+ * the LIGO_LW header.  The output is compressed in blocks of 256 kB by a
+ * pool of threads while the rows that follow are written, each block as a
+ * gzip member of its own, so the file can be decompressed by gunzip or
+ * zlib as usual, or from the start of any block.  If options->index is
+ * non-zero, an index of the blocks is saved when the file is closed as the
+ * file's name with ".gzidx" appended, where MetaioReadDirectory() will use
+ * it (the index holds no directory, so the file is still read once to
+ * list its tables).  If options is a null pointer, the defaults are used.
+ * Returns 0 if successful, nonzero if there was an error creating the file
+ * or the library was built without zlib.
+ */
+extern
+int MetaioCreateCompressed(const MetaioParseEnv env, const char* const filename,
+                           const struct MetaioCompression* const options);
+
 /*
  * Copies column definitions, etc., from one metaio environment to another.
  * Returns 0 if successful, nonzero if there was an error.
@@ -423,10 +819,39 @@ extern
 int MetaioCopyRow(const MetaioParseEnv dest, const MetaioParseEnv source);
 
 /*
- * Writes out the current row.
+ * Writes out the current row, first writing the start of the table as
+ * MetaioBeginTable() would if no table is being written.  Rows are
+ * gathered in a buffer and written to the file in large blocks, the last
+ * of them by MetaioClose().
  * Returns 0 if successful, nonzero if there was an error.
  */
 extern
 int MetaioPutRow(const MetaioParseEnv env);
 
+/*
+ * Writes the start of a table, with the name, comment and columns now in
+ * 'env' (as set by MetaioCopyEnv(), for instance), to a file opened with
+ * MetaioCreate().  The table being written, if any, is ended first.  Its
+ * rows are then written with MetaioPutRow(), and it is ended by
+ * MetaioEndTable(), another MetaioBeginTable() or MetaioClose(), so a
+ * document of any number of tables can be written in one pass.
+ * Returns 0 if successful, nonzero if there was an error.
+ */
+extern
+int MetaioBeginTable(const MetaioParseEnv env);
+
+/*
+ * Ends the table being written to a file opened with MetaioCreate(), if
+ * there is one.  If a document is closed without any table having been
+ * written, MetaioClose() writes a table with no rows; otherwise it only
+ * ends the table being written, if any, and the document.
+ * Returns 0 if successful, nonzero if there was an error.
+ */
+extern
+int MetaioEndTable(const MetaioParseEnv env);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _METAIO_H_ */
@@ -0,0 +1,455 @@
+#ifndef _METAIO_HPP_
+#define _METAIO_HPP_
+/*
+ * A header-only C++17 layer over the metaio parser, which reads the rows
+ * of a table straight into structures of the caller's own.
+ *
+ * A row type is described once, by naming the column held by each of its
+ * members, at global scope:
+ *
+ *     struct Trigger {
+ *         std::string           ifo;
+ *         int                   start_time;
+ *         std::optional<double> snr;
+ *     };
+ *
+ *     METAIO_ROW(Trigger,
+ *                METAIO_FIELD(Trigger, ifo, "ifo"),
+ *                METAIO_FIELD(Trigger, start_time, "start_time"),
+ *                METAIO_FIELD(Trigger, snr, "snr"))
+ *
+ * and is then read with a metaio::Reader:
+ *
+ *     metaio::Reader<Trigger> reader("triggers.xml", "sngl_burst");
+ *
+ *     for (const Trigger& t : reader)
+ *     {
+ *         ... process rows ...
+ *     }
+ *
+ * The columns are looked up, and their types checked against the members,
+ * once when the reader is opened.  Only those columns are decoded (see
+ * MetaioSelectColumns()), and the elements of each row are copied into
+ * the members by code chosen at compile time for the type of each one,
+ * with no lookup by name or switch on the column type.
+ *
+ * The members may have these types, which read columns of these types:
+ *
+ *     METAIO_INT_2S, METAIO_INT_2U, ...      the column type of that name
+ *     METAIO_REAL_4, METAIO_REAL_8
+ *     METAIO_COMPLEX_8, METAIO_COMPLEX_16
+ *     std::string                            lstring, ilwd:char, char_s
+ *                                            and char_v
+ *     std::vector<unsigned char>             blob and ilwd:char_u
+ *     std::optional<T>                       as T
+ *
+ * A null value leaves a std::optional empty, and any other member
+ * value-initialized.
+ *
+ * Errors are reported by throwing metaio::Error.
+ */
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#define METAIO_HAVE_STD_SPAN 1
+#endif
+#endif
+
+#include "metaio.h"
+
+namespace metaio {
+
+/*
+ * An error reported by the parser.  code() is the value returned by the
+ * function that failed.
+ */
+class Error : public std::runtime_error {
+public:
+    Error(int code, const std::string& what)
+        : std::runtime_error(what), code_(code) {}
+
+    int code() const noexcept { return code_; }
+
+private:
+    int code_;
+};
+
+#ifdef METAIO_HAVE_STD_SPAN
+template <class T>
+using span = std::span<T>;
+#else
+/*
+ * A view of a contiguous run of objects, standing in for std::span, which
+ * is not part of C++17
+ */
+template <class T>
+class span {
+public:
+    constexpr span() noexcept = default;
+    constexpr span(T* data, std::size_t size) noexcept
+        : data_(data), size_(size) {}
+    template <std::size_t N>
+    constexpr span(T (&array)[N]) noexcept : data_(array), size_(N) {}
+    template <class C, class = decltype(std::data(std::declval<C&>()))>
+    constexpr span(C& c) : data_(std::data(c)), size_(std::size(c)) {}
+
+    constexpr T* data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+    constexpr T& operator[](std::size_t i) const { return data_[i]; }
+    constexpr T* begin() const noexcept { return data_; }
+    constexpr T* end() const noexcept { return data_ + size_; }
+
+private:
+    T* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+#endif
+
+/*
+ * The column read into one member of a row type
+ */
+template <class Row, class T>
+struct Field {
+    const char* name;
+    T Row::* member;
+};
+
+template <class Row, class T>
+constexpr Field<Row, T> field(const char* name, T Row::* member)
+{
+    return {name, member};
+}
+
+/*
+ * The description of a row type:  a specialization provides a static
+ * fields() returning a tuple of Fields.  METAIO_ROW() writes one.
+ */
+template <class Row>
+struct RowTraits;
+
+#define METAIO_FIELD(Row, member, name) ::metaio::field(name, &Row::member)
+
+#define METAIO_ROW(Row, ...)                                                \
+    namespace metaio {                                                      \
+    template <>                                                             \
+    struct RowTraits<Row> {                                                 \
+        static constexpr auto fields() { return std::make_tuple(__VA_ARGS__); } \
+    };                                                                      \
+    }
+
+namespace detail {
+
+typedef MetaioRowElement::MetaioRowEltData Data;
+
+/*
+ * How a member of type T is read from a non-null element:  binds() tells
+ * whether a column type can be read into it, and get() reads it
+ */
+template <class T>
+struct Column {
+    static_assert(sizeof(T) == 0, "no column type can be read into this type");
+};
+
+template <class T, METAIO_Type Type, T Data::* Value>
+struct NumericColumn {
+    static bool binds(int type) { return type == Type; }
+    static void get(const MetaioRowElement& elt, T& value)
+    {
+        value = elt.data.*Value;
+    }
+};
+
+template <>
+struct Column<METAIO_INT_2S>
+    : NumericColumn<METAIO_INT_2S, METAIO_TYPE_INT_2S, &Data::int_2s> {};
+template <>
+struct Column<METAIO_INT_2U>
+    : NumericColumn<METAIO_INT_2U, METAIO_TYPE_INT_2U, &Data::int_2u> {};
+template <>
+struct Column<METAIO_INT_4S>
+    : NumericColumn<METAIO_INT_4S, METAIO_TYPE_INT_4S, &Data::int_4s> {};
+template <>
+struct Column<METAIO_INT_4U>
+    : NumericColumn<METAIO_INT_4U, METAIO_TYPE_INT_4U, &Data::int_4u> {};
+template <>
+struct Column<METAIO_INT_8S>
+    : NumericColumn<METAIO_INT_8S, METAIO_TYPE_INT_8S, &Data::int_8s> {};
+template <>
+struct Column<METAIO_INT_8U>
+    : NumericColumn<METAIO_INT_8U, METAIO_TYPE_INT_8U, &Data::int_8u> {};
+template <>
+struct Column<METAIO_REAL_4>
+    : NumericColumn<METAIO_REAL_4, METAIO_TYPE_REAL_4, &Data::real_4> {};
+template <>
+struct Column<METAIO_REAL_8>
+    : NumericColumn<METAIO_REAL_8, METAIO_TYPE_REAL_8, &Data::real_8> {};
+template <>
+struct Column<METAIO_COMPLEX_8>
+    : NumericColumn<METAIO_COMPLEX_8, METAIO_TYPE_COMPLEX_8, &Data::complex_8> {};
+template <>
+struct Column<METAIO_COMPLEX_16>
+    : NumericColumn<METAIO_COMPLEX_16, METAIO_TYPE_COMPLEX_16, &Data::complex_16> {};
+
+template <>
+struct Column<std::string> {
+    static bool binds(int type)
+    {
+        return type == METAIO_TYPE_LSTRING || type == METAIO_TYPE_ILWD_CHAR ||
+               type == METAIO_TYPE_CHAR_S || type == METAIO_TYPE_CHAR_V;
+    }
+    static void get(const MetaioRowElement& elt, std::string& value)
+    {
+        value.assign(elt.data.lstring.data, elt.data.lstring.len);
+    }
+};
+
+template <>
+struct Column<std::vector<unsigned char> > {
+    static bool binds(int type)
+    {
+        return type == METAIO_TYPE_BLOB || type == METAIO_TYPE_ILWD_CHAR_U;
+    }
+    static void get(const MetaioRowElement& elt,
+                    std::vector<unsigned char>& value)
+    {
+        value.assign(elt.data.blob.data, elt.data.blob.data + elt.data.blob.len);
+    }
+};
+
+/*
+ * How a member of type T is read from an element that may be null
+ */
+template <class T>
+struct Member {
+    static bool binds(int type) { return Column<T>::binds(type); }
+    static void get(const MetaioRowElement& elt, T& value)
+    {
+        if (elt.valid)
+            Column<T>::get(elt, value);
+        else
+            value = T();
+    }
+};
+
+template <class T>
+struct Member<std::optional<T> > {
+    static bool binds(int type) { return Column<T>::binds(type); }
+    static void get(const MetaioRowElement& elt, std::optional<T>& value)
+    {
+        if (elt.valid)
+            Column<T>::get(elt, value.emplace());
+        else
+            value.reset();
+    }
+};
+
+/*
+ * Frees a parse environment, abandoning any file left open.  The error
+ * message, which MetaioAbort() leaves for the caller, goes with it.
+ */
+struct Abort {
+    void operator()(MetaioParseEnvironment* env) const
+    {
+        MetaioAbort(env);
+        std::free(env->mierrmsg.data);
+        delete env;
+    }
+};
+
+} // namespace detail
+
+/*
+ * Reads the rows of one table into objects of type Row, which must be
+ * described by a specialization of RowTraits.  A Reader owns its parse
+ * environment and can be moved but not copied.
+ */
+template <class Row>
+class Reader {
+    typedef decltype(RowTraits<Row>::fields()) Fields;
+    static constexpr std::size_t N = std::tuple_size<Fields>::value;
+    typedef std::make_index_sequence<N> Indices;
+
+public:
+    class iterator;
+
+    /*
+     * Open filename and seek to the table named table, as by
+     * MetaioOpenFile() and MetaioOpenTableOnly(); an empty name means the
+     * first table in the file.  Throws Error if the file or the table
+     * cannot be read, if a column named by Row is missing, or if its type
+     * cannot be read into its member.
+     */
+    explicit Reader(const std::string& filename,
+                    const std::string& table = std::string())
+        : env_(new MetaioParseEnvironment()),
+          fields_(RowTraits<Row>::fields())
+    {
+        int ret;
+
+        if ((ret = MetaioOpenFile(env_.get(), filename.c_str())) != 0 ||
+            (ret = MetaioOpenTableOnly(env_.get(), table.c_str())) != 0)
+            fail(ret);
+        bind(Indices());
+    }
+
+    Reader(Reader&&) noexcept = default;
+    Reader& operator=(Reader&&) noexcept = default;
+
+    /*
+     * Read the next row into row.  Returns false at the end of the table,
+     * leaving row unchanged.
+     */
+    bool next(Row& row)
+    {
+        const int ret = MetaioGetRow(env_.get());
+
+        if (ret < 0)
+            fail(ret);
+        if (ret == 0)
+            return false;
+        decode(row, Indices());
+        return true;
+    }
+
+    /*
+     * Read up to rows.size() rows into rows.  Returns the number read,
+     * which is less than rows.size() only at the end of the table.
+     */
+    std::size_t read(span<Row> rows)
+    {
+        std::size_t n = 0;
+
+        while (n < rows.size() && next(rows[n]))
+            n++;
+        return n;
+    }
+
+    /*
+     * Parse the rest of the file and close it, as by MetaioClose(),
+     * reporting any error there.  Otherwise the file is abandoned when
+     * the reader is destroyed.
+     */
+    void close()
+    {
+        const int ret = MetaioClose(env_.get());
+
+        if (ret != 0)
+            fail(ret);
+    }
+
+    /* The parse environment, for anything not covered here */
+    MetaioParseEnv env() const noexcept { return env_.get(); }
+
+    /* The index in the table of the column read into the i-th field */
+    int column(std::size_t i) const { return index_[i]; }
+
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
+    /*
+     * Iterates over the remaining rows of the table.  Each step reads the
+     * next row into the iterator.
+     */
+    class iterator {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef Row value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const Row* pointer;
+        typedef const Row& reference;
+
+        iterator() = default;
+        explicit iterator(Reader* reader) : reader_(reader) { ++*this; }
+
+        reference operator*() const { return row_; }
+        pointer operator->() const { return &row_; }
+
+        iterator& operator++()
+        {
+            if (!reader_->next(row_))
+                reader_ = nullptr;
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        friend bool operator==(const iterator& a, const iterator& b)
+        {
+            return a.reader_ == b.reader_;
+        }
+        friend bool operator!=(const iterator& a, const iterator& b)
+        {
+            return a.reader_ != b.reader_;
+        }
+
+    private:
+        Reader* reader_ = nullptr;
+        Row row_ = Row();
+    };
+
+private:
+    [[noreturn]] void fail(int ret) const
+    {
+        const char* const msg = MetaioGetErrorMessage(env_.get());
+        throw Error(ret, msg ? msg : "metaio error");
+    }
+
+    template <std::size_t I>
+    void bind_column()
+    {
+        typedef typename std::remove_reference<
+            decltype(std::declval<Row&>().*(std::get<I>(fields_).member))>::type T;
+        const char* const name = std::get<I>(fields_).name;
+        const int icol = MetaioFindColumn(env_.get(), name);
+
+        if (icol < 0)
+            throw Error(-1, std::string("no column named \"") + name + "\"");
+        if (!detail::Member<T>::binds(env_->ligo_lw.table.col[icol].data_type))
+            throw Error(-1, std::string("column \"") + name + "\" of type " +
+                        MetaioTypeText(env_->ligo_lw.table.col[icol].data_type) +
+                        " cannot be read into its member");
+        index_[I] = icol;
+    }
+
+    template <std::size_t... I>
+    void bind(std::index_sequence<I...>)
+    {
+        const char* names[N + 1] = {std::get<I>(fields_).name..., nullptr};
+
+        (bind_column<I>(), ...);
+        if (const int ret = MetaioSelectColumns(env_.get(), names))
+            fail(ret);
+    }
+
+    template <std::size_t... I>
+    void decode(Row& row, std::index_sequence<I...>) const
+    {
+        const MetaioRowElement* const elt = env_->ligo_lw.table.elt;
+
+        (detail::Member<typename std::remove_reference<
+             decltype(row.*(std::get<I>(fields_).member))>::type>::
+             get(elt[index_[I]], row.*(std::get<I>(fields_).member)), ...);
+    }
+
+    std::unique_ptr<MetaioParseEnvironment, detail::Abort> env_;
+    Fields fields_;
+    int index_[N + 1] = {};
+};
+
+} // namespace metaio
+
+#endif /* _METAIO_HPP_ */
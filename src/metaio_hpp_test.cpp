@@ -0,0 +1,162 @@
+/*
+ * Checks the C++ interface in metaio.hpp against gdstrig10.xml, which has
+ * ten rows in its first table and a FILTER_ID column that is null in all of
+ * them.  Run by "make check" when configure finds a C++17 compiler.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <vector>
+#include "metaio.hpp"
+
+namespace {
+
+struct Trigger {
+    std::string ifo;
+    METAIO_INT_4S start_time;
+    std::optional<METAIO_REAL_4> significance;
+    std::optional<std::vector<unsigned char> > process_id;
+    std::optional<std::vector<unsigned char> > filter_id;
+};
+
+struct Missing {
+    METAIO_INT_4S start_time;
+    METAIO_REAL_8 snr;
+};
+
+struct Mismatch {
+    double start_time;
+};
+
+}
+
+METAIO_ROW(Trigger,
+           METAIO_FIELD(Trigger, ifo, "ifo"),
+           METAIO_FIELD(Trigger, start_time, "START_TIME"),
+           METAIO_FIELD(Trigger, significance, "significance"),
+           METAIO_FIELD(Trigger, process_id, "process_id"),
+           METAIO_FIELD(Trigger, filter_id, "filter_id"))
+
+METAIO_ROW(Missing,
+           METAIO_FIELD(Missing, start_time, "start_time"),
+           METAIO_FIELD(Missing, snr, "snr"))
+
+METAIO_ROW(Mismatch,
+           METAIO_FIELD(Mismatch, start_time, "start_time"))
+
+namespace {
+
+const std::size_t expected_rows = 10;
+
+/*
+ * Reads every row with a range-for loop, checking the values and the
+ * handling of null columns.  Returns the number of failures.
+ */
+int test_iterate(const std::string& filename)
+{
+    int fail = 0;
+    std::size_t n = 0;
+    metaio::Reader<Trigger> reader(filename, "row");
+
+    for (const Trigger& t : reader) {
+        if (t.ifo != "H2") {
+            std::fprintf(stderr, "FAIL: row %zu has ifo \"%s\"\n",
+                         n, t.ifo.c_str());
+            fail++;
+        }
+        if (n == 0 && t.start_time != 638834113) {
+            std::fprintf(stderr, "FAIL: row 0 has start_time %d\n",
+                         (int) t.start_time);
+            fail++;
+        }
+        if (!t.significance || !t.process_id || t.process_id->size() != 13) {
+            std::fprintf(stderr, "FAIL: row %zu is missing a non-null value\n",
+                         n);
+            fail++;
+        }
+        if (t.filter_id) {
+            std::fprintf(stderr, "FAIL: row %zu has a value for a null "
+                         "filter_id\n", n);
+            fail++;
+        }
+        n++;
+    }
+    if (n != expected_rows) {
+        std::fprintf(stderr, "FAIL: iterated over %zu rows, expected %zu\n",
+                     n, expected_rows);
+        fail++;
+    }
+    reader.close();
+    return fail;
+}
+
+/*
+ * Reads the rows in batches that do not divide the table evenly, and checks
+ * that they match the rows from a range-for loop.
+ */
+int test_read_span(const std::string& filename)
+{
+    int fail = 0;
+    std::vector<Trigger> all;
+    for (const Trigger& t : metaio::Reader<Trigger>(filename))
+        all.push_back(t);
+
+    metaio::Reader<Trigger> reader(filename);
+    std::vector<Trigger> batch(4);
+    std::size_t got, total = 0;
+
+    while ((got = reader.read(batch)) > 0) {
+        for (std::size_t i = 0; i < got && total + i < all.size(); i++)
+            if (batch[i].start_time != all[total + i].start_time) {
+                std::fprintf(stderr, "FAIL: batched row %zu differs\n",
+                             total + i);
+                fail++;
+            }
+        total += got;
+    }
+    if (total != expected_rows || all.size() != expected_rows) {
+        std::fprintf(stderr, "FAIL: read %zu rows in batches and %zu one at "
+                     "a time, expected %zu\n", total, all.size(),
+                     expected_rows);
+        fail++;
+    }
+    return fail;
+}
+
+/*
+ * Checks that a Reader throws metaio::Error when it cannot bind the columns
+ * of Row.
+ */
+template <class Row>
+int test_error(const std::string& filename, const char* what)
+{
+    try {
+        metaio::Reader<Row> reader(filename);
+    } catch (const metaio::Error&) {
+        return 0;
+    }
+    std::fprintf(stderr, "FAIL: no error for %s\n", what);
+    return 1;
+}
+
+}
+
+int main()
+{
+    const char* srcdir = std::getenv("srcdir");
+    const std::string filename =
+        std::string(srcdir ? srcdir : ".") + "/gdstrig10.xml";
+    int fail = 0;
+
+    try {
+        fail += test_iterate(filename);
+        fail += test_read_span(filename);
+        fail += test_error<Missing>(filename, "a missing column");
+        fail += test_error<Mismatch>(filename, "a column of the wrong type");
+    } catch (const metaio::Error& e) {
+        std::fprintf(stderr, "FAIL: %s\n", e.what());
+        fail++;
+    }
+    return fail ? 1 : 0;
+}
@@ -31,17 +31,23 @@ check_fail () {
 # because lwtcut can't write XML to stdout
 METAIO_TESTS_PIPE=/tmp/metaio_tests.pipe
 mkfifo $METAIO_TESTS_PIPE
+# because lwtscan -g writes its index beside the file
+METAIO_TESTS_GZ=/tmp/metaio_tests.xml.gz
+# because lwtdiff can't read XML from a pipe
+METAIO_TESTS_XML=/tmp/metaio_tests.xml
 
 echo "-- Basic tests"
 check_pass "./parse_test -q ${srcdir}/gdstrig10.xml"
 check_pass "./parse_test -q ${srcdir}/gdstrig5000.xml"
 check_pass "gunzip < ${srcdir}/glueligolw_sample.xml.gz | ./parse_test -q /dev/stdin"
+check_pass "./parse_test -q ${srcdir}/wide150.xml"
 check_pass "./parse_test_table_only -q ${srcdir}/gdstrig10.xml"
 check_pass "./parse_test_table_only -q ${srcdir}/gdstrig5000.xml"
 check_pass "./lwtcut ${srcdir}/gdstrig10.xml -o $METAIO_TESTS_PIPE & diff $METAIO_TESTS_PIPE ${srcdir}/gdstrig10.xml.lwtcut_output"
 check_pass "./lwtcut ${srcdir}/dmt_sample.xml -o $METAIO_TESTS_PIPE & diff $METAIO_TESTS_PIPE ${srcdir}/dmt_sample.xml.lwtcut_output"
 check_pass "gunzip < ${srcdir}/blobtest.xml.gz | ./lwtcut /dev/stdin -o $METAIO_TESTS_PIPE & diff $METAIO_TESTS_PIPE ${srcdir}/blobtest.xml.lwtcut_output"
 check_pass "./lwtdiff ${srcdir}/gdstrig10.xml ${srcdir}/gdstrig10.xml"
+check_pass "./lwtdiff ${srcdir}/wide150.xml ${srcdir}/wide150.xml"
 check_pass "./lwtprint ${srcdir}/gdstrig10.xml | diff - ${srcdir}/gdstrig10.xml.lwtprint_output"
 check_pass "./lwtscan ${srcdir}/gdstrig10.xml"
 check_pass "./lwtscan ${srcdir}/gdstrig10.xml -t row"
@@ -54,6 +60,7 @@ if test x${HAVE_LIBZ} = "xyes" ; then
   check_pass "./parse_test -q ${srcdir}/gdstrig5000.xml.gz"
   check_pass "./parse_test_table_only -q ${srcdir}/gdstrig10.xml"
   check_pass "./parse_test_table_only -q ${srcdir}/gdstrig5000.xml"
+  check_pass "./parse_test_table_only -q ${srcdir}/gdstrig5000.xml.gz"
   check_pass "./lwtcut ${srcdir}/gdstrig10.xml.gz -o $METAIO_TESTS_PIPE & diff $METAIO_TESTS_PIPE ${srcdir}/gdstrig10.xml.lwtcut_output"
   check_pass "gzip < ${srcdir}/dmt_sample.xml | ./lwtcut /dev/stdin -o $METAIO_TESTS_PIPE & diff $METAIO_TESTS_PIPE ${srcdir}/dmt_sample.xml.lwtcut_output"
   check_pass "./lwtcut ${srcdir}/blobtest.xml.gz -o $METAIO_TESTS_PIPE & diff $METAIO_TESTS_PIPE ${srcdir}/blobtest.xml.lwtcut_output"
@@ -64,6 +71,13 @@ if test x${HAVE_LIBZ} = "xyes" ; then
   check_pass "./lwtscan ${srcdir}/gdstrig10.xml.gz -t row"
   check_pass "./lwtscan ${srcdir}/gdstrig10.xml.gz -t row2"
   check_pass "./lwtscan ${srcdir}/gdstrig10.xml.gz -t row3"
+  check_pass "cp ${srcdir}/gdstrig5000.xml.gz $METAIO_TESTS_GZ && ./lwtscan $METAIO_TESTS_GZ -g && ./lwtscan $METAIO_TESTS_GZ -l | grep '^5000 rows$'"
+  check_pass "test -s $METAIO_TESTS_GZ.gzidx && ./parse_test_table_only -q -s $METAIO_TESTS_GZ"
+  check_pass "./lwtprint ${srcdir}/gdstrig5000.xml -r 2040-2050,4990- > $METAIO_TESTS_PIPE & ./lwtprint $METAIO_TESTS_GZ -r 2040-2050,4990- | diff - $METAIO_TESTS_PIPE"
+  check_pass "./lwtcut ${srcdir}/gdstrig5000.xml -o $METAIO_TESTS_GZ && gunzip -t $METAIO_TESTS_GZ && ./lwtdiff $METAIO_TESTS_GZ ${srcdir}/gdstrig5000.xml"
+  check_pass "./lwtcut ${srcdir}/dmt_sample.xml -o $METAIO_TESTS_XML -g && gunzip < $METAIO_TESTS_XML | diff - ${srcdir}/dmt_sample.xml.lwtcut_output && test -s $METAIO_TESTS_XML.gzidx"
+else
+  echo "-- Zlib compression tests skipped: built without zlib"
 fi
 
 echo "-- Specific tests"
@@ -72,6 +86,31 @@ check_pass "./lwtdiff ${srcdir}/gdstrig5000.xml ${srcdir}/gdstrig5000.xml -c STA
 check_pass "./lwtprint ${srcdir}/gdstrig5000.xml -r 8-12 -c IFO,START_TIME,FREQUENCY,SIZE -t row"
 check_pass "./lwtscan ${srcdir}/gdstrig5000.xml"
 check_pass "./lwtscan ${srcdir}/gdstrig5000.xml -t row"
+check_pass "./lwtscan ${srcdir}/gdstrig5000.xml -l | grep '^5000 rows$'"
+check_pass "./parse_test -b ${srcdir}/gdstrig5000.xml > $METAIO_TESTS_PIPE & ./parse_test ${srcdir}/gdstrig5000.xml | diff - $METAIO_TESTS_PIPE"
+check_pass "./parse_test -b ${srcdir}/dmt_sample.xml > $METAIO_TESTS_PIPE & ./parse_test ${srcdir}/dmt_sample.xml | diff - $METAIO_TESTS_PIPE"
+check_pass "./parse_test -p 4 ${srcdir}/gdstrig5000.xml > $METAIO_TESTS_PIPE & ./parse_test ${srcdir}/gdstrig5000.xml | diff - $METAIO_TESTS_PIPE"
+check_pass "./parse_test -p 2 ${srcdir}/wide150.xml > $METAIO_TESTS_PIPE & ./parse_test ${srcdir}/wide150.xml | diff - $METAIO_TESTS_PIPE"
+check_pass "./lwtprint ${srcdir}/gdstrig5000.xml -r 4990- > $METAIO_TESTS_PIPE & ./lwtprint ${srcdir}/gdstrig5000.xml | tail -n 11 | diff - $METAIO_TESTS_PIPE"
+check_pass "./lwtcut ${srcdir}/dmt_sample.xml -o $METAIO_TESTS_XML && ./lwtdiff $METAIO_TESTS_XML ${srcdir}/dmt_sample.xml"
+check_pass "./lwtcut ${srcdir}/wide150.xml -o $METAIO_TESTS_XML && ./lwtdiff $METAIO_TESTS_XML ${srcdir}/wide150.xml"
+# a number longer than any fixed buffer, spanning blocks of piped input
+awk 'BEGIN {
+  z = "0"; while (length(z) < 300000) z = z z
+  print "<?xml version=\"1.0\"?>"
+  print "<LIGO_LW>"
+  print "<Table Name=\"numbers:table\">"
+  print "<Column Name=\"x\" Type=\"real_8\"/>"
+  print "<Column Name=\"z\" Type=\"complex_16\"/>"
+  print "<Stream Name=\"numbers:table\" Type=\"Local\" Delimiter=\",\">"
+  print z "12.5," z "1+i" z "2,"
+  print "1,2+i3"
+  print "</Stream>"
+  print "</Table>"
+  print "</LIGO_LW>"
+}' > $METAIO_TESTS_XML
+check_pass "./lwtprint $METAIO_TESTS_XML > $METAIO_TESTS_PIPE & cat $METAIO_TESTS_XML | ./lwtprint /dev/stdin | diff - $METAIO_TESTS_PIPE"
+check_pass "cat $METAIO_TESTS_XML | ./lwtprint /dev/stdin | grep '^12.5,1+i2$'"
 
 
 echo "-- Failure tests"
@@ -87,7 +126,7 @@ check_fail "./lwtdiff ${srcdir}/gdstrig10.xml ${srcdir}/gdstrig10.xml -c NO_COLU
 check_fail "./lwtprint ${srcdir}/gdstrig10.xml -r foo-bar"
 
 
-rm -f $METAIO_TESTS_PIPE
+rm -f $METAIO_TESTS_PIPE $METAIO_TESTS_GZ $METAIO_TESTS_GZ.gzidx $METAIO_TESTS_XML $METAIO_TESTS_XML.gzidx
 
 if [ $OVERALL_PASS -eq 1 ]; then
   echo "PASS: All tests passed"
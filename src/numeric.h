@@ -0,0 +1,63 @@
+#ifndef _NUMERIC_H_
+#define _NUMERIC_H_
+/*
+ * Locale-independent conversion of the decimal numbers found in LIGO_LW
+ * streams, to and from binary.  The parsers work on a span of characters [s, end) that need
+ * not be null-terminated, so they can be applied directly to the parser's
+ * input buffer.
+ *
+ * Each parser skips leading white space, converts the longest prefix of
+ * the span that forms a number and sets *stop to the first character
+ * following it.  The return value is 0 on success, -1 if no number was
+ * found (in which case *stop is set to s), or 1 if an integer does not
+ * fit into the requested range.
+ */
+
+#include <stddef.h>
+
+/*
+ * Floating-point numbers are correctly rounded, i.e. the result is
+ * bit-for-bit identical to that of strtod() (resp. strtof()) in the "C"
+ * locale.  "inf", "nan" and hexadecimal forms are accepted as well.
+ */
+extern
+int numeric_parse_double(const char *s, const char *end, double *val,
+                         const char **stop);
+
+extern
+int numeric_parse_float(const char *s, const char *end, float *val,
+                        const char **stop);
+
+/*
+ * Signed integers must lie in [min, max].
+ */
+extern
+int numeric_parse_int(const char *s, const char *end, long long min,
+                      long long max, long long *val, const char **stop);
+
+/*
+ * Unsigned integers must not exceed max.  As with scanf("%u"), a leading
+ * minus sign negates the value in unsigned arithmetic.
+ */
+extern
+int numeric_parse_uint(const char *s, const char *end,
+                       unsigned long long max, unsigned long long *val,
+                       const char **stop);
+
+/*
+ * Formatting of floating-point numbers with the fewest significant digits
+ * that the parsers above convert back to the same value.  The text looks
+ * like that of printf("%.17g") (resp. "%.9g"), including "inf" and "nan",
+ * but without the digits that are not needed:  0.1 is written "0.1" rather
+ * than "0.10000000000000001".  buf must have room for NUMERIC_FORMAT_MAX
+ * characters.  The text is null-terminated and its length returned.
+ */
+#define NUMERIC_FORMAT_MAX 32
+
+extern
+int numeric_format_double(double val, char *buf);
+
+extern
+int numeric_format_float(float val, char *buf);
+
+#endif /* _NUMERIC_H_ */
@@ -6,18 +6,151 @@
 const char* const default_filename = "gdstrig10.xml";
 
 int quiet_mode = 0;
+int batch_mode = 0;
+int nthreads = 0;
 
 void
 print_help()
 {
     fprintf(stderr,
-	    "Usage: parse_test [ -h ] [ -q ] [ file ]\n"
+	    "Usage: parse_test [ -h ] [ -q ] [ -b | -p threads ] [ file ]\n"
 	    "Options:\n"
 	    "  -h   : print this message\n"
 	    "  -q   : don't print rows\n"
+	    "  -b   : read rows in batches with MetaioGetRows()\n"
+	    "  -p   : read rows with MetaioGetRowsParallel() in this many threads\n"
 	    "  file : filename (default filename is %s)\n", default_filename);
 }
 
+void
+print_row(MetaioParseEnv env, const struct MetaioRowElement *elt, int count)
+{
+    int i;
+
+    printf("ROW %d:\n", count);
+    for (i = 0; i < env->ligo_lw.table.numcols; i++)
+    {
+	printf("  Name = <%s> Type = <%s> Data = <", 
+	       env->ligo_lw.table.col[i].name,
+	       MetaioTypeText(env->ligo_lw.table.col[i].data_type));
+	MetaioFprintElement(stdout, &elt[i]);
+	printf(">\n");
+    }
+    printf("---------------------------------------------------------"
+	   "----------------------\n");
+}
+
+/*
+ * Rebuild the row elements from one row of a batch and print them like
+ * print_row()
+ */
+void
+print_batch_row(MetaioParseEnv env, const struct MetaioRowBatch *batch,
+		size_t row, int count)
+{
+    struct MetaioRowElement *elt = calloc(batch->numcols + 1, sizeof(*elt));
+    char **copies = calloc(batch->numcols + 1, sizeof(*copies));
+    int i;
+
+    if (!elt || !copies)
+    {
+	fprintf(stderr, "out of memory\n");
+	exit(1);
+    }
+
+    for (i = 0; i < batch->numcols; i++)
+    {
+	const struct MetaioColumnData *cd = &batch->col[i];
+	const size_t *offset = cd->values;
+	size_t len;
+
+	elt[i].col = &env->ligo_lw.table.col[i];
+	elt[i].valid = METAIO_BATCH_VALID(cd, row);
+	copies[i] = NULL;
+
+	switch (cd->data_type)
+	{
+	case METAIO_TYPE_REAL_4:
+	    elt[i].data.real_4 = ((METAIO_REAL_4 *) cd->values)[row];
+	    break;
+	case METAIO_TYPE_REAL_8:
+	    elt[i].data.real_8 = ((METAIO_REAL_8 *) cd->values)[row];
+	    break;
+	case METAIO_TYPE_INT_4S:
+	    elt[i].data.int_4s = ((METAIO_INT_4S *) cd->values)[row];
+	    break;
+	case METAIO_TYPE_INT_4U:
+	    elt[i].data.int_4u = ((METAIO_INT_4U *) cd->values)[row];
+	    break;
+	case METAIO_TYPE_INT_2S:
+	    elt[i].data.int_2s = ((METAIO_INT_2S *) cd->values)[row];
+	    break;
+	case METAIO_TYPE_INT_2U:
+	    elt[i].data.int_2u = ((METAIO_INT_2U *) cd->values)[row];
+	    break;
+	case METAIO_TYPE_INT_8S:
+	    elt[i].data.int_8s = ((METAIO_INT_8S *) cd->values)[row];
+	    break;
+	case METAIO_TYPE_INT_8U:
+	    elt[i].data.int_8u = ((METAIO_INT_8U *) cd->values)[row];
+	    break;
+	case METAIO_TYPE_COMPLEX_8:
+	    elt[i].data.complex_8 = ((METAIO_COMPLEX_8 *) cd->values)[row];
+	    break;
+	case METAIO_TYPE_COMPLEX_16:
+	    elt[i].data.complex_16 = ((METAIO_COMPLEX_16 *) cd->values)[row];
+	    break;
+	default:
+	    /* Strings and blobs:  make a null-terminated copy */
+	    len = offset[row + 1] - offset[row];
+	    copies[i] = malloc(len + 1);
+	    memcpy(copies[i], cd->heap + offset[row], len);
+	    copies[i][len] = '\0';
+	    if (cd->data_type == METAIO_TYPE_BLOB ||
+		cd->data_type == METAIO_TYPE_ILWD_CHAR_U)
+	    {
+		elt[i].data.blob.data = (METAIO_CHAR_U *) copies[i];
+		elt[i].data.blob.len = len;
+		elt[i].data.blob.datasize = len + 1;
+	    }
+	    else
+	    {
+		elt[i].data.lstring.data = copies[i];
+		elt[i].data.lstring.len = len;
+		elt[i].data.lstring.datasize = len + 1;
+	    }
+	    break;
+	}
+    }
+
+    print_row(env, elt, count);
+
+    for (i = 0; i < batch->numcols; i++)
+	free(copies[i]);
+    free(copies);
+    free(elt);
+}
+
+/*
+ * Handler for MetaioGetRowsParallel()
+ */
+int
+print_batch(const struct MetaioRowBatch *batch, void *data)
+{
+    MetaioParseEnv env = data;
+    static int count = 0;
+    size_t row;
+
+    for (row = 0; row < batch->nrows; row++)
+    {
+	count++;
+	if (quiet_mode == 0)
+	    print_batch_row(env, batch, row, count);
+    }
+
+    return 0;
+}
+
 int
 main(int argc, char** argv)
 {
@@ -30,7 +163,7 @@ main(int argc, char** argv)
     int i = 0;
     int ret = 0;
 
-    if (argc > 3)
+    if (argc > 5)
     {
 	fprintf(stderr, "too many options\n");
 	print_help();
@@ -45,6 +178,14 @@ main(int argc, char** argv)
 	    {
 		quiet_mode = 1;
 	    }
+	    else if (strcmp(argv[i], "-b") == 0)
+	    {
+		batch_mode = 1;
+	    }
+	    else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+	    {
+		nthreads = atoi(argv[++i]);
+	    }
 	    else if (strcmp(argv[i], "-h") == 0)
 	    {
 		print_help();
@@ -70,29 +211,58 @@ main(int argc, char** argv)
 	exit(ret);
     }
   
-    while ((ret = MetaioGetRow(env)) > 0)
+    if (nthreads > 0)
     {
-	count++;
-	if (quiet_mode == 0)
+	if ((ret = MetaioGetRowsParallel(env, nthreads, 7, print_batch, env)) != 0)
+	{
+	    fprintf(stderr, "Error from MetaioGetRowsParallel(): %s\n", env->mierrmsg.data);
+	    exit(ret);
+	}
+    }
+    else if (batch_mode)
+    {
+	struct MetaioRowBatch batch;
+
+	if (MetaioInitRowBatch(env, &batch, 7) != 0)
+	{
+	    fprintf(stderr, "Error from MetaioInitRowBatch()\n");
+	    exit(1);
+	}
+
+	while ((ret = MetaioGetRows(env, &batch)) > 0)
 	{
-	    printf("ROW %d:\n", count);
-	    for (i = 0; i < env->ligo_lw.table.numcols; i++)
+	    size_t row;
+
+	    for (row = 0; row < batch.nrows; row++)
 	    {
-		printf("  Name = <%s> Type = <%s> Data = <", 
-		       env->ligo_lw.table.col[i].name,
-		       MetaioTypeText(env->ligo_lw.table.col[i].data_type));
-		MetaioFprintElement(stdout, &env->ligo_lw.table.elt[i]);
-		printf(">\n");
+		count++;
+		if (quiet_mode == 0)
+		    print_batch_row(env, &batch, row, count);
 	    }
-	    printf("---------------------------------------------------------"
-		   "----------------------\n");
 	}
-    }
 
-    if (ret < 0)
+	MetaioFreeRowBatch(&batch);
+
+	if (ret < 0)
+	{
+	    fprintf(stderr, "Error from MetaioGetRows(): %s\n", env->mierrmsg.data);
+	    exit(ret);
+	}
+    }
+    else
     {
-	fprintf(stderr, "Error from MetaioGetRow(): %s\n", env->mierrmsg.data);
-	exit(ret);
+	while ((ret = MetaioGetRow(env)) > 0)
+	{
+	    count++;
+	    if (quiet_mode == 0)
+		print_row(env, env->ligo_lw.table.elt, count);
+	}
+
+	if (ret < 0)
+	{
+	    fprintf(stderr, "Error from MetaioGetRow(): %s\n", env->mierrmsg.data);
+	    exit(ret);
+	}
     }
 
     ret = MetaioClose(env);
@@ -1,44 +1,34 @@
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "metaio.h"
 
 int quiet_mode = 0;
+int seek_mode = 0;
 
 void
 print_help()
 {
     fprintf(stderr,
-	    "Usage: parse_test_table_only [ -h ] [ -q ] filename\n"
+	    "Usage: parse_test_table_only [ -h ] [ -q ] [ -s ] filename\n"
 	    "Options:\n"
 	    "  -h   : print this message\n"
-	    "  -q   : don't print rows\n");
+	    "  -q   : don't print rows\n"
+	    "  -s   : test seeking, on a file with the rows of gdstrig5000.xml\n");
 }
 
+/*
+ * Read the rest of the rows of the current table, printing them unless in
+ * quiet mode.  Returns the number of rows read, or -1 if there was an error.
+ */
 int
-test_table(const char* const filename, const char* const tablename)
+read_rows(MetaioParseEnv const env)
 {
-    struct MetaioParseEnvironment parseEnvironment;
-    MetaioParseEnv const env = &parseEnvironment;
-    int fail = 0;
     int ret = 0;
     int count = 0;
     int i = 0;
 
-    if ((ret = MetaioOpenFile(env, filename)) != 0)
-    {
-	fprintf(stderr, "FAIL: %s\n", env->mierrmsg.data);
-        fail = 1;
-        return fail;
-    }
-
-    if ((ret = MetaioOpenTableOnly(env, tablename)) != 0)
-    {
-	fprintf(stderr, "FAIL: %s\n", env->mierrmsg.data);
-        fail = 1;
-        return fail;
-    }
-
     while ((ret = MetaioGetRow(env)) > 0)
     {
 	count++;
@@ -58,7 +48,32 @@ test_table(const char* const filename, const char* const tablename)
 	}
     }
 
-    if (ret < 0)
+    return ret < 0 ? -1 : count;
+}
+
+int
+test_table(const char* const filename, const char* const tablename)
+{
+    struct MetaioParseEnvironment parseEnvironment;
+    MetaioParseEnv const env = &parseEnvironment;
+    int fail = 0;
+    int ret = 0;
+
+    if ((ret = MetaioOpenFile(env, filename)) != 0)
+    {
+	fprintf(stderr, "FAIL: %s\n", env->mierrmsg.data);
+        fail = 1;
+        return fail;
+    }
+
+    if ((ret = MetaioOpenTableOnly(env, tablename)) != 0)
+    {
+	fprintf(stderr, "FAIL: %s\n", env->mierrmsg.data);
+        fail = 1;
+        return fail;
+    }
+
+    if (read_rows(env) < 0)
     {
 	/* Error from MetaioGetRow() */
 	fprintf(stderr, "FAIL: %s\n", env->mierrmsg.data);
@@ -117,6 +132,412 @@ test_no_table(const char* const filename, const char* const tablename)
     return fail;
 }
 
+/*
+ * Read the tables of gdstrig10.xml in one pass:  part of "row", all of
+ * "row2", then skip straight to "row3", after which there are no more
+ */
+int
+test_next_table(const char* const filename)
+{
+    struct MetaioParseEnvironment parseEnvironment;
+    MetaioParseEnv const env = &parseEnvironment;
+    int ret = 0;
+
+    if ((ret = MetaioOpenTable(env, filename, "row")) != 0 ||
+        (ret = MetaioGetRow(env)) != 1 ||
+        (ret = MetaioNextTable(env, NULL)) != 0 ||
+        strcmp(env->ligo_lw.table.name, "ldasgroup:row2:table") != 0 ||
+        read_rows(env) < 0 ||
+        (ret = MetaioNextTable(env, "row3")) != 0 ||
+        strcmp(env->ligo_lw.table.name, "ldasgroup:row3:table") != 0 ||
+        read_rows(env) < 0 ||
+        (ret = MetaioNextTable(env, NULL)) != 1 ||
+        (ret = MetaioClose(env)) != 0)
+    {
+	fprintf(stderr, "FAIL: reading successive tables: %s\n",
+		env->mierrmsg.data ? env->mierrmsg.data : "wrong table");
+	MetaioAbort(env);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Copy the tables of gdstrig10.xml into one new document in a single pass,
+ * with an empty table after them, and check that the copy reads back with
+ * the same tables and rows
+ */
+int
+test_write_tables(const char* const filename)
+{
+    struct MetaioParseEnvironment inEnvironment, outEnvironment;
+    MetaioParseEnv const in = &inEnvironment;
+    MetaioParseEnv const out = &outEnvironment;
+    const char* const outname = "parse_test_tables.xml";
+    int ntables = 0;
+    int fail = 0;
+    int ret = 0;
+    int i = 0;
+
+    if ((ret = MetaioOpenTable(in, filename, NULL)) != 0 ||
+        (ret = MetaioCreate(out, outname)) != 0)
+    {
+	fprintf(stderr, "FAIL: opening %s and %s\n", filename, outname);
+	MetaioAbort(in);
+	return 1;
+    }
+    do
+    {
+	MetaioCopyEnv(out, in);
+	fail |= MetaioBeginTable(out);
+	while ((ret = MetaioGetRow(in)) > 0)
+	{
+	    MetaioCopyRow(out, in);
+	    fail |= MetaioPutRow(out);
+	}
+	fail |= ret < 0 || MetaioEndTable(out) != 0;
+	ntables++;
+    }
+    while ((ret = MetaioNextTable(in, NULL)) == 0);
+    fail |= ret != 1 || MetaioBeginTable(out) != 0;
+    fail |= MetaioClose(in) != 0 || MetaioClose(out) != 0;
+
+    /* Read the original and the copy side by side */
+    if (fail ||
+        (ret = MetaioOpenTable(in, filename, NULL)) != 0 ||
+        (ret = MetaioOpenTable(out, outname, NULL)) != 0)
+    {
+	fprintf(stderr, "FAIL: writing the tables of %s to %s\n", filename, outname);
+	MetaioAbort(in);
+	remove(outname);
+	return 1;
+    }
+    do
+    {
+	fail |= strcmp(in->ligo_lw.table.name, out->ligo_lw.table.name) != 0 ||
+	    in->ligo_lw.table.numcols != out->ligo_lw.table.numcols;
+	while (!fail && (ret = MetaioGetRow(in)) > 0)
+	{
+	    fail |= MetaioGetRow(out) != 1;
+	    for (i = 0; !fail && i < in->ligo_lw.table.numcols; i++)
+		fail |= MetaioCompareElements(&in->ligo_lw.table.elt[i],
+					      &out->ligo_lw.table.elt[i]) != 0;
+	}
+	fail |= ret < 0 || MetaioGetRow(out) != 0;
+	ntables--;
+    }
+    while (!fail && (ret = MetaioNextTable(in, NULL)) == 0 &&
+           (ret = MetaioNextTable(out, NULL)) == 0);
+
+    /* The empty table is last */
+    fail |= ntables != 0 || ret != 1 ||
+	MetaioNextTable(out, NULL) != 0 || MetaioGetRow(out) != 0 ||
+	MetaioNextTable(out, NULL) != 1;
+    if (fail)
+	fprintf(stderr, "FAIL: reading back the tables of %s from %s\n",
+		filename, outname);
+    MetaioAbort(in);
+    MetaioAbort(out);
+    remove(outname);
+
+    return fail;
+}
+
+/*
+ * Read filename several times through one environment with MetaioReopen(),
+ * abandoning it part way through once, and check that each pass reads the
+ * same rows as the first
+ */
+int
+test_reopen(const char* const filename)
+{
+    struct MetaioParseEnvironment parseEnvironment;
+    MetaioParseEnv const env = &parseEnvironment;
+    int count = 0;
+    int ret = 0;
+
+    if ((ret = MetaioOpen(env, filename)) != 0 ||
+        (count = read_rows(env)) < 0 ||
+        (ret = MetaioReset(env)) != 0 ||
+        (ret = MetaioReopen(env, filename)) != 0 ||
+        (ret = MetaioGetRow(env)) != 1 ||
+        (ret = MetaioReopen(env, filename)) != 0 ||
+        read_rows(env) != count ||
+        (ret = MetaioReset(env)) != 0 ||
+        (ret = MetaioReopen(env, "doesntexist.xml")) == 0 ||
+        MetaioGetErrorMessage(env) == NULL ||
+        (ret = MetaioReopen(env, filename)) != 0 ||
+        MetaioGetErrorMessage(env) != NULL ||
+        read_rows(env) != count ||
+        (ret = MetaioClose(env)) != 0)
+    {
+	fprintf(stderr, "FAIL: reopening %s: %s\n", filename,
+		env->mierrmsg.data ? env->mierrmsg.data : "wrong rows");
+	MetaioAbort(env);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Allocator for test_allocator() that counts the blocks outstanding
+ */
+void *
+counting_alloc(size_t size, void *data)
+{
+    ++*(int *) data;
+    return malloc(size);
+}
+
+void
+counting_free(void *ptr, void *data)
+{
+    --*(int *) data;
+    free(ptr);
+}
+
+/*
+ * Read filename with the header strings in memory from a user-supplied
+ * allocator, and check that it gets back everything it gave out
+ */
+int
+test_allocator(const char* const filename)
+{
+    struct MetaioParseEnvironment parseEnvironment;
+    MetaioParseEnv const env = &parseEnvironment;
+    int outstanding = 0;
+    int used = 0;
+    int ret = 0;
+
+    MetaioSetAllocator(counting_alloc, counting_free, &outstanding);
+    if ((ret = MetaioOpen(env, filename)) == 0)
+    {
+	used = outstanding;
+	if (read_rows(env) < 0)
+	    ret = 1;
+	ret |= MetaioClose(env);
+    }
+    MetaioSetAllocator(NULL, NULL, NULL);
+
+    if (ret != 0 || used == 0 || outstanding != 0)
+    {
+	fprintf(stderr, "FAIL: allocator used for %d blocks, %d not freed\n",
+		used, outstanding);
+	return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Look up every column of filename by its name in upper case, and match
+ * the columns against themselves
+ */
+int
+test_find_columns(const char* const filename)
+{
+    struct MetaioParseEnvironment parseEnvironment;
+    MetaioParseEnv const env = &parseEnvironment;
+    char name[256];
+    int *match = NULL;
+    int fail = 0;
+    int icol = 0;
+    int j = 0;
+
+    if (MetaioOpen(env, filename) != 0)
+    {
+	fprintf(stderr, "FAIL: opening %s: %s\n", filename, env->mierrmsg.data);
+	MetaioAbort(env);
+	return 1;
+    }
+
+    for (icol = 0; icol < env->ligo_lw.table.numcols; icol++)
+    {
+	const char *cptr = MetaioColumnName(env, icol);
+
+	for (j = 0; cptr[j] && j < (int) sizeof(name) - 1; j++)
+	    name[j] = toupper((unsigned char) cptr[j]);
+	name[j] = '\0';
+	if (MetaioFindColumn(env, name) != icol)
+	{
+	    fprintf(stderr, "FAIL: column %s not found at %d\n", name, icol);
+	    fail = 1;
+	}
+    }
+    if (MetaioFindColumn(env, "no_such_column") != -1)
+    {
+	fprintf(stderr, "FAIL: found a column that does not exist\n");
+	fail = 1;
+    }
+
+    match = malloc((env->ligo_lw.table.numcols + 1) * sizeof(*match));
+    if (!match ||
+	MetaioMatchColumns(env, env, match) != env->ligo_lw.table.numcols)
+    {
+	fprintf(stderr, "FAIL: matching the columns of %s\n", filename);
+	fail = 1;
+    }
+    for (icol = 0; match && icol < env->ligo_lw.table.numcols; icol++)
+	if (match[icol] != icol)
+	{
+	    fprintf(stderr, "FAIL: column %d matched %d\n", icol, match[icol]);
+	    fail = 1;
+	}
+    free(match);
+
+    MetaioClose(env);
+    return fail;
+}
+
+/*
+ * List gdstrig5000.xml, or a copy of it, with MetaioReadDirectory(), then
+ * seek forwards and backwards across the rows whose positions it records
+ * (every 1024th), and check that each row reached is the one found by
+ * reading the table from the start.  A compressed copy with a saved index
+ * is listed from the index, and seeks through it
+ */
+int
+test_seek_rows(const char* const filename)
+{
+    static const int rows[] = { 3000, 1030, 4999, 0, 2048, 1023, 1024, 4096 };
+    struct MetaioParseEnvironment parseEnvironment;
+    struct MetaioParseEnvironment serialEnvironment;
+    MetaioParseEnv const env = &parseEnvironment;
+    MetaioParseEnv const serial = &serialEnvironment;
+    const struct MetaioDirectory *dir = NULL;
+    int fail = 0;
+    int i = 0;
+    int n = 0;
+    int icol = 0;
+
+    if (MetaioOpenFile(env, filename) != 0 ||
+	MetaioReadDirectory(env, &dir) != 0 ||
+	MetaioOpenTableOnly(env, "row") != 0)
+    {
+	fprintf(stderr, "FAIL: listing %s: %s\n", filename, env->mierrmsg.data);
+	MetaioAbort(env);
+	return 1;
+    }
+
+    for (i = 0; i < (int) (sizeof(rows) / sizeof(rows[0])) && !fail; i++)
+    {
+	if (MetaioSeekRow(env, rows[i]) != 0 || env->file->nrows != rows[i] ||
+	    MetaioGetRow(env) != 1)
+	{
+	    fprintf(stderr, "FAIL: seeking to row %d: %s\n", rows[i],
+		    env->mierrmsg.data ? env->mierrmsg.data : "wrong row");
+	    fail = 1;
+	    break;
+	}
+
+	if (MetaioOpenFile(serial, filename) != 0 ||
+	    MetaioOpenTableOnly(serial, "row") != 0)
+	{
+	    fprintf(stderr, "FAIL: %s\n", serial->mierrmsg.data);
+	    MetaioAbort(serial);
+	    fail = 1;
+	    break;
+	}
+	for (n = 0; n <= rows[i]; n++)
+	    if (MetaioGetRow(serial) != 1)
+		break;
+	if (n <= rows[i] ||
+	    serial->ligo_lw.table.numcols != env->ligo_lw.table.numcols)
+	    fail = 1;
+	for (icol = 0; !fail && icol < env->ligo_lw.table.numcols; icol++)
+	    if (MetaioCompareElements(&env->ligo_lw.table.elt[icol],
+				      &serial->ligo_lw.table.elt[icol]) != 0)
+		fail = 1;
+	if (fail)
+	    fprintf(stderr, "FAIL: row %d differs after seeking\n", rows[i]);
+	MetaioAbort(serial);
+    }
+
+    MetaioAbort(env);
+    return fail;
+}
+
+/*
+ * Copy the rows of gdstrig5000.xml into a file written by several threads
+ * with MetaioCreateCompressed(), in more blocks than there are threads,
+ * check that the copy reads back with the same rows, and seek through the
+ * index saved beside it
+ */
+int
+test_write_compressed(const char* const filename)
+{
+    static const struct MetaioCompression options = { 1, 3, 1 };
+    struct MetaioParseEnvironment inEnvironment, outEnvironment;
+    MetaioParseEnv const in = &inEnvironment;
+    MetaioParseEnv const out = &outEnvironment;
+    const char* const outname = "parse_test_compressed.xml.gz";
+    const char* const indexname = "parse_test_compressed.xml.gz.gzidx";
+    FILE* fp = NULL;
+    int nrows = 0;
+    int fail = 0;
+    int ret = 0;
+    int i = 0;
+
+    if ((ret = MetaioOpenTable(in, filename, "row")) != 0 ||
+        (ret = MetaioCreateCompressed(out, outname, &options)) != 0)
+    {
+	fprintf(stderr, "FAIL: opening %s and %s\n", filename, outname);
+	MetaioAbort(in);
+	return 1;
+    }
+    MetaioCopyEnv(out, in);
+    while ((ret = MetaioGetRow(in)) > 0)
+    {
+	MetaioCopyRow(out, in);
+	fail |= MetaioPutRow(out);
+	nrows++;
+    }
+    fail |= ret < 0 || MetaioClose(in) != 0 || MetaioClose(out) != 0;
+    if (!fail && (fp = fopen(indexname, "rb")) == NULL)
+    {
+	fprintf(stderr, "FAIL: no index %s\n", indexname);
+	fail = 1;
+    }
+    if (fp)
+	fclose(fp);
+
+    /* Read the original and the copy side by side */
+    if (fail ||
+        (ret = MetaioOpenTable(in, filename, "row")) != 0 ||
+        (ret = MetaioOpenTable(out, outname, "row")) != 0)
+    {
+	fprintf(stderr, "FAIL: writing the rows of %s to %s\n", filename, outname);
+	MetaioAbort(in);
+	remove(outname);
+	remove(indexname);
+	return 1;
+    }
+    fail |= in->ligo_lw.table.numcols != out->ligo_lw.table.numcols;
+    while (!fail && (ret = MetaioGetRow(in)) > 0)
+    {
+	fail |= MetaioGetRow(out) != 1;
+	for (i = 0; !fail && i < in->ligo_lw.table.numcols; i++)
+	    fail |= MetaioCompareElements(&in->ligo_lw.table.elt[i],
+					  &out->ligo_lw.table.elt[i]) != 0;
+	nrows--;
+    }
+    fail |= ret < 0 || nrows != 0 || MetaioGetRow(out) != 0;
+    if (fail)
+	fprintf(stderr, "FAIL: reading back the rows of %s from %s\n",
+		filename, outname);
+    MetaioAbort(in);
+    MetaioAbort(out);
+
+    if (!fail)
+	fail = test_seek_rows(outname);
+    remove(outname);
+    remove(indexname);
+
+    return fail;
+}
+
 int
 main(int argc, char** argv)
 {
@@ -138,6 +559,10 @@ main(int argc, char** argv)
         {
             quiet_mode = 1;
         }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            seek_mode = 1;
+        }
         else if (strcmp(argv[i], "-h") == 0)
         {
             print_help();
@@ -157,7 +582,16 @@ main(int argc, char** argv)
         {
         fail |= test_table(argv[i], "row2");
         fail |= test_table(argv[i], "row3");
+        fail |= test_next_table(argv[i]);
+        fail |= test_write_tables(argv[i]);
         }
+    if(seek_mode || strstr(argv[i], "gdstrig5000.xml"))
+        fail |= test_seek_rows(argv[i]);
+    if(strstr(argv[i], "gdstrig5000.xml.gz"))
+        fail |= test_write_compressed(argv[i]);
+    fail |= test_reopen(argv[i]);
+    fail |= test_allocator(argv[i]);
+    fail |= test_find_columns(argv[i]);
     fail |= test_no_table(argv[i], "faketable");
 
     return fail;
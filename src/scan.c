@@ -0,0 +1,225 @@
+/*
+ * Vectorized character classification for the row parser.
+ *
+ * Each vector of input is compared against every character of interest
+ * at once and the comparison results are collapsed into a bit mask, whose
+ * lowest set bit gives the position of the first match.  The AVX2 code is
+ * compiled with a function-specific target attribute so that the library
+ * as a whole still runs on processors that only have SSE2; the variant to
+ * use is chosen the first time either function is called.
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "scan.h"
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Portable versions
+ */
+
+static inline
+int is_space(char c)
+{
+    return c == ' ' || (unsigned char) (c - '\t') <= '\r' - '\t';
+}
+
+static
+const char *find_scalar(const char *p, const char *end, const char *set, int n)
+{
+    int i;
+
+    for(; p < end; p++)
+        for(i = 0; i < n; i++)
+            if(*p == set[i])
+                return p;
+
+    return end;
+}
+
+static
+const char *skip_space_scalar(const char *p, const char *end)
+{
+    while(p < end && is_space(*p))
+        p++;
+    return p;
+}
+
+#ifdef SCAN_X86
+
+/*
+ * SSE2 versions, 16 bytes at a time
+ */
+
+static
+const char *find_sse2(const char *p, const char *end, const char *set, int n)
+{
+    __m128i v[SCAN_MAX_SET];
+    int i;
+
+    for(i = 0; i < n; i++)
+        v[i] = _mm_set1_epi8(set[i]);
+
+    for(; end - p >= 16; p += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *) p);
+        __m128i hit = _mm_cmpeq_epi8(x, v[0]);
+        unsigned mask;
+
+        for(i = 1; i < n; i++)
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, v[i]));
+        mask = _mm_movemask_epi8(hit);
+        if(mask)
+            return p + __builtin_ctz(mask);
+    }
+
+    return find_scalar(p, end, set, n);
+}
+
+static
+const char *skip_space_sse2(const char *p, const char *end)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i span = _mm_set1_epi8('\r' - '\t');
+
+    for(; end - p >= 16; p += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *) p);
+        /* '\t' through '\r' are contiguous:  x - '\t' <= 4 (unsigned) */
+        __m128i t = _mm_sub_epi8(x, tab);
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(x, space),
+                                  _mm_cmpeq_epi8(_mm_min_epu8(t, span), t));
+        unsigned mask = ~_mm_movemask_epi8(ws) & 0xFFFF;
+
+        if(mask)
+            return p + __builtin_ctz(mask);
+    }
+
+    return skip_space_scalar(p, end);
+}
+
+/*
+ * AVX2 versions, 32 bytes at a time
+ */
+
+__attribute__((target("avx2")))
+static
+const char *find_avx2(const char *p, const char *end, const char *set, int n)
+{
+    __m256i v[SCAN_MAX_SET];
+    int i;
+
+    for(i = 0; i < n; i++)
+        v[i] = _mm256_set1_epi8(set[i]);
+
+    for(; end - p >= 32; p += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *) p);
+        __m256i hit = _mm256_cmpeq_epi8(x, v[0]);
+        unsigned mask;
+
+        for(i = 1; i < n; i++)
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, v[i]));
+        mask = _mm256_movemask_epi8(hit);
+        if(mask)
+            return p + __builtin_ctz(mask);
+    }
+
+    return find_sse2(p, end, set, n);
+}
+
+__attribute__((target("avx2")))
+static
+const char *skip_space_avx2(const char *p, const char *end)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i span = _mm256_set1_epi8('\r' - '\t');
+
+    for(; end - p >= 32; p += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *) p);
+        __m256i t = _mm256_sub_epi8(x, tab);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(x, space),
+                                     _mm256_cmpeq_epi8(_mm256_min_epu8(t, span), t));
+        unsigned mask = ~(unsigned) _mm256_movemask_epi8(ws);
+
+        if(mask)
+            return p + __builtin_ctz(mask);
+    }
+
+    return skip_space_sse2(p, end);
+}
+
+#endif /* SCAN_X86 */
+
+/*
+ * Run-time selection of the implementation
+ */
+
+static const char *find_init(const char *p, const char *end, const char *set, int n);
+static const char *skip_space_init(const char *p, const char *end);
+
+static const char *(*find_impl)(const char *, const char *, const char *, int) = find_init;
+static const char *(*skip_space_impl)(const char *, const char *) = skip_space_init;
+
+static
+void select_impl(void)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+    {
+        find_impl = find_avx2;
+        skip_space_impl = skip_space_avx2;
+    }
+    else
+    {
+        find_impl = find_sse2;
+        skip_space_impl = skip_space_sse2;
+    }
+#else
+    find_impl = find_scalar;
+    skip_space_impl = skip_space_scalar;
+#endif
+}
+
+static
+const char *find_init(const char *p, const char *end, const char *set, int n)
+{
+    select_impl();
+    return find_impl(p, end, set, n);
+}
+
+static
+const char *skip_space_init(const char *p, const char *end)
+{
+    select_impl();
+    return skip_space_impl(p, end);
+}
+
+const char *scan_find(const char *p, const char *end, const char *set, int n)
+{
+    /* The C library's memchr() is already vectorized, but p may be a null
+     * pointer when there is nothing to search */
+    if(n == 1)
+    {
+        if(p == end)
+            return end;
+        const char *q = memchr(p, set[0], end - p);
+        return q ? q : end;
+    }
+
+    return find_impl(p, end, set, n);
+}
+
+const char *scan_skip_space(const char *p, const char *end)
+{
+    return skip_space_impl(p, end);
+}
@@ -0,0 +1,36 @@
+#ifndef _SCAN_H_
+#define _SCAN_H_
+/*
+ * Vectorized character classification for the row parser.  Both functions
+ * work on a span of characters [p, end) that need not be null-terminated
+ * and never read outside of it.
+ *
+ * On x86 processors the span is examined 16 bytes at a time with SSE2, or
+ * 32 bytes at a time with AVX2 when the processor supports it (this is
+ * determined at run time).  Elsewhere a portable scalar loop is used.
+ */
+
+#include <stddef.h>
+
+/*
+ * Maximum number of characters in the set passed to scan_find()
+ */
+#define SCAN_MAX_SET 8
+
+/*
+ * Return a pointer to the first character in [p, end) that is one of the
+ * n characters in set, or end if there is none.  n must be between 1 and
+ * SCAN_MAX_SET.
+ */
+extern
+const char *scan_find(const char *p, const char *end, const char *set, int n);
+
+/*
+ * Return a pointer to the first character in [p, end) that is not white
+ * space (as classified by isspace() in the "C" locale), or end if there
+ * is none.
+ */
+extern
+const char *scan_skip_space(const char *p, const char *end);
+
+#endif /* _SCAN_H_ */